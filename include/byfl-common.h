@@ -91,6 +91,19 @@ enum {
   BF_NO_ARG    = NUM_LLVM_OPCODES + 1   // No operand
 };
 
+// Define the geometry of the -bf-shadow-mem bitmap, which holds one bit per
+// byte of the low BF_SHADOW_ADDR_BITS bits of the address space.  Byte i of
+// the address space maps to bit i%8 of shadow byte i/8.
+#define BF_SHADOW_ADDR_BITS 47
+#define BF_SHADOW_BYTES ((uint64_t)1 << (BF_SHADOW_ADDR_BITS - 3))
+
+// Define the locality measurements that bf_access_data_struct_locality()
+// attributes to the data structure being accessed.
+enum {
+  BF_LOCALITY_CACHE = 1,    // Cache model (-bf-cache-model)
+  BF_LOCALITY_REUSE = 2     // Reuse distance (-bf-reuse-dist)
+};
+
 // Define a type for communicating symbol information from the plugin
 // to the run-time library.
 typedef struct {
@@ -102,6 +115,43 @@ typedef struct {
   unsigned int line;     // Line number at which the symbol appears
 } bf_symbol_info_t;
 
+// Define a type for communicating static information about a basic block
+// whose executions are counted (-bf-every-bb) from the plugin to the run-time
+// library.
+typedef struct {
+  const bf_symbol_info_t *syminfo;  // Information about the basic block's location
+  uint64_t num_insts;               // Static code size in instructions
+} bf_bb_info_t;
+
+// Define a type for communicating static information about a type of vector
+// operation whose executions are counted (-bf-vectors) from the plugin to the
+// run-time library.
+typedef struct {
+  const char *function;   // Name of the function performing the operation
+  uint64_t num_elements;  // Number of scalar elements in the vector
+  uint64_t element_bits;  // Number of bits per scalar element
+  uint8_t is_flop;        // 1=floating-point operation; 0=integer operation
+} bf_vector_info_t;
+
+// Define types for communicating a module's edge profile (-bf-edge-profile)
+// from the plugin to the run-time library.  The number of times a profile
+// point (a basic block or a conditional-branch edge) executed is a sum of
+// edge-counter values times coefficients, and each profile point adds
+// constant amounts to various counters every time it executes.
+typedef struct {
+  uint64_t point;        // Module-specific profile-point number
+  uint64_t edge;         // Module-specific edge-counter number
+  int64_t coeff;         // Multiplier for the edge counter's value
+} bf_edge_term_t;
+
+typedef struct {
+  void* counter;         // Counter or, if indirect, pointer to a counter array
+  uint64_t point;        // Module-specific profile-point number
+  uint64_t index;        // Index into the counter array (if indirect)
+  uint64_t amount;       // Amount added per execution of the profile point
+  uint64_t indirect;     // 1=counter points to a pointer to an array; 0=counter is a counter
+} bf_edge_tally_t;
+
 // Map a memory-access type to an index into bf_mem_insts_count[].
 static inline uint64_t mem_type_to_index(uint64_t memop,
                                          uint64_t memref,
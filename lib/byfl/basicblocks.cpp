@@ -40,13 +40,34 @@ extern BinaryOStream* bfbin;
 
 // Define a structure to keep track of dynamic basic-block accesss.
 struct BBAccessInfo {
-  bf_symbol_info_t syminfo;  // Information about the basic block's location
+  const bf_symbol_info_t* syminfo;  // Information about the basic block's location
   uint64_t tally;      // Number of times the basic block was executed
   uint64_t num_insts;  // Static code size in instructions
 };
 
-// Map a basic-block ID to an access tally.
-static CachedUnorderedMap<uint64_t, BBAccessInfo*>* bb_accesses;
+// Describe a module's basic-block execution counters (-bf-every-bb).
+struct BBCounts {
+  const uint64_t* counts;      // Number of times each basic block was executed
+  const bf_bb_info_t* infos;   // Static information about each basic block
+  uint64_t num_bbs;            // Number of entries in each of the above
+  vector<uint64_t> uncounted;  // Executions that occurred while counting was suppressed
+};
+
+// Keep track of every module's basic-block execution counters.
+static vector<BBCounts>* bb_counts = nullptr;
+
+// Describe a module's edge profile (-bf-edge-profile).
+struct EdgeProfile {
+  uint64_t* edge_counts;           // Number of times each counted edge was taken
+  uint64_t num_points;             // Number of profile points (basic blocks and branch edges)
+  const bf_edge_term_t* terms;     // Profile-point executions in terms of edge counts
+  uint64_t num_terms;              // Number of entries in the above
+  const bf_edge_tally_t* tallies;  // Constant counter increments of each profile point
+  uint64_t num_tallies;            // Number of entries in the above
+};
+
+// Keep track of every edge-profiled module.
+static vector<EdgeProfile>* edge_profiles = nullptr;
 
 // Initialize some of our variables at first use.
 void initialize_bblocks (void)
@@ -67,8 +88,8 @@ void initialize_bblocks (void)
   bf_mem_intrin_count = new uint64_t[BF_NUM_MEM_INTRIN];
   for (unsigned int i = 0; i < BF_NUM_MEM_INTRIN; i++)
     bf_mem_intrin_count[i] = 0;
-  if (bf_every_bb)
-    bb_accesses = new CachedUnorderedMap<uint64_t, BBAccessInfo*>;
+  if (bf_every_bb && bb_counts == nullptr)
+    bb_counts = new vector<BBCounts>;
 }
 
 // Initialize all of the basic-block counters.
@@ -368,42 +389,61 @@ void bf_reset_bb_tallies (void)
   bb_totals.reset();
 }
 
-// Keep track of dynamic basic-block accesses given a unique identifier and
-// static basic-block size in instructions.
+// Register a module's basic-block execution counters and the static
+// information describing each basic block.  This function is invoked from a
+// module constructor.
 extern "C"
-void bf_tally_bb_execution (bf_symbol_info_t* syminfo, uint64_t bb_id,
-                            uint64_t num_insts)
+void bf_register_bb_counts (const uint64_t* counts, const bf_bb_info_t* infos,
+                            uint64_t num_bbs)
 {
-  if (bf_suppress_counting)
+  if (bb_counts == nullptr)
+    bb_counts = new vector<BBCounts>;
+  BBCounts module_counts;
+  module_counts.counts = counts;
+  module_counts.infos = infos;
+  module_counts.num_bbs = num_bbs;
+  if (bf_suppress_counting) {
+    // Counting is currently suppressed (see bf_suppress_bb_counts()).
+    module_counts.uncounted.resize(num_bbs, 0);
+    for (uint64_t i = 0; i < num_bbs; i++)
+      module_counts.uncounted[i] -= counts[i];
+  }
+  bb_counts->push_back(module_counts);
+}
+
+// Exclude from the report all basic-block executions that occur while
+// counting is suppressed.  Counters are incremented unconditionally, so we
+// subtract their values when suppression begins and add them back when it
+// ends.  All arithmetic is modulo 2^64, so the final differences are exact.
+void bf_suppress_bb_counts (bool suppress)
+{
+  if (bb_counts == nullptr)
     return;
-  BBAccessInfo* bb_info;
-  auto iter = bb_accesses->find(bb_id);
-  if (iter == bb_accesses->end()) {
-    // Not found -- create a new entry.
-    bb_info = new BBAccessInfo;
-    bb_info->syminfo = *syminfo;
-    bb_info->tally = 0;
-    bb_info->num_insts = num_insts;
-    (*bb_accesses)[bb_id] = bb_info;
+  for (auto bbc_iter = bb_counts->begin(); bbc_iter != bb_counts->end(); bbc_iter++) {
+    BBCounts& module_counts = *bbc_iter;
+    if (module_counts.uncounted.empty())
+      module_counts.uncounted.resize(module_counts.num_bbs, 0);
+    for (uint64_t i = 0; i < module_counts.num_bbs; i++)
+      if (suppress)
+        module_counts.uncounted[i] -= module_counts.counts[i];
+      else
+        module_counts.uncounted[i] += module_counts.counts[i];
   }
-  else
-    bb_info = iter->second;
-  bb_info->tally++;
 }
 
 // Compare two basic blocks, reporting which was called more times.  Break ties
 // by comparing instruction counts, then file names, then line numbers.
-static bool compare_bb_accesses (const BBAccessInfo* one,
-                                 const BBAccessInfo* two)
+static bool compare_bb_accesses (const BBAccessInfo& one,
+                                 const BBAccessInfo& two)
 {
-  if (one->tally != two->tally)
-    return one->tally > two->tally;
-  if (one->num_insts != two->num_insts)
-    return one->num_insts > two->num_insts;
-  int file_comp = strcmp(one->syminfo.file, two->syminfo.file);
+  if (one.tally != two.tally)
+    return one.tally > two.tally;
+  if (one.num_insts != two.num_insts)
+    return one.num_insts > two.num_insts;
+  int file_comp = strcmp(one.syminfo->file, two.syminfo->file);
   if (file_comp != 0)
     return file_comp == -1;
-  return one->syminfo.line < two->syminfo.line;
+  return one.syminfo->line < two.syminfo->line;
 }
 
 // Output the number of accesses to each basic block.
@@ -419,16 +459,38 @@ void bf_report_bb_execution (void)
          << uint8_t(BINOUT_COL_UINT64) << "Line number"
          << uint8_t(BINOUT_COL_NONE);
 
+  // Merge all modules' counters into a single list of executed basic blocks.
+  // If counting is currently suppressed, temporarily account for the
+  // executions that occurred since suppression began.
+  if (bb_counts == nullptr)
+    bb_counts = new vector<BBCounts>;
+  if (bf_suppress_counting)
+    bf_suppress_bb_counts(false);
+  vector<BBAccessInfo> unique_bbs;
+  for (auto bbc_iter = bb_counts->begin(); bbc_iter != bb_counts->end(); bbc_iter++) {
+    const BBCounts& module_counts = *bbc_iter;
+    for (uint64_t i = 0; i < module_counts.num_bbs; i++) {
+      BBAccessInfo bb_info;
+      bb_info.tally = module_counts.counts[i];
+      if (!module_counts.uncounted.empty())
+        bb_info.tally -= module_counts.uncounted[i];
+      if (bb_info.tally == 0)
+        continue;
+      bb_info.syminfo = module_counts.infos[i].syminfo;
+      bb_info.num_insts = module_counts.infos[i].num_insts;
+      unique_bbs.push_back(bb_info);
+    }
+  }
+  if (bf_suppress_counting)
+    bf_suppress_bb_counts(true);
+
   // Sort the list of basic blocks in decreasing order of access count.
-  vector<BBAccessInfo*> unique_bbs;
-  for (auto iter = bb_accesses->begin(); iter != bb_accesses->end(); iter++)
-    unique_bbs.push_back(iter->second);
   sort(unique_bbs.begin(), unique_bbs.end(), compare_bb_accesses);
 
   // Output each basic block in turn.
   for (auto iter = unique_bbs.begin(); iter != unique_bbs.end(); iter++) {
-    BBAccessInfo* bb_info = *iter;
-    bf_symbol_info_t* syminfo = &bb_info->syminfo;
+    const BBAccessInfo* bb_info = &*iter;
+    const bf_symbol_info_t* syminfo = bb_info->syminfo;
     *bfbin << uint8_t(BINOUT_ROW_DATA)
            << bb_info->tally
            << bb_info->num_insts
@@ -620,6 +682,59 @@ void bf_assoc_counters_with_func (KeyType_t funcID)
   }
 }
 
+// Register a module's edge profile and its statically allocated edge
+// counters.  This function is invoked from a module constructor.
+extern "C"
+void bf_register_edge_profile (uint64_t* edge_counts, uint64_t num_counts,
+                               uint64_t num_points,
+                               const bf_edge_term_t* terms, uint64_t num_terms,
+                               const bf_edge_tally_t* tallies, uint64_t num_tallies)
+{
+  if (edge_profiles == nullptr)
+    edge_profiles = new vector<EdgeProfile>;
+  EdgeProfile profile;
+  profile.edge_counts = edge_counts;
+  profile.num_points = num_points;
+  profile.terms = terms;
+  profile.num_terms = num_terms;
+  profile.tallies = tallies;
+  profile.num_tallies = num_tallies;
+  edge_profiles->push_back(profile);
+}
+
+// Add to the counter variables (bf_*_count) the increments implied by every
+// module's edge profile.
+static void reconstruct_edge_profiles (void)
+{
+  if (edge_profiles == nullptr)
+    return;
+  for (auto ep_iter = edge_profiles->begin(); ep_iter != edge_profiles->end(); ep_iter++) {
+    // Compute the number of times each profile point executed.  Terms may
+    // have negative coefficients, but all arithmetic is modulo 2^64 so the
+    // final sums are exact.
+    const EdgeProfile& profile = *ep_iter;
+    vector<uint64_t> executions(profile.num_points, 0);
+    for (uint64_t t = 0; t < profile.num_terms; t++) {
+      const bf_edge_term_t& term = profile.terms[t];
+      executions[term.point] += uint64_t(term.coeff)*profile.edge_counts[term.edge];
+    }
+
+    // Increment each counter by the appropriate multiple of each profile
+    // point's executions.
+    for (uint64_t t = 0; t < profile.num_tallies; t++) {
+      const bf_edge_tally_t& tally = profile.tallies[t];
+      uint64_t* counter = (uint64_t*) tally.counter;
+      if (tally.indirect) {
+        counter = *(uint64_t**) tally.counter;
+        if (counter == nullptr)
+          continue;
+        counter += tally.index;
+      }
+      *counter += executions[tally.point]*tally.amount;
+    }
+  }
+}
+
 // Finalize the basic-block tallies at the end of the run.
 void finalize_bblocks (void)
 {
@@ -633,21 +748,22 @@ void finalize_bblocks (void)
   else {
     // If we're not instrumented on the basic-block level, then we need to
     // accumulate the current values of all of our counters into the global
-    // totals.
-    if (!bf_every_bb)
-      global_totals.accumulate(bf_mem_insts_count,
-                               bf_inst_mix_histo,
-                               bf_terminator_count,
-                               bf_mem_intrin_count,
-                               bf_load_count,
-                               bf_store_count,
-                               bf_load_ins_count,
-                               bf_store_ins_count,
-                               bf_call_ins_count,
-                               bf_flop_count,
-                               bf_fp_bits_count,
-                               bf_op_count,
-                               bf_op_bits_count);
+    // totals.  First, add in whatever counts we reconstruct from the edge
+    // profile.
+    reconstruct_edge_profiles();
+    global_totals.accumulate(bf_mem_insts_count,
+                             bf_inst_mix_histo,
+                             bf_terminator_count,
+                             bf_mem_intrin_count,
+                             bf_load_count,
+                             bf_store_count,
+                             bf_load_ins_count,
+                             bf_store_ins_count,
+                             bf_call_ins_count,
+                             bf_flop_count,
+                             bf_fp_bits_count,
+                             bf_op_count,
+                             bf_op_bits_count);
 
     // If the global counter totals are empty, this means that we were tallying
     // per-function data and resetting the global counts after each tally.  We
@@ -0,0 +1,150 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (log/linear binned histogram)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#ifndef _BINNEDHIST_H_
+#define _BINNEDHIST_H_
+
+#include "byfl.h"
+
+using namespace std;
+
+namespace bytesflops {
+
+// A BinnedHistogram tallies 64-bit values into a fixed number of bins.  Small
+// values each get a bin of their own.  Larger values are grouped by power of
+// two, and each power of two is divided linearly into sub_bins bins.  The
+// relative error of a value's bin is therefore at most 1/sub_bins, and memory
+// usage is independent of the largest value tallied.
+class BinnedHistogram {
+public:
+  static const unsigned int sub_bits = 5;                  // Log base 2 of the number of bins per power of two
+  static const uint64_t sub_bins = uint64_t(1) << sub_bits;  // Number of bins per power of two
+  static const size_t num_bins = (64 - sub_bits + 1)*sub_bins;   // Total number of bins
+
+private:
+  uint64_t tally[num_bins];    // Number of values that landed in each bin
+  size_t used_bins;            // One more than the largest nonempty bin
+  uint64_t total_tally;        // Sum of all bins
+
+public:
+  // Initialize an empty histogram.
+  BinnedHistogram() {
+    clear();
+  }
+
+  // Empty the histogram.
+  void clear() {
+    memset(tally, 0, sizeof(tally));
+    used_bins = 0;
+    total_tally = 0;
+  }
+
+  // Map a value to a bin number.
+  static size_t bin_of(uint64_t value) {
+    if (value < 2*sub_bins)
+      return size_t(value);
+    unsigned int shift = 63 - __builtin_clzll(value) - sub_bits;
+    return size_t(shift)*sub_bins + size_t(value >> shift);
+  }
+
+  // Return the smallest value that maps to a given bin.
+  static uint64_t bin_low(size_t bin) {
+    if (bin < 2*sub_bins)
+      return uint64_t(bin);
+    unsigned int shift = unsigned(bin/sub_bins) - 1;
+    return uint64_t(bin - shift*sub_bins) << shift;
+  }
+
+  // Return the number of distinct values that map to a given bin.
+  static uint64_t bin_width(size_t bin) {
+    if (bin < 2*sub_bins)
+      return 1;
+    return uint64_t(1) << (bin/sub_bins - 1);
+  }
+
+  // Return a value representative of all values in a given bin (the
+  // bin's midpoint).
+  static uint64_t bin_value(size_t bin) {
+    return bin_low(bin) + bin_width(bin)/2;
+  }
+
+  // Increment the bin corresponding to a given value.
+  void increment(uint64_t value, uint64_t count=1) {
+    size_t bin = bin_of(value);
+    tally[bin] += count;
+    total_tally += count;
+    if (bin >= used_bins)
+      used_bins = bin + 1;
+  }
+
+  // Return the tally associated with a given bin.
+  uint64_t operator[](size_t bin) const {
+    return tally[bin];
+  }
+
+  // Return one more than the largest nonempty bin.
+  size_t size() const {
+    return used_bins;
+  }
+
+  // Return the sum of all bins.
+  uint64_t total() const {
+    return total_tally;
+  }
+};
+
+// A SparseBinnedHistogram tallies values into the same bins as a
+// BinnedHistogram but stores only the nonempty bins, sorted by bin number.
+// It suits the many histograms kept per data structure, most of which use
+// only a few bins.
+class SparseBinnedHistogram {
+private:
+  typedef pair<size_t, uint64_t> bin_tally_t;   // {bin number, tally}
+  vector<bin_tally_t> tally;   // Tally of each nonempty bin
+  uint64_t total_tally;        // Sum of all bins
+
+  // Increment a given bin by a given count.
+  void increment_bin(size_t bin, uint64_t count) {
+    auto iter = lower_bound(tally.begin(), tally.end(), bin_tally_t(bin, 0));
+    if (iter != tally.end() && iter->first == bin)
+      iter->second += count;
+    else
+      tally.insert(iter, bin_tally_t(bin, count));
+    total_tally += count;
+  }
+
+public:
+  // Initialize an empty histogram.
+  SparseBinnedHistogram() : total_tally(0) { }
+
+  // Increment the bin corresponding to a given value.
+  void increment(uint64_t value, uint64_t count=1) {
+    increment_bin(BinnedHistogram::bin_of(value), count);
+  }
+
+  // Add another histogram's tallies to this one.
+  void merge(const SparseBinnedHistogram& other) {
+    for (auto iter = other.tally.cbegin(); iter != other.tally.cend(); iter++)
+      increment_bin(iter->first, iter->second);
+  }
+
+  // Copy the histogram into a BinnedHistogram, replacing its contents.
+  void expand(BinnedHistogram& dense) const {
+    dense.clear();
+    for (auto iter = tally.cbegin(); iter != tally.cend(); iter++)
+      dense.increment(BinnedHistogram::bin_low(iter->first), iter->second);
+  }
+
+  // Return the sum of all bins.
+  uint64_t total() const {
+    return total_tally;
+  }
+};
+
+} // namespace bytesflops
+
+#endif
@@ -180,6 +180,7 @@ void bf_initialize_if_necessary (void)
     initialize_data_structures();
     initialize_strides();
     initialize_cache();
+    initialize_working_set();
     initialized = true;
   }
 }
@@ -196,6 +197,10 @@ extern "C"
 void bf_enable_counting (int enable)
 {
   bf_reset_bb_tallies();
+  if (bf_every_bb && bf_suppress_counting == bool(enable))
+    bf_suppress_bb_counts(!bool(enable));
+  if (bf_vectors && bf_suppress_counting == bool(enable))
+    bf_suppress_vector_counts(!bool(enable));
   bf_suppress_counting = !bool(enable);
 }
 
@@ -688,7 +693,7 @@ private:
     uint64_t global_bytes = counter_totals.loads + counter_totals.stores;
     uint64_t global_mem_ops = counter_totals.load_ins + counter_totals.store_ins;
     uint64_t global_unique_bytes = 0;
-    vector<uint64_t>* reuse_hist;   // Histogram of reuse distances
+    BinnedHistogram* reuse_hist;    // Histogram of reuse distances
     uint64_t reuse_unique;          // Unique bytes as measured by the reuse-distance calculator
     bf_get_reuse_distance(&reuse_hist, &reuse_unique);
     if (reuse_unique > 0)
@@ -696,6 +701,10 @@ private:
     else
       if (bf_unique_bytes && !partition)
         global_unique_bytes = bf_mem_footprint ? bf_tally_unique_addresses_tb() : bf_tally_unique_addresses();
+    bool unique_approx = bf_unique_approx && reuse_unique == 0;   // true=global_unique_bytes is a HyperLogLog estimate
+    uint64_t unique_std_error = 0;   // Standard error of an approximate global_unique_bytes
+    if (unique_approx)
+      unique_std_error = uint64_t(llround(double(global_unique_bytes)*HyperLogLog::relative_error()));
     uint64_t uti = 0, mti = 0;
     if (bf_unique_bytes && bf_strides && !partition)
       bf_partition_unique_addresses(&uti, &mti);
@@ -760,9 +769,15 @@ private:
         *bfout << tag << ": " << setw(25) << global_unique_bytes << " unique bytes ("
                << uti << " from single-target loads and stores + "
                << mti << " from multiple-target loads and stores - "
-               << uti + mti - global_unique_bytes << " overlapped)\n";
+               << (uti + mti > global_unique_bytes ? uti + mti - global_unique_bytes : 0)
+               << " overlapped)\n";
         else
           *bfout << tag << ": " << setw(25) << global_unique_bytes << " unique bytes\n";
+      if (unique_approx)
+        *bfout << tag << ": " << setw(25) << unique_std_error
+               << " bytes of standard error in the unique-byte estimates ("
+               << fixed << setprecision(2) << HyperLogLog::relative_error()*100.0
+               << "%)\n";
     }
     if (bf_mem_footprint && !partition)
       *bfout << tag << ": " << setw(25) << bytes_for_50pct_hits
@@ -847,6 +862,10 @@ private:
       *bfbin << uint8_t(BINOUT_COL_UINT64)
              << "Unique addresses loaded or stored"
              << global_unique_bytes;
+      if (unique_approx)
+        *bfbin << uint8_t(BINOUT_COL_UINT64)
+               << "Standard error of unique addresses"
+               << unique_std_error;
       if (bf_strides)
         *bfbin << uint8_t(BINOUT_COL_UINT64)
                << "Unique addresses from single-target loads and stores"
@@ -869,8 +888,11 @@ private:
       if (median_value == ~(uint64_t)0)
         *bfout << "infinite" << " median reuse distance\n";
       else
-        *bfout << median_value << " median reuse distance (+/- "
-               << mad_value << ")\n";
+        if (mad_value == ~(uint64_t)0)
+          *bfout << median_value << " median reuse distance (+/- infinity)\n";
+        else
+          *bfout << median_value << " median reuse distance (+/- "
+                 << mad_value << ")\n";
       *bfbin << uint8_t(BINOUT_COL_UINT64)
              << "Median reuse distance"
              << median_value;
@@ -1058,16 +1080,22 @@ private:
       *bfbin << uint8_t(BINOUT_ROW_NONE);
     }
 
-    // Output a table of reuse distances in binary format.
+    // Output a table of reuse distances in binary format.  Each row
+    // represents the distances from "Distance in bytes" up to but not
+    // including "Distance in bytes" plus "Bin width".
     if (reuse_unique > 0) {
       *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Reuse distance";
       *bfbin << uint8_t(BINOUT_COL_UINT64) << "Distance in bytes"
+             << uint8_t(BINOUT_COL_UINT64) << "Bin width"
              << uint8_t(BINOUT_COL_UINT64) << "Tally"
              << uint8_t(BINOUT_COL_NONE);
-      uint64_t dist = 0;
-      for (auto iter = reuse_hist->begin(); iter != reuse_hist->end(); iter++, dist++)
-        if (*iter > 0)
-          *bfbin << uint8_t(BINOUT_ROW_DATA) << dist << *iter;
+      size_t num_bins = reuse_hist->size();
+      for (size_t bin = 0; bin < num_bins; bin++)
+        if ((*reuse_hist)[bin] > 0)
+          *bfbin << uint8_t(BINOUT_ROW_DATA)
+                 << BinnedHistogram::bin_low(bin)
+                 << BinnedHistogram::bin_width(bin)
+                 << (*reuse_hist)[bin];
       *bfbin << uint8_t(BINOUT_ROW_NONE);
     }
 
@@ -1232,6 +1260,75 @@ private:
            << uint8_t(BINOUT_COL_NONE);
   }
 
+  // Report miss-ratio curves (misses versus cache capacity) derived from the
+  // reuse-distance histogram and from the cache model, whichever are
+  // available.
+  void report_miss_ratio_curves (void) {
+    // Compute a curve for each source of data.
+    vector<string> models;                   // Name of each curve's source
+    vector<uint64_t> accesses;               // Total accesses for each curve
+    vector<vector<bf_mrc_point_t> > curves;  // {bytes, misses} pairs for each curve
+    BinnedHistogram* reuse_hist;
+    uint64_t reuse_unique;
+    bf_get_reuse_distance(&reuse_hist, &reuse_unique);
+    if (reuse_unique > 0) {
+      models.push_back("Reuse distance");
+      accesses.push_back(0);
+      curves.push_back(vector<bf_mrc_point_t>());
+      bf_get_reuse_miss_ratio_curve(curves.back(), &accesses.back());
+    }
+    if (bf_cache_model) {
+      models.push_back("Private cache");
+      accesses.push_back(bf_get_private_cache_accesses());
+      curves.push_back(vector<bf_mrc_point_t>());
+      bf_get_cache_miss_ratio_curve(bf_get_private_cache_hits(), accesses.back(), curves.back());
+      models.push_back("Shared cache");
+      accesses.push_back(bf_get_shared_cache_accesses());
+      curves.push_back(vector<bf_mrc_point_t>());
+      bf_get_cache_miss_ratio_curve(bf_get_shared_cache_hits(), accesses.back(), curves.back());
+    }
+    if (models.empty())
+      return;
+
+    // Output each curve in binary format and its knees in textual format.
+    string tag(bf_output_prefix + "BYFL_SUMMARY");
+    bool wrote_text = false;
+    *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Miss ratio curve";
+    *bfbin << uint8_t(BINOUT_COL_STRING) << "Model"
+           << uint8_t(BINOUT_COL_UINT64) << "Capacity in bytes"
+           << uint8_t(BINOUT_COL_UINT64) << "Accesses"
+           << uint8_t(BINOUT_COL_UINT64) << "Misses"
+           << uint8_t(BINOUT_COL_BOOL) << "Knee"
+           << uint8_t(BINOUT_COL_NONE);
+    for (size_t m = 0; m < models.size(); m++) {
+      vector<bool> is_knee;
+      bf_find_miss_ratio_knees(curves[m], accesses[m], is_knee);
+      stringstream knees;
+      knees.imbue(bfout->getloc());
+      for (size_t i = 0; i < curves[m].size(); i++) {
+        *bfbin << uint8_t(BINOUT_ROW_DATA)
+               << models[m]
+               << curves[m][i].first
+               << accesses[m]
+               << curves[m][i].second
+               << bool(is_knee[i]);
+        if (is_knee[i])
+          knees << (knees.tellp() > 0 ? " " : "") << curves[m][i].first;
+      }
+      if (knees.tellp() > 0) {
+        string model_name(models[m]);
+        transform(model_name.begin(), model_name.end(), model_name.begin(), ::tolower);
+        *bfout << tag << ": " << setw(25) << knees.str()
+               << " byte capacities at miss-ratio-curve knees ("
+               << model_name << ")\n";
+        wrote_text = true;
+      }
+    }
+    *bfbin << uint8_t(BINOUT_ROW_NONE);
+    if (wrote_text)
+      *bfout << tag << ": " << separator << '\n';
+  }
+
   // Report miscellaneous information in the binary output file.
   void report_misc_info() {
     // Report the list of environment variables that are currently active.
@@ -1290,6 +1387,9 @@ private:
       free(optstr);
     }
 
+    // Report the logical page size each analysis used.
+    PageSizeChooser::report_all();
+
     // Report bits of system information that may be useful for reproducibility.
     *bfbin << uint8_t(BINOUT_TABLE_KEYVAL) << "System information";
     *bfbin << uint8_t(BINOUT_COL_STRING) << "Byfl version" << PACKAGE_VERSION;
@@ -1361,10 +1461,18 @@ public:
     if (bf_data_structs)
       bf_report_data_struct_counts();
 
+    // Report the heap footprint over time if requested.
+    if (bf_heap_events > 0 || bf_heap_ms > 0)
+      bf_report_heap_footprint();
+
     // Report stride information if requested.
     if (bf_strides)
       bf_report_strides_by_call_point();
 
+    // Report the working set over time if requested.
+    if (bf_epoch_ops > 0 || bf_epoch_ms > 0)
+      bf_report_working_set();
+
     // Report user-defined counter totals, if any.
     vector<const char*>* all_tag_names = user_defined_totals().sorted_keys(compare_char_stars);
     for (vector<const char*>::const_iterator tag_iter = all_tag_names->cbegin();
@@ -1381,6 +1489,9 @@ public:
     if (bf_cache_model)
       report_cache(global_totals);
 
+    // Report miss-ratio curves if we have data from which to derive them.
+    report_miss_ratio_curves();
+
     // Report anything else we can think to report.
     report_misc_info();
 
@@ -13,6 +13,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <functional>
 #include <inttypes.h>
 #include <iomanip>
 #include <iostream>
@@ -37,6 +38,8 @@ namespace bytesflops {
 #include "byfl-common.h"
 #include "cachemap.h"
 #include "pagetable.h"
+#include "binnedhist.h"
+#include "hyperloglog.h"
 #include "binaryoutput.h"
 
 // The following constants are defined by the instrumented code.
@@ -54,12 +57,21 @@ extern uint8_t  bf_tally_inst_mix;   // 1=maintain instruction-mix histogram
 extern uint8_t  bf_tally_inst_deps;  // 1=maintain instruction-dependency histogram
 extern uint8_t  bf_types;            // 1=count loads/stores per type
 extern uint8_t  bf_unique_bytes;     // 1=tally and output unique bytes
+extern uint8_t  bf_shadow_mem;       // 1=track unique bytes in a shadow-memory bitmap
+extern uint8_t  bf_unique_approx;    // 1=estimate unique bytes with HyperLogLog sketches
+extern uint64_t bf_unique_granularity;  // Bytes per granule when estimating unique bytes
 extern uint8_t  bf_vectors;          // 1=bin then output vector characteristics
 extern uint8_t  bf_cache_model;      // 1=use the simple cache model
 extern uint8_t  bf_data_structs;     // 1=tally and output counters by data structure
 extern uint8_t  bf_strides;          // 1=tally and output information about access strides
+extern uint8_t  bf_thread_safe;      // 1=guard against simultaneous updates from multiple threads
 extern uint64_t bf_line_size;        // cache line size in bytes
 extern uint64_t bf_max_set_bits;     // log base 2 of max number of sets to model
+extern uint64_t bf_epoch_ops;        // Memory operations per working-set epoch (0=none)
+extern uint64_t bf_epoch_ms;         // Milliseconds per working-set epoch (0=none)
+extern uint64_t bf_heap_events;      // Allocation events per heap-footprint sample (0=none)
+extern uint64_t bf_heap_ms;          // Milliseconds per heap-footprint sample (0=none)
+extern uint64_t bf_alloc_context;    // Callers per heap-allocation context (0=none)
 
 // The following globals are defined by the instrumented code.
 extern uint64_t bf_fmap_cnt;
@@ -72,25 +84,79 @@ extern "C" {
 namespace bytesflops {
   const bytecount_t bf_max_bytecount = ~(bytecount_t)(0);  // Clamp to this value
   typedef pair<bytecount_t, uint64_t> bf_addr_tally_t;  // Number of times a count was seen ({count, multiplier})
+  typedef pair<uint64_t, uint64_t> bf_mrc_point_t;      // Misses at a given cache capacity ({bytes, misses})
+
+  // Tally the cache model's and the reuse-distance tracker's view of the
+  // accesses to a single data structure.
+  class LocalityStats {
+  public:
+    uint64_t cache_accesses = 0;   // Number of line accesses in the private cache model
+    uint64_t cold_misses = 0;      // Number of those line accesses that were cold misses
+    SparseBinnedHistogram cache_dist;  // LRU stack distance in lines of each remaining line access
+    uint64_t reuse_unique = 0;     // Number of bytes accessed with an infinite reuse distance
+    SparseBinnedHistogram reuse_dist;  // Reuse distance in bytes of each remaining byte accessed
+
+    // Tally a line access given the number of lines searched to find it (0
+    // for a cold miss).
+    void record_cache (uint64_t lines_searched) {
+      cache_accesses++;
+      if (lines_searched == 0)
+        cold_misses++;
+      else
+        cache_dist.increment(lines_searched - 1);
+    }
+
+    // Tally a byte access given its reuse distance (~0 for infinite).
+    void record_reuse (uint64_t distance) {
+      if (distance == ~uint64_t(0))
+        reuse_unique++;
+      else
+        reuse_dist.increment(distance);
+    }
+
+    // Add another set of statistics to this one.
+    void merge (const LocalityStats& other) {
+      cache_accesses += other.cache_accesses;
+      cold_misses += other.cold_misses;
+      reuse_unique += other.reuse_unique;
+      cache_dist.merge(other.cache_dist);
+      reuse_dist.merge(other.reuse_dist);
+    }
+  };
 
   // The following library functions are used in files other than the
   // one in which they're defined.
   extern void bf_get_address_tally_hist (vector<bf_addr_tally_t>& histogram, uint64_t* total);
   extern void bf_get_median_reuse_distance(uint64_t* median_value, uint64_t* mad_value);
-  extern void bf_get_reuse_distance(vector<uint64_t>** hist, uint64_t* unique_addrs);
+  extern void bf_get_reuse_distance(BinnedHistogram** hist, uint64_t* unique_addrs);
+  extern void bf_compute_median_distance(const BinnedHistogram& hist, uint64_t unique_entries, uint64_t* median_value, uint64_t* mad_value);
+  extern void bf_get_binned_miss_ratio_curve(const BinnedHistogram& hist, uint64_t accesses, uint64_t unit_bytes, vector<bf_mrc_point_t>& curve);
+  extern void bf_get_reuse_miss_ratio_curve(vector<bf_mrc_point_t>& curve, uint64_t* accesses);
+  extern void bf_get_cache_miss_ratio_curve(const vector<unordered_map<uint64_t,uint64_t> >& hits, uint64_t accesses, vector<bf_mrc_point_t>& curve);
+  extern void bf_find_miss_ratio_knees(const vector<bf_mrc_point_t>& curve, uint64_t accesses, vector<bool>& is_knee);
   extern void bf_get_vector_statistics(const char* tag, uint64_t* num_ops, uint64_t* total_elts, uint64_t* total_bits);
   extern void bf_get_vector_statistics(uint64_t* num_ops, uint64_t* total_elts, uint64_t* total_bits);
   extern void bf_abend(void) __attribute__ ((noreturn));
   extern void bf_report_vector_operations(void);
   extern void bf_report_data_struct_counts(void);
+  extern void bf_report_heap_footprint(void);
+  extern void bf_reuse_dist_addrs(uint64_t baseaddr, uint64_t numaddrs, LocalityStats* stats);
+  extern void bf_touch_cache(uint64_t baseaddr, uint64_t numaddrs);
+  extern void bf_touch_cache(uint64_t baseaddr, uint64_t numaddrs, LocalityStats* stats);
   extern void bf_report_bb_execution(void);
+  extern void bf_suppress_bb_counts(bool suppress);
+  extern void bf_suppress_vector_counts(bool suppress);
   extern void bf_partition_unique_addresses(uint64_t* uti, uint64_t *mti);
   extern void bf_report_strides_by_call_point(void);
+  extern void bf_report_working_set(void);
+  extern uint64_t bf_current_ms(void);
   extern uint64_t bf_tally_unique_addresses(const char* funcname);
   extern uint64_t bf_tally_unique_addresses_tb(const char* funcname);
   extern uint64_t bf_tally_unique_addresses_tb(void);
   extern uint64_t bf_tally_unique_addresses(void);
   extern "C" const char* bf_string_to_symbol(const char *nonunique);
+  extern "C" void bf_acquire_mega_lock(void);
+  extern "C" void bf_release_mega_lock(void);
   extern void initialize_byfl(void);
   extern void initialize_bblocks(void);
   extern void initialize_reuse(void);
@@ -102,6 +168,7 @@ namespace bytesflops {
   extern void initialize_data_structures(void);
   extern void initialize_strides(void);
   extern void initialize_cache(void);
+  extern void initialize_working_set(void);
   extern void finalize_bblocks(void);
   extern uint64_t bf_get_private_cache_accesses(void);
   extern vector<unordered_map<uint64_t,uint64_t> > bf_get_private_cache_hits(void);
@@ -110,6 +177,8 @@ namespace bytesflops {
   extern uint64_t bf_get_shared_cache_accesses(void);
   extern vector<unordered_map<uint64_t,uint64_t> > bf_get_shared_cache_hits(void);
   extern uint64_t bf_get_shared_cold_misses(void);
+  extern size_t bf_report_threads(void);
+  extern void bf_run_in_parallel(const function<void(size_t, size_t)>& work);
   extern uint64_t bf_get_shared_misaligned_mem_ops(void);
   extern vector<unordered_map<uint64_t,uint64_t> > bf_get_remote_shared_cache_hits(void);
   extern bool suppress_output(void);
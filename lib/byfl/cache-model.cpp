@@ -20,7 +20,7 @@ using namespace std;
 
 class Cache {
   public:
-    void access(uint64_t baseaddr, uint64_t numaddrs);
+    void access(uint64_t baseaddr, uint64_t numaddrs, LocalityStats* stats);
     Cache(uint64_t line_size, uint64_t max_set_bits, bool record_thread_id) :
       line_size_{line_size}, accesses_{0}, misaligned_mem_ops_{0},
       log2_line_size_{0}, max_set_bits_{max_set_bits}, cold_misses_{0},
@@ -60,7 +60,7 @@ inline int Cache::getRightMatch(uint64_t a, uint64_t b){
   return __builtin_ctzll(diff_bits);
 }
 
-void Cache::access(uint64_t baseaddr, uint64_t numaddrs){
+void Cache::access(uint64_t baseaddr, uint64_t numaddrs, LocalityStats* stats){
   uint64_t num_accesses = 0; // running total of number of lines accessed
   for(uint64_t addr = baseaddr / line_size_ * line_size_;
       addr <= (baseaddr + numaddrs - 1) / line_size_ * line_size_;
@@ -102,8 +102,14 @@ void Cache::access(uint64_t baseaddr, uint64_t numaddrs){
           ++remote_hits_[set][idx];
         }
       }
+      if(stats != nullptr){
+        stats->record_cache(right_match_tally[0]);
+      }
     } else {
       ++cold_misses_;
+      if(stats != nullptr){
+        stats->record_cache(0);
+      }
     }
 
     // move up this address to mru position
@@ -137,6 +143,12 @@ void initialize_cache(void){
 
 // Access the cache model with this address.
 void bf_touch_cache(uint64_t baseaddr, uint64_t numaddrs){
+  bf_touch_cache(baseaddr, numaddrs, nullptr);
+}
+
+// Access the cache model with this address, and tally the private cache's
+// view of the access in a set of locality statistics if one is provided.
+void bf_touch_cache(uint64_t baseaddr, uint64_t numaddrs, LocalityStats* stats){
   if(cache == nullptr){
     // Only let one thread update caches at a time.
     lock_guard<mutex> guard(cache_vector_mutex);
@@ -144,9 +156,9 @@ void bf_touch_cache(uint64_t baseaddr, uint64_t numaddrs){
     caches->push_back(cache);
     cache_id = thread_counter++;
   }
-  cache->access(baseaddr, numaddrs);
+  cache->access(baseaddr, numaddrs, stats);
   lock_guard<mutex> guard(global_cache_mutex);
-  global_cache->access(baseaddr, numaddrs);
+  global_cache->access(baseaddr, numaddrs, nullptr);
 }
 
 // Get cache accesses
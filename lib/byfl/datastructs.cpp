@@ -5,27 +5,33 @@
  * By Scott Pakin <pakin@lanl.gov>
  */
 
+#include <atomic>
+#include <mutex>
+#include <link.h>
+
 #include "byfl.h"
+#include "intervalindex.h"
 
 using namespace std;
 
-// Define an {ID, tag} pair.
+// Define an {ID, tag} pair, optionally qualified by an allocation context.
 class ID_tag {
 public:
-  uint64_t ID;     // Unique call-point ID
-  string tag;      // User-specified tag
+  uint64_t ID;       // Unique call-point ID
+  string tag;        // User-specified tag
+  uint64_t context;  // Allocation-context ID (0=none)
 
-  ID_tag(uint64_t i=0, string t="") : ID(i), tag(t) { }
+  ID_tag(uint64_t i=0, string t="", uint64_t c=0) : ID(i), tag(t), context(c) { }
 
   bool operator==(const ID_tag& other) const {
-    return ID == other.ID && tag == other.tag;
+    return ID == other.ID && tag == other.tag && context == other.context;
   }
 };
 namespace std {
   template <>
   struct hash<ID_tag> {
     size_t operator()(const ID_tag& idt) const {
-      return hash<uint64_t>()(idt.ID) ^ hash<string>()(idt.tag);
+      return hash<uint64_t>()(idt.ID ^ idt.context) ^ hash<string>()(idt.tag);
     }
   };
 }
@@ -34,42 +40,24 @@ namespace bytesflops {
 
 extern BinaryOStream* bfbin;
 static bool output_ds_tags = false;  // true: user called bf_tag_data_region() at least once; false=no calls
-static uint64_t dstruct_time = 1;    // Current allocation "time"
+static bool output_ds_contexts = false;  // true: at least one allocation context was captured; false=none
+static atomic<uint64_t> dstruct_time(1);          // Current allocation "time"
+static atomic<size_t> num_dstruct_counters(0);    // Number of sets of counters created so far
 
-// Define an interval-tree type.
-template<typename T>
-class Interval
+// Advance the global "time" counter and return its previous value.  Only
+// thread-safe runs pay for an atomic read-modify-write.
+static inline uint64_t next_dstruct_time (void)
 {
-public:
-  T lower;    // Lower limit
-  T upper;    // Upper limit
-
-  Interval() { }
-
-  Interval(T ll, T ul) : lower(ll), upper(ul) {
-  }
-
-  bool operator<(const Interval<T>& other) const {
-    return upper < other.lower;
-  }
-
-  bool operator>(const Interval<T>& other) const {
-    return lower > other.upper;
-  }
-
-  // Equality is defined as not less than and not greater than.
-  bool operator==(const Interval<T>& other) const {
-    return !(*this < other) && !(*this > other);
-  }
-
-  friend ostream& operator<<(ostream& os, const Interval<T>& val) {
-    os << '[' << val.lower << ", " << val.upper << ']';
-    return os;
-  }
-};
+  if (bf_thread_safe)
+    return dstruct_time.fetch_add(1, memory_order_relaxed);
+  uint64_t now = dstruct_time.load(memory_order_relaxed);
+  dstruct_time.store(now + 1, memory_order_relaxed);
+  return now;
+}
 
 // Define all of the counters and other information we keep track of
-// per data structure.
+// per data structure.  Access counters are accumulated per thread and merged
+// in only at report time; allocation counters are updated in place.
 class DataStructCounters
 {
 public:
@@ -84,20 +72,35 @@ public:
   uint64_t bytes_alloced = 0; // Total number of bytes allocated (always >= max_size)
   uint64_t num_allocs = 0;    // Number of allocation calls
   string tag = "";            // User-specified tag
+  uint64_t context = 0;       // Allocation-context ID (0=none)
+  string context_desc = "";   // Description of the allocation context
   uint64_t alloc_time = 0;    // Allocation "time" on a global counter
   uint64_t access1_time = 0;  // First access "time" on a global counter
   uint64_t accessN_time = 0;  // Last access "time" on a global counter
   uint64_t free_time = 0;     // Deallocation "time" on a global counter
+  size_t number;              // Index of these counters into each thread's access deltas
+  mutex alloc_mutex;          // Lock protecting the allocation counters
+  bool heap = false;          // true=allocated on the heap; false=static, stack, or unknown
+  LocalityStats* locality = nullptr;  // Cache and reuse measurements, if any
+
+  // The following are used only for the heap timeline and are protected by
+  // heap_mutex.
+  bool heap_dirty = false;        // true=footprint changed since the last sample
+  uint64_t heap_bytes = 0;        // Number of bytes currently live
+  uint64_t sampled_bytes = 0;     // Number of bytes live as of the last sample
+  uint64_t peak_bytes = 0;        // Number of bytes live at the heap's high-water mark (sometimes)
+  uint64_t last_heap_change = 0;  // Heap-change number of the most recent change in footprint
 
   // The minimum we need to initialize are the data structure's initial size
-  // (which can grow), symbol information, and whether the data structure comes
-  // from an explicit allocation or an access to an unknown address.
-  DataStructCounters(bf_symbol_info_t sinfo, uint64_t sz, bool alloc) :
+  // (which can grow), symbol information, whether the data structure comes
+  // from an explicit allocation or an access to an unknown address, and its
+  // allocation time.
+  DataStructCounters(bf_symbol_info_t sinfo, uint64_t sz, bool alloc, uint64_t atime) :
     syminfo(sinfo), current_size(sz), max_size(sz), allocation(alloc),
-    bytes_alloced(sz), num_allocs(1), tag(""),
+    bytes_alloced(sz), num_allocs(1), tag(""), alloc_time(atime),
     access1_time(0), accessN_time(0), free_time(0)
   {
-    alloc_time = dstruct_time++;
+    number = num_dstruct_counters++;
   }
 
   // Generate a description of a data structure.
@@ -127,20 +130,478 @@ string DataStructCounters::generate_symbol_desc (void) const
     if (syminfo.line > 0)
       locstr << ':' << syminfo.line;
   }
+  if (context_desc != "")
+    locstr << " called from " << context_desc;
   return locstr.str();
 }
 
-// Define this file's two main data structures.
-static CachedOrderedMap<Interval<uint64_t>, DataStructCounters*>* data_structs;  // Interval tree with information about each data structure
-static CachedUnorderedMap<ID_tag, DataStructCounters*>* id_tag_to_counters;  // Map from a symbol identifier to data-structure counters
+// Define the access counters a single thread accumulates for a single set of
+// DataStructCounters.
+struct AccessDeltas {
+  uint64_t bytes_loaded = 0;  // Number of bytes loaded
+  uint64_t bytes_stored = 0;  // Number of bytes stored
+  uint64_t load_ops = 0;      // Number of load operations
+  uint64_t store_ops = 0;     // Number of store operations
+  uint64_t access1_time = 0;  // First access "time" on a global counter
+  uint64_t accessN_time = 0;  // Last access "time" on a global counter
+  LocalityStats* locality = nullptr;  // Cache and reuse measurements, if any
+};
+typedef vector<AccessDeltas> access_deltas_t;   // Deltas indexed by DataStructCounters::number
+
+// Define this file's two main data structures.  Each is split into shards so
+// that threads working on unrelated data structures rarely contend for the
+// same lock.  Every 2^dstruct_region_bits-byte region of the address space
+// maps to one shard of the interval index, and each interval is stored in the
+// shard of every region it touches.
+typedef IntervalIndex<DataStructCounters*> dstruct_index_t;
+static const uint64_t dstruct_region_bits = 20;   // Log base 2 of the number of bytes per region
+static const size_t max_dstruct_shards = 16;      // Number of shards per data structure (a power of two)
+static size_t num_dstruct_shards = 1;             // Number of shards actually used
+struct DataStructShard {
+  pthread_rwlock_t lock;          // Lock protecting the index
+  dstruct_index_t index;          // Intervals overlapping the shard's regions
+};
+struct IDTagShard {
+  mutex lock;                     // Lock protecting the map
+  CachedUnorderedMap<ID_tag, DataStructCounters*> counters;  // Map from an {ID, tag} pair to counters
+};
+static DataStructShard* data_structs;  // Interval index with information about each data structure
+static IDTagShard* id_tag_to_counters; // Map from a symbol identifier to data-structure counters
+
+// Each thread accumulates access counters privately.
+static __thread access_deltas_t* thread_deltas = nullptr;  // This thread's access deltas
+static vector<access_deltas_t*>* all_thread_deltas;        // Every thread's access deltas
+static mutex all_thread_deltas_mutex;                      // Lock protecting all_thread_deltas
+
+// Summarize the heap at a single sample point.
+struct HeapSample {
+  uint64_t events;       // Number of allocation events performed so far
+  uint64_t ms;           // Milliseconds from program start to the sample
+  uint64_t bytes_live;   // Number of bytes live on the heap
+};
+
+// Record the change in a single allocation site's heap footprint since the
+// previous sample.
+struct HeapDelta {
+  uint64_t sample;       // Sample number (starting from 1)
+  uint64_t site;         // Allocation site (DataStructCounters::number)
+  uint64_t increase;     // Growth in bytes live since the previous sample
+  uint64_t decrease;     // Shrinkage in bytes live since the previous sample
+};
+
+// When samples are taken periodically in time, check the clock only once
+// every this many allocation events (a power of two).
+static const uint64_t heap_time_check_interval = 16;
+
+// Keep track of the heap footprint over time.
+static bool track_heap = false;                 // true=maintain a heap timeline
+static mutex heap_mutex;                        // Lock protecting all heap-timeline state
+static vector<HeapSample>* heap_samples;        // Summary of every sample taken
+static vector<HeapDelta>* heap_deltas;          // Per-site footprint changes at every sample
+static vector<DataStructCounters*>* dirty_heap_sites;  // Sites whose footprint changed since the last sample
+static uint64_t heap_events = 0;                // Allocation events performed so far
+static uint64_t sample_events = 0;              // Allocation events performed since the last sample
+static uint64_t heap_changes = 0;               // Changes in any site's footprint so far
+static uint64_t heap_live = 0;                  // Bytes currently live on the heap
+static uint64_t peak_heap_live = 0;             // Largest number of bytes ever live on the heap
+static uint64_t peak_heap_change = 0;           // Heap-change number at the high-water mark
+static uint64_t peak_heap_events = 0;           // Allocation events performed at the high-water mark
+static uint64_t heap_start_ms = 0;              // Time at which the program started
+static uint64_t last_sample_ms = 0;             // Time at which the previous sample was taken
+
+// Hold a mutex for the duration of a scope, but only if the program was
+// compiled with -bf-thread-safe.
+class ThreadSafeGuard {
+private:
+  mutex* the_mutex;   // Mutex to hold or nullptr if none
+
+public:
+  ThreadSafeGuard(mutex* m) : the_mutex(bf_thread_safe ? m : nullptr) {
+    if (the_mutex != nullptr)
+      the_mutex->lock();
+  }
+
+  ~ThreadSafeGuard() {
+    if (the_mutex != nullptr)
+      the_mutex->unlock();
+  }
+};
+
+// Hold a shard's reader/writer lock for the duration of a scope, but only if
+// the program was compiled with -bf-thread-safe.
+class ShardGuard {
+private:
+  pthread_rwlock_t* the_lock;   // Lock to hold or nullptr if none
+
+public:
+  ShardGuard(DataStructShard& shard, bool exclusive) :
+    the_lock(bf_thread_safe ? &shard.lock : nullptr) {
+    if (the_lock == nullptr)
+      return;
+    if ((exclusive ? pthread_rwlock_wrlock(the_lock) : pthread_rwlock_rdlock(the_lock)) != 0) {
+      cerr << "Failed to acquire a reader/writer lock\n";
+      bf_abend();
+    }
+  }
+
+  ~ShardGuard() {
+    if (the_lock != nullptr && pthread_rwlock_unlock(the_lock) != 0) {
+      cerr << "Failed to release a reader/writer lock\n";
+      bf_abend();
+    }
+  }
+};
 
-// Construct an interval tree of symbol addresses.
+// Construct a sharded interval index of symbol addresses.
 void initialize_data_structures (void)
 {
   if (data_structs != nullptr)
     return;    // Already initialized
-  data_structs = new CachedOrderedMap<Interval<uint64_t>, DataStructCounters*>;
-  id_tag_to_counters = new CachedUnorderedMap<ID_tag, DataStructCounters*>;
+  if (bf_thread_safe)
+    num_dstruct_shards = max_dstruct_shards;   // Sharding pays off only when threads contend.
+  data_structs = new DataStructShard[num_dstruct_shards];
+  for (size_t i = 0; i < num_dstruct_shards; i++)
+    if (pthread_rwlock_init(&data_structs[i].lock, nullptr) != 0) {
+      cerr << "Failed to initialize a reader/writer lock\n";
+      bf_abend();
+    }
+  id_tag_to_counters = new IDTagShard[num_dstruct_shards];
+  all_thread_deltas = new vector<access_deltas_t*>;
+  if (bf_heap_events > 0 || bf_heap_ms > 0) {
+    track_heap = true;
+    heap_samples = new vector<HeapSample>;
+    heap_deltas = new vector<HeapDelta>;
+    dirty_heap_sites = new vector<DataStructCounters*>;
+    heap_start_ms = last_sample_ms = bf_current_ms();
+  }
+}
+
+// Return the shard of the interval index that contains a given address.
+static inline DataStructShard& dstruct_shard (uint64_t addr)
+{
+  return data_structs[(addr >> dstruct_region_bits) & (num_dstruct_shards - 1)];
+}
+
+// Return the shard of the {ID, tag} map that contains a given key.
+static inline IDTagShard& id_tag_shard (const ID_tag& key)
+{
+  return id_tag_to_counters[hash<ID_tag>()(key) & (num_dstruct_shards - 1)];
+}
+
+// Invoke a function on the index of each shard that holds the interval
+// [lower, upper], taking each shard's lock exclusively in turn.
+template<typename Func>
+static void for_each_dstruct_shard (uint64_t lower, uint64_t upper, Func func)
+{
+  uint64_t first_region = lower >> dstruct_region_bits;
+  uint64_t num_regions = (upper >> dstruct_region_bits) - first_region + 1;
+  if (num_regions > num_dstruct_shards)
+    num_regions = num_dstruct_shards;
+  for (uint64_t r = first_region; r < first_region + num_regions; r++) {
+    DataStructShard& shard = data_structs[r & (num_dstruct_shards - 1)];
+    ShardGuard guard(shard, true);
+    func(shard.index);
+  }
+}
+
+// Find the interval containing a given address.  Return true and fill in the
+// interval's bounds and counters if found; return false otherwise.
+static bool find_dstruct (uint64_t addr, uint64_t& lower, uint64_t& upper,
+                          DataStructCounters*& counters)
+{
+  DataStructShard& shard = dstruct_shard(addr);
+  ShardGuard guard(shard, false);
+  dstruct_index_t::Entry* entry = shard.index.find(addr);
+  if (entry == nullptr)
+    return false;
+  lower = entry->lower;
+  upper = entry->upper;
+  counters = entry->value;
+  return true;
+}
+
+// Associate a range of addresses with a set of counters.
+static void insert_dstruct (uint64_t lower, uint64_t upper,
+                            DataStructCounters* counters)
+{
+  for_each_dstruct_shard(lower, upper, [=](dstruct_index_t& index) {
+      index.assign(lower, upper, counters);
+    });
+}
+
+// Remove the interval beginning at a given address from the index.
+static void erase_dstruct (uint64_t lower, uint64_t upper)
+{
+  for_each_dstruct_shard(lower, upper, [=](dstruct_index_t& index) {
+      dstruct_index_t::Entry* entry = index.find(lower);
+      if (entry != nullptr && entry->lower == lower)
+        index.erase(entry);
+    });
+}
+
+// Record the footprint of every allocation site whose footprint changed
+// since the previous sample.  The caller must hold heap_mutex.
+static void take_heap_sample (uint64_t now_ms)
+{
+  uint64_t sample = heap_samples->size() + 1;
+  for (auto iter = dirty_heap_sites->begin(); iter != dirty_heap_sites->end(); iter++) {
+    DataStructCounters* counters = *iter;
+    counters->heap_dirty = false;
+    if (counters->heap_bytes == counters->sampled_bytes)
+      continue;
+    HeapDelta delta;
+    delta.sample = sample;
+    delta.site = counters->number;
+    delta.increase = counters->heap_bytes > counters->sampled_bytes ? counters->heap_bytes - counters->sampled_bytes : 0;
+    delta.decrease = counters->heap_bytes < counters->sampled_bytes ? counters->sampled_bytes - counters->heap_bytes : 0;
+    heap_deltas->push_back(delta);
+    counters->sampled_bytes = counters->heap_bytes;
+  }
+  dirty_heap_sites->clear();
+  HeapSample summary;
+  summary.events = heap_events;
+  summary.ms = now_ms - heap_start_ms;
+  summary.bytes_live = heap_live;
+  heap_samples->push_back(summary);
+  sample_events = 0;
+  last_sample_ms = now_ms;
+}
+
+// Add to and subtract from the number of bytes an allocation site has live on
+// the heap.  The caller must hold heap_mutex.
+static void change_heap_footprint (DataStructCounters* counters,
+                                   uint64_t added, uint64_t removed)
+{
+  // Rather than copy every site's footprint each time the heap reaches a new
+  // high-water mark, have each site remember its footprint at the mark when
+  // it first changes after the mark.
+  heap_changes++;
+  if (counters->last_heap_change <= peak_heap_change)
+    counters->peak_bytes = counters->heap_bytes;
+  counters->last_heap_change = heap_changes;
+  counters->heap_bytes += added - removed;
+  heap_live += added - removed;
+  if (heap_live > peak_heap_live) {
+    peak_heap_live = heap_live;
+    peak_heap_change = heap_changes;
+    peak_heap_events = heap_events + 1;
+  }
+
+  // Remember that the site will need to appear in the next sample.
+  if (!counters->heap_dirty) {
+    counters->heap_dirty = true;
+    dirty_heap_sites->push_back(counters);
+  }
+}
+
+// Return the number of bytes an allocation site had live on the heap at the
+// heap's high-water mark.  The caller must hold heap_mutex.
+static uint64_t heap_bytes_at_peak (const DataStructCounters* counters)
+{
+  if (counters->last_heap_change <= peak_heap_change)
+    return counters->heap_bytes;
+  else
+    return counters->peak_bytes;
+}
+
+// Count an allocation event, and take a sample after a given number of
+// events or, failing that, a given amount of time.  The caller must hold
+// heap_mutex.
+static void end_heap_event (void)
+{
+  heap_events++;
+  sample_events++;
+  if (bf_heap_events > 0) {
+    if (sample_events >= bf_heap_events)
+      take_heap_sample(bf_current_ms());
+  }
+  else if ((sample_events & (heap_time_check_interval - 1)) == 0) {
+    uint64_t now_ms = bf_current_ms();
+    if (now_ms - last_sample_ms >= bf_heap_ms)
+      take_heap_sample(now_ms);
+  }
+}
+
+// Record a single allocation event that adds bytes to and removes bytes from
+// an allocation site's heap footprint.
+static inline void heap_event (DataStructCounters* counters,
+                               uint64_t added, uint64_t removed)
+{
+  if (!track_heap || !counters->heap)
+    return;
+  ThreadSafeGuard guard(&heap_mutex);
+  change_heap_footprint(counters, added, removed);
+  end_heap_event();
+}
+
+// Define the calling context of a heap allocation.  The context is either
+// the instrumented call stack (when -bf-call-stack is in effect) or a list of
+// return addresses taken from a bounded walk of the frame-pointer chain.
+static const size_t max_alloc_context = 32;   // Maximum number of callers to record
+class AllocContext {
+public:
+  uint64_t ID = 0;                       // Hash of the calling context (0=none)
+  const char* call_stack = nullptr;      // Instrumented call stack, if any
+  size_t depth = 0;                      // Number of valid entries in frames[]
+  void* frames[max_alloc_context];       // Return addresses, innermost first
+};
+
+// Bound the calling thread's stack so a frame-pointer walk never strays
+// outside of it.
+static __thread uintptr_t thread_stack_lower = 0;   // Lowest address on the stack
+static __thread uintptr_t thread_stack_upper = 0;   // One past the highest address on the stack
+
+// Find the bounds of the calling thread's stack.  If the bounds can't be
+// determined, leave the stack empty so no frames will be walked.
+static void find_thread_stack (void)
+{
+  pthread_attr_t attr;
+  void* stack_addr;
+  size_t stack_size;
+  thread_stack_lower = thread_stack_upper = 1;
+  if (pthread_getattr_np(pthread_self(), &attr) != 0)
+    return;
+  if (pthread_attr_getstack(&attr, &stack_addr, &stack_size) == 0) {
+    thread_stack_lower = uintptr_t(stack_addr);
+    thread_stack_upper = thread_stack_lower + stack_size;
+  }
+  pthread_attr_destroy(&attr);
+}
+
+// Say whether a frame pointer plausibly points to a {saved frame pointer,
+// return address} pair on the calling thread's stack.
+static inline bool valid_frame (void** fp)
+{
+  uintptr_t addr = uintptr_t(fp);
+  return addr%sizeof(void*) == 0
+    && addr >= thread_stack_lower
+    && addr + 2*sizeof(void*) <= thread_stack_upper;
+}
+
+// Capture the calling context of a heap allocation, given the frame of the
+// Byfl entry point that the allocating function called.
+static void capture_alloc_context (void* frame, AllocContext& context)
+{
+  // Reuse the instrumented call stack if we're maintaining one.
+  if (bf_call_stack) {
+    context.ID = bf_func_and_parents_id;
+    context.call_stack = bf_func_and_parents;
+    return;
+  }
+
+  // Walk up the frame-pointer chain, skipping the allocating function (whose
+  // allocation site is already known) and hashing each caller's return
+  // address (FNV-1a) into a context ID.
+  if (thread_stack_upper == 0)
+    find_thread_stack();
+  size_t max_depth = min(size_t(bf_alloc_context), max_alloc_context);
+  uint64_t hash = 14695981039346656037ULL;
+  void** fp = (void**) frame;
+  while (context.depth < max_depth && valid_frame(fp)) {
+    void** next_fp = (void**) fp[0];
+    if (next_fp <= fp || !valid_frame(next_fp) || next_fp[1] == nullptr)
+      break;
+    context.frames[context.depth++] = next_fp[1];
+    hash = (hash ^ uint64_t(uintptr_t(next_fp[1]))) * 1099511628211ULL;
+    fp = next_fp;
+  }
+  if (context.depth > 0)
+    context.ID = hash;
+}
+
+// Describe a return address as an offset into the object file that contains
+// it, suitable for passing to addr2line.
+static string describe_return_address (void* retaddr)
+{
+  struct ObjectInfo {
+    uintptr_t addr;      // Address to look up
+    const char* name;    // Name of the containing object
+    uintptr_t base;      // Load address of the containing object
+  } info = {uintptr_t(retaddr), nullptr, 0};
+  dl_iterate_phdr([](struct dl_phdr_info* phdr, size_t, void* data) -> int {
+      ObjectInfo* info = (ObjectInfo*) data;
+      for (ElfW(Half) i = 0; i < phdr->dlpi_phnum; i++) {
+        const ElfW(Phdr)& seg = phdr->dlpi_phdr[i];
+        uintptr_t seg_start = phdr->dlpi_addr + seg.p_vaddr;
+        if (seg.p_type == PT_LOAD
+            && info->addr >= seg_start && info->addr < seg_start + seg.p_memsz) {
+          info->name = phdr->dlpi_name;
+          info->base = phdr->dlpi_addr;
+          return 1;
+        }
+      }
+      return 0;
+    }, &info);
+  stringstream desc;
+  if (info.name == nullptr)
+    desc << "0x" << hex << info.addr;
+  else
+    desc << (info.name[0] == '\0' ? program_invocation_name : info.name)
+         << "+0x" << hex << info.addr - info.base;
+  return desc.str();
+}
+
+// Describe an allocation context as a list of callers, innermost first.
+static string describe_alloc_context (const AllocContext& context)
+{
+  string desc;
+  if (context.call_stack != nullptr) {
+    // Demangle each caller in the instrumented call stack, skipping the
+    // allocating function itself.
+    istringstream names(context.call_stack);
+    string name;
+    names >> name;
+    while (names >> name)
+      desc += (desc == "" ? "" : " <- ") + demangle_func_name(name);
+  }
+  else
+    for (size_t i = 0; i < context.depth; i++)
+      desc += (i == 0 ? "" : " <- ") + describe_return_address(context.frames[i]);
+  return desc;
+}
+
+// Return the counters associated with an {ID, tag} pair, creating them (and
+// setting the "created" argument to true) from the remaining arguments if
+// they don't already exist.
+static DataStructCounters* find_or_create_counters (const ID_tag& key,
+                                                    const bf_symbol_info_t& syminfo,
+                                                    uint64_t numaddrs,
+                                                    bool known_alloc,
+                                                    bool on_heap,
+                                                    const AllocContext* context,
+                                                    bool& created)
+{
+  IDTagShard& shard = id_tag_shard(key);
+  ThreadSafeGuard guard(&shard.lock);
+  auto count_iter = shard.counters.find(key);
+  created = count_iter == shard.counters.end();
+  if (!created)
+    return count_iter->second;
+  DataStructCounters* counters =
+    new DataStructCounters(syminfo, numaddrs, known_alloc, next_dstruct_time());
+  counters->heap = on_heap;
+  if (context != nullptr && context->ID != 0) {
+    counters->context = context->ID;
+    counters->context_desc = describe_alloc_context(*context);
+    output_ds_contexts = true;
+  }
+  shard.counters[key] = counters;
+  return counters;
+}
+
+// Return the calling thread's access deltas for a given set of counters.
+static inline AccessDeltas& find_access_deltas (const DataStructCounters* counters)
+{
+  access_deltas_t* deltas = thread_deltas;
+  if (deltas == nullptr) {
+    // First access by this thread -- allocate and register a set of deltas.
+    deltas = thread_deltas = new access_deltas_t;
+    lock_guard<mutex> guard(all_thread_deltas_mutex);
+    all_thread_deltas->push_back(deltas);
+  }
+  if (counters->number >= deltas->size())
+    deltas->resize(counters->number + 1);
+  return (*deltas)[counters->number];
 }
 
 // Disassociate a range of previously allocated addresses (given the address
@@ -149,25 +610,29 @@ void initialize_data_structures (void)
 static void* disassoc_addresses_with_dstruct (void* baseptr)
 {
   // Find the address interval and set of counters.
-  static Interval<uint64_t> search_addr(0, 0);
-  search_addr.lower = search_addr.upper = uint64_t(uintptr_t(baseptr));
-  auto iter = data_structs->find(search_addr);
-  if (iter == data_structs->end())
+  uint64_t lower, upper;
+  DataStructCounters* counters;
+  if (!find_dstruct(uint64_t(uintptr_t(baseptr)), lower, upper, counters))
     return (void*)((char*)baseptr + 1);  // Address was not previously allocated (or somehow snuck by us).
-  Interval<uint64_t> interval = iter->first;
-  DataStructCounters* counters = iter->second;
 
-  // Reduce the size of the data structure by the size of the address range and
-  // break the link from the address interval to the counters.  Note that
+  // Break the link from the address interval to the counters.  Note that
   // id_tag_to_counters still points to the counters; we don't want to forget
   // that the data structure ever existed just because it was deallocated.
-  uint64_t interval_length = interval.upper - interval.lower + 1;
-  counters->current_size -= interval_length;
-  if (counters->current_size == 0)
-    counters->free_time = dstruct_time;
-  dstruct_time++;      // Deallocation is an event, even if we haven't freed the entire data structure.
-  data_structs->erase(interval);
-  return (void *)(interval.upper + 1);
+  erase_dstruct(lower, upper);
+
+  // Reduce the size of the data structure by the size of the address range.
+  // Deallocation is an event, even if we haven't freed the entire data
+  // structure.
+  uint64_t interval_length = upper - lower + 1;
+  uint64_t now = next_dstruct_time();
+  {
+    ThreadSafeGuard guard(&counters->alloc_mutex);
+    counters->current_size -= interval_length;
+    if (counters->current_size == 0)
+      counters->free_time = now;
+  }
+  heap_event(counters, 0, interval_length);
+  return (void *)(upper + 1);
 }
 
 // For access from user code, wrap disassoc_addresses_with_dstruct() and
@@ -188,37 +653,43 @@ void bf_assoc_addresses_with_sstruct (const bf_symbol_info_t* syminfo,
   uint64_t last_addr = first_addr + numaddrs - 1;
   string symname(syminfo->symbol);
 
-  // Insert the symbol into the interval tree and into the mapping from
+  // Insert the symbol into the interval index and into the mapping from
   // data-structure name to counters.
-  DataStructCounters* info = new DataStructCounters(*syminfo, numaddrs, true);
-  dstruct_time--;   // Undo the time increment when we're allocating statically.
-  info->alloc_time = 0;   // Static data are always allocated at time 0.
-  (*data_structs)[Interval<uint64_t>(first_addr, last_addr)] = info;
-  (*id_tag_to_counters)[ID_tag(syminfo->ID)] = info;
+  // Static data are always allocated at time 0.
+  DataStructCounters* info = new DataStructCounters(*syminfo, numaddrs, true, 0);
+  insert_dstruct(first_addr, last_addr, info);
+  ID_tag key(syminfo->ID);
+  IDTagShard& shard = id_tag_shard(key);
+  ThreadSafeGuard guard(&shard.lock);
+  shard.counters[key] = info;
 }
 
 // Associate a range of addresses with a dynamically allocated data structure.
 static void assoc_addresses_with_dstruct (const bf_symbol_info_t* syminfo,
                                           void* old_baseptr, void* baseptr,
                                           uint64_t numaddrs,
-                                          bool known_alloc)
+                                          bool known_alloc,
+                                          bool on_heap,
+                                          const AllocContext* context=nullptr)
 {
   // Find an existing set of counters for the same source-code location.  If no
   // such counters exist, allocate a new set.
   DataStructCounters* counters;      // Counters associated with the data structure
-  if (old_baseptr == nullptr) {
+  uint64_t old_lower, old_upper;     // Bounds of the old address range
+  uint64_t old_length = 0;           // Number of bytes in the old address range
+  if (old_baseptr == nullptr
+      || !find_dstruct(uint64_t(uintptr_t(old_baseptr)), old_lower, old_upper, counters)) {
     // Common case -- we haven't seen the old base address before (because it's
     // presumably the same as the new address, and that's what was just
-    // allocated).
-    auto count_iter = id_tag_to_counters->find(ID_tag(syminfo->ID));
-    if (count_iter == id_tag_to_counters->end()) {
-      // Not found -- allocate new counters.
-      counters = new DataStructCounters(*syminfo, numaddrs, known_alloc);
-      (*id_tag_to_counters)[ID_tag(syminfo->ID)] = counters;
-    }
-    else {
+    // allocated).  Distinguish allocations from the same site by their
+    // calling context if one was provided.
+    bool created;
+    ID_tag key(syminfo->ID, "", context == nullptr ? 0 : context->ID);
+    counters = find_or_create_counters(key, *syminfo, numaddrs, known_alloc,
+                                       on_heap, context, created);
+    if (!created) {
       // Found -- increment the size of the data structure and its tallies.
-      counters = count_iter->second;
+      ThreadSafeGuard guard(&counters->alloc_mutex);
       counters->current_size += numaddrs;
       if (counters->current_size > counters->max_size)
         counters->max_size = counters->current_size;
@@ -229,25 +700,22 @@ static void assoc_addresses_with_dstruct (const bf_symbol_info_t* syminfo,
   else {
     // Case of realloc -- reuse the old counters, but remove the old address
     // range, and subtract off the bytes previously allocated.
-    static Interval<uint64_t> search_addr(0, 0);
-    search_addr.lower = search_addr.upper = uint64_t(uintptr_t(old_baseptr));
-    auto old_iter = data_structs->find(search_addr);
-    counters = old_iter->second;
-    Interval<uint64_t> old_interval = old_iter->first;
-    counters->current_size -= old_interval.upper - old_interval.lower + 1;
+    erase_dstruct(old_lower, old_upper);
+    old_length = old_upper - old_lower + 1;
+    ThreadSafeGuard guard(&counters->alloc_mutex);
+    counters->current_size -= old_length;
     counters->current_size += numaddrs;
     if (counters->current_size > counters->max_size)
       counters->max_size = counters->current_size;
     counters->bytes_alloced += numaddrs;
     counters->num_allocs++;
-    data_structs->erase(old_interval);
   }
+  heap_event(counters, numaddrs, old_length);
 
   // Associate the new range of addresses with the old (or just created)
   // counters.
   uint64_t baseaddr = uint64_t(uintptr_t(baseptr));
-  Interval<uint64_t> ival(baseaddr, baseaddr + numaddrs - 1);
-  (*data_structs)[ival] = counters;
+  insert_dstruct(baseaddr, baseaddr + numaddrs - 1, counters);
 }
 
 // Associate a range of addresses with a dynamically allocated data structure.
@@ -260,8 +728,15 @@ void bf_assoc_addresses_with_dstruct (const bf_symbol_info_t* syminfo,
   if (numaddrs == 0)
     return;
 
-  // Associate the given addresses with the data structure.
-  assoc_addresses_with_dstruct(syminfo, old_baseptr, baseptr, numaddrs, true);
+  // Associate the given addresses with the data structure and, optionally,
+  // with the allocation's calling context.
+  if (bf_alloc_context == 0) {
+    assoc_addresses_with_dstruct(syminfo, old_baseptr, baseptr, numaddrs, true, true);
+    return;
+  }
+  AllocContext context;
+  capture_alloc_context(__builtin_frame_address(0), context);
+  assoc_addresses_with_dstruct(syminfo, old_baseptr, baseptr, numaddrs, true, true, &context);
 }
 
 // Associate a range of addresses with a dynamically allocated data structure
@@ -279,8 +754,15 @@ void bf_assoc_addresses_with_dstruct_pm (const bf_symbol_info_t* syminfo,
   if (numaddrs == 0)
     return;
 
-  // Associate the given addresses with the data structure.
-  assoc_addresses_with_dstruct(syminfo, old_baseptr, *baseptrptr, numaddrs, true);
+  // Associate the given addresses with the data structure and, optionally,
+  // with the allocation's calling context.
+  if (bf_alloc_context == 0) {
+    assoc_addresses_with_dstruct(syminfo, old_baseptr, *baseptrptr, numaddrs, true, true);
+    return;
+  }
+  AllocContext context;
+  capture_alloc_context(__builtin_frame_address(0), context);
+  assoc_addresses_with_dstruct(syminfo, old_baseptr, *baseptrptr, numaddrs, true, true, &context);
 }
 
 // Associate a range of addresses with a dynamically allocated data structure
@@ -304,25 +786,26 @@ void bf_assoc_addresses_with_dstruct_stack (const bf_symbol_info_t* syminfo,
     ;
 
   // Associate the given addresses with the data structure.
-  assoc_addresses_with_dstruct(syminfo, nullptr, baseptr, numaddrs, true);
+  assoc_addresses_with_dstruct(syminfo, nullptr, baseptr, numaddrs, true, false);
 }
 
-// Increment access counts for a data structure.
-extern "C"
-void bf_access_data_struct (const bf_symbol_info_t* syminfo, uint64_t baseaddr,
-                            uint64_t numaddrs, uint8_t load0store1)
+// Increment access counts for a data structure.  Return the calling
+// thread's deltas for the data structure or nullptr if counting is
+// suppressed.
+static inline AccessDeltas* access_data_struct (const bf_symbol_info_t* syminfo,
+                                                uint64_t baseaddr,
+                                                uint64_t numaddrs,
+                                                uint8_t load0store1)
 {
   // Do nothing if counting is suppressed.
   if (bf_suppress_counting)
-    return;
+    return nullptr;
 
   // Find the interval containing the base address.  Use a set of counts
   // representing unknown data structures if we failed to find an interval.
-  static Interval<uint64_t> search_addr(0, 0);
-  search_addr.lower = search_addr.upper = baseaddr;
   DataStructCounters* counters;
-  auto iter = data_structs->find(search_addr);
-  if (iter == data_structs->end()) {
+  uint64_t lower, upper;
+  if (!find_dstruct(baseaddr, lower, upper, counters)) {
     // The data structure wasn't found.  For example, it was allocated by a
     // non-Byfl-instrumented function (say, strdup(), for example).  "Allocate"
     // it so it'll be found the next time.
@@ -334,25 +817,68 @@ void bf_access_data_struct (const bf_symbol_info_t* syminfo, uint64_t baseaddr,
 
     // "Allocate" an unknown data structure.
     assoc_addresses_with_dstruct(syminfo, nullptr, (void*)uintptr_t(baseaddr),
-                                 numaddrs, false);
-    iter = data_structs->find(search_addr);
+                                 numaddrs, false, false);
+    if (!find_dstruct(baseaddr, lower, upper, counters))
+      abort();    // Internal error searching data_structs (bad interval?)
   }
-  counters = iter->second;
 
-  // Increment the appropriate counters.
-  if (iter == data_structs->end())
-    abort();    // Internal error searching data_structs (bad interval?)
+  // Increment the appropriate counters.  To avoid contention, these are
+  // this thread's private deltas rather than the shared counters themselves.
+  AccessDeltas& deltas = find_access_deltas(counters);
   if (load0store1 == 0) {
-    counters->load_ops++;
-    counters->bytes_loaded += numaddrs;
+    deltas.load_ops++;
+    deltas.bytes_loaded += numaddrs;
   }
   else {
-    counters->store_ops++;
-    counters->bytes_stored += numaddrs;
+    deltas.store_ops++;
+    deltas.bytes_stored += numaddrs;
+  }
+  uint64_t now = next_dstruct_time();
+  if (deltas.access1_time == 0)
+    deltas.access1_time = now;
+  deltas.accessN_time = now;
+  return &deltas;
+}
+
+// Increment access counts for a data structure.
+extern "C"
+void bf_access_data_struct (const bf_symbol_info_t* syminfo, uint64_t baseaddr,
+                            uint64_t numaddrs, uint8_t load0store1)
+{
+  (void) access_data_struct(syminfo, baseaddr, numaddrs, load0store1);
+}
+
+// Increment access counts for a data structure, and also pass the access to
+// the cache model and/or the reuse-distance tracker (as specified by a set of
+// BF_LOCALITY_* flags), attributing their results to the same data
+// structure.
+extern "C"
+void bf_access_data_struct_locality (const bf_symbol_info_t* syminfo,
+                                     uint64_t baseaddr, uint64_t numaddrs,
+                                     uint8_t load0store1, uint8_t locality)
+{
+  // Find the data structure being accessed.  If counting is suppressed, the
+  // cache model still needs to see the access.
+  AccessDeltas* deltas = access_data_struct(syminfo, baseaddr, numaddrs, load0store1);
+  if (deltas == nullptr) {
+    if ((locality & BF_LOCALITY_CACHE) != 0)
+      bf_touch_cache(baseaddr, numaddrs);
+    return;
+  }
+  if (deltas->locality == nullptr)
+    deltas->locality = new LocalityStats;
+
+  // Model the access.  Unlike the data-structure counters, the reuse-distance
+  // tracker relies on the mega-lock for thread safety.
+  if ((locality & BF_LOCALITY_CACHE) != 0)
+    bf_touch_cache(baseaddr, numaddrs, deltas->locality);
+  if ((locality & BF_LOCALITY_REUSE) != 0) {
+    if (bf_thread_safe)
+      bf_acquire_mega_lock();
+    bf_reuse_dist_addrs(baseaddr, numaddrs, deltas->locality);
+    if (bf_thread_safe)
+      bf_release_mega_lock();
   }
-  if (counters->access1_time == 0)
-    counters->access1_time = dstruct_time;
-  counters->accessN_time = dstruct_time++;
 }
 
 // Associate an arbitrary tag with a fragment of a data structure, given an
@@ -361,45 +887,108 @@ extern "C"
 void bf_tag_data_region (void* address, const char *tag)
 {
   // Find the data structure associated with the given address.
-  static Interval<uint64_t> search_addr(0, 0);
-  search_addr.lower = search_addr.upper = uint64_t(uintptr_t(address));
-  auto diter = data_structs->find(search_addr);
-  if (diter == data_structs->end())
+  uint64_t lower, upper;
+  DataStructCounters* old_counters;
+  if (!find_dstruct(uint64_t(uintptr_t(address)), lower, upper, old_counters))
     return;
-  DataStructCounters* old_counters = diter->second;
   uint64_t id = old_counters->syminfo.ID;
 
-  // Find the set of counters associated with the symbol ID and tag.  If no
-  // such set exists, create a new one.
+  // Find the set of counters associated with the symbol ID, tag, and
+  // allocation context.  If no such set exists, create a new one.
   DataStructCounters* new_counters;
-  auto titer = id_tag_to_counters->find(ID_tag(id, tag));
-  if (titer == id_tag_to_counters->end()) {
-    // Create a new set of counters.
-    new_counters = new DataStructCounters(old_counters->syminfo, 0, old_counters->allocation);
-    new_counters->num_allocs = 0;   // This will be incremented below.
-    new_counters->tag = tag;
-    (*id_tag_to_counters)[ID_tag(id, tag)] = new_counters;
-    output_ds_tags = true;
+  ID_tag key(id, tag, old_counters->context);
+  IDTagShard& shard = id_tag_shard(key);
+  {
+    ThreadSafeGuard guard(&shard.lock);
+    auto titer = shard.counters.find(key);
+    if (titer == shard.counters.end()) {
+      // Create a new set of counters.
+      new_counters = new DataStructCounters(old_counters->syminfo, 0, old_counters->allocation,
+                                            next_dstruct_time());
+      new_counters->num_allocs = 0;   // This will be incremented below.
+      new_counters->tag = tag;
+      new_counters->heap = old_counters->heap;
+      new_counters->context = old_counters->context;
+      new_counters->context_desc = old_counters->context_desc;
+      shard.counters[key] = new_counters;
+      output_ds_tags = true;
+    }
+    else
+      new_counters = titer->second;
   }
-  else
-    new_counters = titer->second;
 
   // Transfer allocation values (but not load/store counters) from the old
-  // counters to the new counters.
-  uint64_t numaddrs = diter->first.upper - diter->first.lower + 1;
-  old_counters->num_allocs--;
-  new_counters->num_allocs++;
-  old_counters->bytes_alloced -= numaddrs;
-  new_counters->bytes_alloced += numaddrs;
-  old_counters->current_size -= numaddrs;
-  new_counters->current_size += numaddrs;
-  if (old_counters->current_size < old_counters->max_size)
-    old_counters->max_size = old_counters->current_size;
-  if (new_counters->current_size > new_counters->max_size)
-    new_counters->max_size = new_counters->current_size;
+  // counters to the new counters.  Lock the two sets of counters in a
+  // consistent order to avoid deadlock.
+  uint64_t numaddrs = upper - lower + 1;
+  {
+    ThreadSafeGuard guard1(&min(old_counters, new_counters)->alloc_mutex);
+    ThreadSafeGuard guard2(old_counters == new_counters ? nullptr : &max(old_counters, new_counters)->alloc_mutex);
+    old_counters->num_allocs--;
+    new_counters->num_allocs++;
+    old_counters->bytes_alloced -= numaddrs;
+    new_counters->bytes_alloced += numaddrs;
+    old_counters->current_size -= numaddrs;
+    new_counters->current_size += numaddrs;
+    if (old_counters->current_size < old_counters->max_size)
+      old_counters->max_size = old_counters->current_size;
+    if (new_counters->current_size > new_counters->max_size)
+      new_counters->max_size = new_counters->current_size;
+  }
+
+  // Move the bytes from one heap site to the other.  This is not itself an
+  // allocation event.
+  if (track_heap && old_counters->heap) {
+    ThreadSafeGuard guard(&heap_mutex);
+    change_heap_footprint(old_counters, 0, numaddrs);
+    change_heap_footprint(new_counters, numaddrs, 0);
+  }
 
   // Associate the original address interval with the new set of counters.
-  (*data_structs)[diter->first] = new_counters;
+  for_each_dstruct_shard(lower, upper, [=](dstruct_index_t& index) {
+      dstruct_index_t::Entry* entry = index.find(lower);
+      if (entry != nullptr && entry->lower == lower)
+        entry->value = new_counters;
+    });
+}
+
+// Fold every thread's access deltas into the corresponding counters.
+static void merge_access_deltas (void)
+{
+  // Index all sets of counters by number.
+  vector<DataStructCounters*> counters_by_number(num_dstruct_counters, nullptr);
+  for (size_t s = 0; s < num_dstruct_shards; s++) {
+    IDTagShard& shard = id_tag_to_counters[s];
+    for (auto iter = shard.counters.begin(); iter != shard.counters.end(); iter++)
+      counters_by_number[iter->second->number] = iter->second;
+  }
+
+  // Accumulate each thread's deltas into the counters then reset the deltas.
+  lock_guard<mutex> guard(all_thread_deltas_mutex);
+  for (auto titer = all_thread_deltas->begin(); titer != all_thread_deltas->end(); titer++) {
+    access_deltas_t& deltas = **titer;
+    for (size_t n = 0; n < deltas.size(); n++) {
+      DataStructCounters* counters = counters_by_number[n];
+      const AccessDeltas& delta = deltas[n];
+      if (counters == nullptr || delta.access1_time == 0)
+        continue;
+      counters->bytes_loaded += delta.bytes_loaded;
+      counters->bytes_stored += delta.bytes_stored;
+      counters->load_ops += delta.load_ops;
+      counters->store_ops += delta.store_ops;
+      if (counters->access1_time == 0 || delta.access1_time < counters->access1_time)
+        counters->access1_time = delta.access1_time;
+      if (delta.accessN_time > counters->accessN_time)
+        counters->accessN_time = delta.accessN_time;
+      if (delta.locality != nullptr) {
+        if (counters->locality == nullptr)
+          counters->locality = new LocalityStats;
+        counters->locality->merge(*delta.locality);
+        delete delta.locality;
+      }
+    }
+    deltas.clear();
+  }
 }
 
 // Compare two counters with the intention of sorted them in decreasing
@@ -425,16 +1014,33 @@ static bool compare_counter_interest (const DataStructCounters* a,
 // Output load and store counters by data structure.
 void bf_report_data_struct_counts (void)
 {
-  // Sort all data structures in the interval tree by decreasing order
+  // Sort all data structures in the interval index by decreasing order
   // of total bytes accessed.  Ignore any unaccessed data structures.
+  merge_access_deltas();
   vector<DataStructCounters*> interesting_data;
-  for (auto iter = id_tag_to_counters->begin(); iter != id_tag_to_counters->end(); iter++) {
-    DataStructCounters* counters = iter->second;
-    if (counters->bytes_loaded + counters->bytes_stored > 0)
-      interesting_data.push_back(counters);
+  for (size_t s = 0; s < num_dstruct_shards; s++) {
+    IDTagShard& shard = id_tag_to_counters[s];
+    for (auto iter = shard.counters.begin(); iter != shard.counters.end(); iter++) {
+      DataStructCounters* counters = iter->second;
+      if (counters->bytes_loaded + counters->bytes_stored > 0)
+        interesting_data.push_back(counters);
+    }
   }
   sort(interesting_data.begin(), interesting_data.end(), compare_counter_interest);
 
+  // Determine which locality measurements, if any, were attributed to the
+  // data structures.
+  bool have_cache = false;   // true=the cache model observed at least one access
+  bool have_reuse = false;   // true=reuse distance was measured for at least one access
+  BinnedHistogram dense_hist;   // Scratch space for analyzing a sparse histogram
+  for (auto iter = interesting_data.cbegin(); iter != interesting_data.cend(); iter++) {
+    const LocalityStats* stats = (*iter)->locality;
+    if (stats == nullptr)
+      continue;
+    have_cache |= stats->cache_accesses > 0;
+    have_reuse |= stats->reuse_unique + stats->reuse_dist.total() > 0;
+  }
+
   // Output a binary table header.
   *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Data-structure accesses";
   *bfbin << uint8_t(BINOUT_COL_UINT64) << "Number of allocations"
@@ -453,14 +1059,23 @@ void bf_report_data_struct_counts (void)
          << uint8_t(BINOUT_COL_STRING) << "Demangled origin";
   if (output_ds_tags)
     *bfbin << uint8_t(BINOUT_COL_STRING) << "Tag";
+  if (output_ds_contexts)
+    *bfbin << uint8_t(BINOUT_COL_UINT64) << "Allocation context"
+           << uint8_t(BINOUT_COL_STRING) << "Allocation call stack";
   *bfbin << uint8_t(BINOUT_COL_STRING) << "Mangled variable name"
          << uint8_t(BINOUT_COL_STRING) << "Demangled variable name"
          << uint8_t(BINOUT_COL_STRING) << "Mangled function name"
          << uint8_t(BINOUT_COL_STRING) << "Demangled function name"
          << uint8_t(BINOUT_COL_STRING) << "File name"
          << uint8_t(BINOUT_COL_UINT64) << "Line number"
-         << uint8_t(BINOUT_COL_STRING) << "Description"
-         << uint8_t(BINOUT_COL_NONE);
+         << uint8_t(BINOUT_COL_STRING) << "Description";
+  if (have_cache)
+    *bfbin << uint8_t(BINOUT_COL_UINT64) << "Cache-line accesses"
+           << uint8_t(BINOUT_COL_UINT64) << "Cold misses";
+  if (have_reuse)
+    *bfbin << uint8_t(BINOUT_COL_UINT64) << "Median reuse distance"
+           << uint8_t(BINOUT_COL_UINT64) << "MAD reuse distance";
+  *bfbin << uint8_t(BINOUT_COL_NONE);
 
   // Output both textual and binary data.
   for (auto iter = interesting_data.cbegin(); iter != interesting_data.cend(); iter++) {
@@ -482,7 +1097,7 @@ void bf_report_data_struct_counts (void)
            << counters->alloc_time
            << counters->access1_time
            << counters->accessN_time
-           << (counters->free_time == 0 ? dstruct_time : counters->free_time)
+           << (counters->free_time == 0 ? dstruct_time.load() : counters->free_time)
            << counters->bytes_loaded
            << counters->bytes_stored
            << counters->load_ops
@@ -492,6 +1107,8 @@ void bf_report_data_struct_counts (void)
            << demangled_origin;
     if (output_ds_tags)
       *bfbin << counters->tag;
+    if (output_ds_contexts)
+      *bfbin << counters->context << counters->context_desc;
     *bfbin << (string(syminfo->symbol[0] == '[' ? "" : syminfo->symbol))
            << (string(syminfo->symbol[0] == '[' ? "" : demangle_func_name(syminfo->symbol)))
            << (strcmp(syminfo->function, "*GLOBAL*") == 0 ? "" : syminfo->function)
@@ -499,6 +1116,173 @@ void bf_report_data_struct_counts (void)
            << (strcmp(syminfo->file, "??") == 0 ? "" : syminfo->file)
            << uint64_t(syminfo->line)
            << description;
+    static const LocalityStats no_locality;
+    const LocalityStats* stats = counters->locality == nullptr ? &no_locality : counters->locality;
+    if (have_cache)
+      *bfbin << stats->cache_accesses << stats->cold_misses;
+    if (have_reuse) {
+      uint64_t median_value = 0;
+      uint64_t mad_value = 0;
+      if (stats->reuse_unique + stats->reuse_dist.total() > 0) {
+        stats->reuse_dist.expand(dense_hist);
+        bf_compute_median_distance(dense_hist, stats->reuse_unique,
+                                   &median_value, &mad_value);
+      }
+      *bfbin << median_value << mad_value;
+    }
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+  if (!have_cache && !have_reuse)
+    return;
+
+  // Output a miss-ratio curve for each data structure from each source of
+  // locality data.  The curves describe how many of each data structure's
+  // accesses miss in a cache that is shared with all other data.
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Data-structure miss ratio curve";
+  *bfbin << uint8_t(BINOUT_COL_STRING) << "Description"
+         << uint8_t(BINOUT_COL_STRING) << "Model"
+         << uint8_t(BINOUT_COL_UINT64) << "Capacity in bytes"
+         << uint8_t(BINOUT_COL_UINT64) << "Accesses"
+         << uint8_t(BINOUT_COL_UINT64) << "Misses"
+         << uint8_t(BINOUT_COL_BOOL) << "Knee"
+         << uint8_t(BINOUT_COL_NONE);
+  for (auto iter = interesting_data.cbegin(); iter != interesting_data.cend(); iter++) {
+    const DataStructCounters* counters = *iter;
+    const LocalityStats* stats = counters->locality;
+    if (stats == nullptr)
+      continue;
+    const string description = counters->generate_symbol_desc();
+    for (int m = 0; m < 2; m++) {
+      // Compute the curve from either reuse distances or the cache model.
+      const char* model;
+      uint64_t accesses;
+      vector<bf_mrc_point_t> curve;
+      if (m == 0) {
+        model = "Reuse distance";
+        accesses = stats->reuse_unique + stats->reuse_dist.total();
+        stats->reuse_dist.expand(dense_hist);
+        bf_get_binned_miss_ratio_curve(dense_hist, accesses, 1, curve);
+      }
+      else {
+        model = "Private cache";
+        accesses = stats->cache_accesses;
+        stats->cache_dist.expand(dense_hist);
+        bf_get_binned_miss_ratio_curve(dense_hist, accesses, bf_line_size, curve);
+      }
+      if (accesses == 0)
+        continue;
+
+      // Output the curve.
+      vector<bool> is_knee;
+      bf_find_miss_ratio_knees(curve, accesses, is_knee);
+      for (size_t i = 0; i < curve.size(); i++)
+        *bfbin << uint8_t(BINOUT_ROW_DATA)
+               << description
+               << model
+               << curve[i].first
+               << accesses
+               << curve[i].second
+               << bool(is_knee[i]);
+    }
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+}
+
+// Output the heap footprint of each allocation site over time and at the
+// heap's high-water mark.
+void bf_report_heap_footprint (void)
+{
+  // Finish the final, partial sample.
+  ThreadSafeGuard guard(&heap_mutex);
+  if (sample_events > 0)
+    take_heap_sample(bf_current_ms());
+
+  // Output a summary of the heap's high-water mark.
+  *bfbin << uint8_t(BINOUT_TABLE_KEYVAL) << "Heap footprint";
+  *bfbin << uint8_t(BINOUT_COL_UINT64) << "Allocation events" << heap_events
+         << uint8_t(BINOUT_COL_UINT64) << "Samples" << uint64_t(heap_samples->size())
+         << uint8_t(BINOUT_COL_UINT64) << "Peak bytes live" << peak_heap_live
+         << uint8_t(BINOUT_COL_UINT64) << "Allocation events at peak" << peak_heap_events
+         << uint8_t(BINOUT_COL_NONE);
+
+  // Output one row per sample.
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Heap footprint samples";
+  *bfbin << uint8_t(BINOUT_COL_UINT64) << "Sample"
+         << uint8_t(BINOUT_COL_UINT64) << "Allocation events"
+         << uint8_t(BINOUT_COL_UINT64) << "Time (ms)"
+         << uint8_t(BINOUT_COL_UINT64) << "Bytes live"
+         << uint8_t(BINOUT_COL_NONE);
+  for (size_t i = 0; i < heap_samples->size(); i++) {
+    const HeapSample& summary = (*heap_samples)[i];
+    *bfbin << uint8_t(BINOUT_ROW_DATA)
+           << uint64_t(i + 1)
+           << summary.events
+           << summary.ms
+           << summary.bytes_live;
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+
+  // Output one row per site per sample in which the site's footprint
+  // changed.  A site's footprint at a given sample is the sum of its
+  // increases minus the sum of its decreases up to and including that
+  // sample.
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Heap footprint changes by allocation site";
+  *bfbin << uint8_t(BINOUT_COL_UINT64) << "Sample"
+         << uint8_t(BINOUT_COL_UINT64) << "Site"
+         << uint8_t(BINOUT_COL_UINT64) << "Bytes live increase"
+         << uint8_t(BINOUT_COL_UINT64) << "Bytes live decrease"
+         << uint8_t(BINOUT_COL_NONE);
+  for (auto iter = heap_deltas->cbegin(); iter != heap_deltas->cend(); iter++)
+    *bfbin << uint8_t(BINOUT_ROW_DATA)
+           << iter->sample
+           << iter->site
+           << iter->increase
+           << iter->decrease;
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+
+  // Sort the heap allocation sites by decreasing footprint at the heap's
+  // high-water mark.
+  vector<pair<uint64_t, DataStructCounters*>> sites;
+  for (size_t s = 0; s < num_dstruct_shards; s++) {
+    IDTagShard& shard = id_tag_to_counters[s];
+    for (auto iter = shard.counters.begin(); iter != shard.counters.end(); iter++)
+      if (iter->second->heap)
+        sites.push_back(make_pair(heap_bytes_at_peak(iter->second), iter->second));
+  }
+  sort(sites.begin(), sites.end(),
+       [](const pair<uint64_t, DataStructCounters*>& a,
+          const pair<uint64_t, DataStructCounters*>& b) {
+         if (a.first != b.first)
+           return a.first > b.first;
+         return a.second->number < b.second->number;
+       });
+
+  // Output one row per heap allocation site.
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Heap allocation sites";
+  *bfbin << uint8_t(BINOUT_COL_UINT64) << "Site"
+         << uint8_t(BINOUT_COL_UINT64) << "Bytes live at peak"
+         << uint8_t(BINOUT_COL_UINT64) << "Maximum memory footprint"
+         << uint8_t(BINOUT_COL_UINT64) << "Total bytes allocated"
+         << uint8_t(BINOUT_COL_UINT64) << "Number of allocations"
+         << uint8_t(BINOUT_COL_STRING) << "Mangled origin"
+         << uint8_t(BINOUT_COL_STRING) << "Demangled origin";
+  if (output_ds_tags)
+    *bfbin << uint8_t(BINOUT_COL_STRING) << "Tag";
+  *bfbin << uint8_t(BINOUT_COL_STRING) << "Description"
+         << uint8_t(BINOUT_COL_NONE);
+  for (auto iter = sites.cbegin(); iter != sites.cend(); iter++) {
+    const DataStructCounters* counters = iter->second;
+    *bfbin << uint8_t(BINOUT_ROW_DATA)
+           << uint64_t(counters->number)
+           << iter->first
+           << counters->max_size
+           << counters->bytes_alloced
+           << counters->num_allocs
+           << string(counters->syminfo.origin)
+           << demangle_func_name(counters->syminfo.origin);
+    if (output_ds_tags)
+      *bfbin << counters->tag;
+    *bfbin << counters->generate_symbol_desc();
   }
   *bfbin << uint8_t(BINOUT_ROW_NONE);
 }
@@ -0,0 +1,132 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (HyperLogLog cardinality estimation)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include "byfl.h"
+
+using namespace std;
+
+namespace bytesflops {
+
+// Update a dense register from a sparse entry.  The sparse index contains
+// (sparse_precision - precision) more hash bits than the dense index.  If any
+// of those are set, they determine the dense rank; otherwise, the dense rank
+// continues into the sparse rank.
+void HyperLogLog::insert_dense_entry (uint32_t entry)
+{
+  const unsigned int extra_bits = sparse_precision - precision;
+  uint32_t sparse_idx = entry >> 6;
+  uint32_t sparse_rank = entry & 0x3f;
+  size_t idx = size_t(sparse_idx >> extra_bits);
+  uint32_t extra = sparse_idx & ((uint32_t(1) << extra_bits) - 1);
+  uint8_t rank;
+  if (extra == 0)
+    rank = uint8_t(extra_bits + sparse_rank);
+  else
+    rank = uint8_t(extra_bits - (31 - __builtin_clz(extra)));
+  if (registers[idx] < rank)
+    registers[idx] = rank;
+}
+
+// Merge the pending entries into the sorted sparse list, and switch to the
+// dense representation if the list has grown too long.
+void HyperLogLog::compact (void)
+{
+  if (pending.empty())
+    return;
+
+  // Merge the two lists.  Entries are ordered by index then rank, so the last
+  // entry for a given index is the one to keep.
+  sort(pending.begin(), pending.end());
+  vector<uint32_t> merged(sparse.size() + pending.size());
+  std::merge(sparse.cbegin(), sparse.cend(), pending.cbegin(), pending.cend(),
+             merged.begin());
+  size_t num_kept = 0;
+  for (size_t i = 0; i < merged.size(); i++) {
+    if (num_kept > 0 && merged[num_kept - 1]>>6 == merged[i]>>6)
+      num_kept--;
+    merged[num_kept++] = merged[i];
+  }
+  merged.resize(num_kept);
+  sparse.swap(merged);
+  pending.clear();
+
+  // Switch to the dense representation once it's the smaller of the two.
+  if (sparse.size() > max_sparse)
+    make_dense();
+}
+
+// Switch from the sparse to the dense representation.
+void HyperLogLog::make_dense (void)
+{
+  if (registers != nullptr)
+    return;
+  registers = new uint8_t[num_registers];
+  memset(registers, 0, num_registers);
+  for (auto entry : sparse)
+    insert_dense_entry(entry);
+  for (auto entry : pending)
+    insert_dense_entry(entry);
+  vector<uint32_t>().swap(sparse);
+  vector<uint32_t>().swap(pending);
+}
+
+// Merge another sketch into ours.
+void HyperLogLog::merge (HyperLogLog* other)
+{
+  if (other->registers != nullptr) {
+    // The other sketch is dense.  Take the register-wise maximum.
+    make_dense();
+    for (size_t i = 0; i < num_registers; i++)
+      if (registers[i] < other->registers[i])
+        registers[i] = other->registers[i];
+  }
+  else if (registers != nullptr) {
+    // We're dense, but the other sketch is sparse.
+    for (auto entry : other->sparse)
+      insert_dense_entry(entry);
+    for (auto entry : other->pending)
+      insert_dense_entry(entry);
+  }
+  else {
+    // Both sketches are sparse.
+    pending.insert(pending.end(), other->sparse.cbegin(), other->sparse.cend());
+    pending.insert(pending.end(), other->pending.cbegin(), other->pending.cend());
+    compact();
+  }
+}
+
+// Return the estimated number of unique bytes accessed.  Sparse sketches use
+// linear counting over the high-precision indexes, which is nearly exact for
+// the small cardinalities they represent.  Dense sketches use the HyperLogLog
+// estimator, falling back to linear counting over the registers for small
+// cardinalities.  (We don't apply HyperLogLog++'s empirical bias correction.)
+uint64_t HyperLogLog::tally_unique (void)
+{
+  double estimate;
+  compact();
+  if (registers == nullptr) {
+    double m = double(uint64_t(1) << sparse_precision);
+    estimate = m*log(m/(m - double(sparse.size())));
+  }
+  else {
+    double m = double(num_registers);
+    double sum = 0.0;
+    size_t zeros = 0;
+    for (size_t i = 0; i < num_registers; i++) {
+      sum += ldexp(1.0, -int(registers[i]));
+      if (registers[i] == 0)
+        zeros++;
+    }
+    double alpha = 0.7213/(1.0 + 1.079/m);
+    estimate = alpha*m*m/sum;
+    if (estimate <= 2.5*m && zeros > 0)
+      estimate = m*log(m/double(zeros));
+  }
+  return uint64_t(llround(estimate)) << lg_granularity;
+}
+
+} // namespace bytesflops
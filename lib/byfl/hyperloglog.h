@@ -0,0 +1,124 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (HyperLogLog cardinality estimation)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#ifndef _HYPERLOGLOG_H_
+#define _HYPERLOGLOG_H_
+
+#include "byfl.h"
+#include <cmath>
+
+using namespace std;
+
+namespace bytesflops {
+
+// A HyperLogLog sketch estimates the number of distinct addresses it has seen
+// in constant memory.  Addresses are first reduced to granules (bytes, words,
+// or cache lines).  Following HyperLogLog++, a sketch starts out in a sparse
+// representation -- a sorted list of high-precision {index, rank} pairs --
+// and switches to a dense array of 2^precision one-byte registers only once
+// the sparse list would be larger than the dense array.
+class HyperLogLog {
+public:
+  static const unsigned int precision = 14;         // Log base 2 of the number of dense registers
+  static const unsigned int sparse_precision = 25;  // Log base 2 of the number of sparse indexes
+  static const size_t num_registers = size_t(1) << precision;  // Number of dense registers
+
+private:
+  static const size_t max_pending = 1024;                 // Maximum number of unmerged sparse entries
+  static const size_t max_sparse = num_registers/sizeof(uint32_t);  // Maximum number of sparse entries
+
+  uint8_t* registers;         // Dense registers (nullptr while sparse)
+  vector<uint32_t> sparse;    // Sorted, one entry per index, when sparse
+  vector<uint32_t> pending;   // Unsorted entries not yet merged into sparse
+  unsigned int lg_granularity;  // Log base 2 of the number of bytes per granule
+
+  // Hash a granule number to 64 well-mixed bits.
+  static inline uint64_t hash(uint64_t key) {
+    key += 0x9e3779b97f4a7c15ULL;
+    key = (key ^ (key >> 30))*0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27))*0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+  }
+
+  // Encode a hash as a sparse entry: the top sparse_precision bits of the
+  // hash followed by a 6-bit rank of the remaining bits.
+  static inline uint32_t sparse_entry(uint64_t h) {
+    uint64_t idx = h >> (64 - sparse_precision);
+    uint64_t w = (h << sparse_precision) | (uint64_t(1) << (sparse_precision - 1));
+    return uint32_t(idx << 6) | uint32_t(__builtin_clzll(w) + 1);
+  }
+
+  // Update a dense register from a hash.
+  inline void insert_dense(uint64_t h) {
+    size_t idx = size_t(h >> (64 - precision));
+    uint64_t w = (h << precision) | (uint64_t(1) << (precision - 1));
+    uint8_t rank = uint8_t(__builtin_clzll(w) + 1);
+    if (registers[idx] < rank)
+      registers[idx] = rank;
+  }
+
+  // Update a dense register from a sparse entry.
+  void insert_dense_entry(uint32_t entry);
+
+  // Merge the pending entries into the sorted sparse list, and switch to the
+  // dense representation if the list has grown too long.
+  void compact();
+
+  // Switch from the sparse to the dense representation.
+  void make_dense();
+
+  // Insert a hash into the sketch.
+  inline void insert(uint64_t h) {
+    if (registers != nullptr) {
+      insert_dense(h);
+      return;
+    }
+    pending.push_back(sparse_entry(h));
+    if (pending.size() >= max_pending)
+      compact();
+  }
+
+public:
+  // Create an empty sketch that counts granules of a given power-of-two
+  // number of bytes.
+  HyperLogLog(uint64_t granularity=1) :
+    registers(nullptr), lg_granularity(__builtin_ctzll(granularity)) {
+  }
+
+  ~HyperLogLog() {
+    delete[] registers;
+  }
+
+  // Copying a sketch is not supported.
+  HyperLogLog(const HyperLogLog&) = delete;
+  HyperLogLog& operator=(const HyperLogLog&) = delete;
+
+  // Mark a range of addresses as accessed.
+  void access(uint64_t baseaddr, uint64_t numaddrs) {
+    if (numaddrs == 0)
+      return;
+    uint64_t first = baseaddr >> lg_granularity;
+    uint64_t last = (baseaddr + numaddrs - 1) >> lg_granularity;
+    for (uint64_t g = first; g <= last; g++)
+      insert(hash(g));
+  }
+
+  // Merge another sketch into ours.
+  void merge(HyperLogLog* other);
+
+  // Return the estimated number of unique bytes accessed.
+  uint64_t tally_unique();
+
+  // Return the relative standard error of a dense sketch's estimates.
+  static double relative_error() {
+    return 1.04/sqrt(double(num_registers));
+  }
+};
+
+} // namespace bytesflops
+
+#endif
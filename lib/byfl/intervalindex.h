@@ -0,0 +1,207 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (interval-index class definitions)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#ifndef _INTERVALINDEX_H_
+#define _INTERVALINDEX_H_
+
+#include "byfl.h"
+
+using namespace std;
+
+namespace bytesflops {
+
+// Map disjoint, closed intervals of addresses to values.  Rather than
+// searching a tree, a point lookup hashes the address's page number to a short
+// list of the intervals that cover that page.  Intervals that span too many
+// pages to list on each are instead kept in a separate ordered map, which is
+// consulted only when the page lists come up empty.  Finally, each thread
+// remembers the last interval it found, which satisfies most lookups without
+// even a hash.
+template<typename V>
+class IntervalIndex {
+public:
+  // Define an interval and its associated value.
+  struct Entry {
+    uint64_t lower;   // First address in the interval
+    uint64_t upper;   // Last address in the interval
+    V value;          // Value associated with the interval
+  };
+
+private:
+  static const uint64_t page_bits = 12;         // Log base 2 of the number of bytes per page
+  static const uint64_t max_small_pages = 256;  // Maximum number of pages a "small" interval can span
+  typedef vector<Entry*> entry_list_t;          // List of intervals sorted by address
+  unordered_map<uint64_t, entry_list_t> pages;  // Map from a page number to the small intervals that cover it
+  map<uint64_t, Entry*> large;                  // Map from an upper address to a large interval
+  uint64_t version = 0;                         // Number of entries erased so far
+  size_t num_entries = 0;                       // Number of entries currently in the index
+
+  // Define a per-thread cache of the most recently found entry.  The cached
+  // entry is valid only if no entry has since been erased from the index.
+  struct LastHit {
+    const IntervalIndex* index;   // Index in which the entry was found
+    uint64_t version;             // Index version at the time of the lookup
+    Entry* entry;                 // Entry that was found
+  };
+  static __thread LastHit last_hit;
+
+  // Say whether an interval spans few enough pages to list on each page.
+  static bool is_small (uint64_t lower, uint64_t upper) {
+    return (upper >> page_bits) - (lower >> page_bits) < max_small_pages;
+  }
+
+  // Return the lowest entry in a sorted list that overlaps [lower, upper], or
+  // nullptr if there is no such entry.  Because entries are disjoint, their
+  // upper addresses are sorted, too.
+  static Entry* find_in_list (const entry_list_t& list, uint64_t lower, uint64_t upper) {
+    auto iter = lower_bound(list.begin(), list.end(), lower,
+                            [](const Entry* ent, uint64_t addr) { return ent->upper < addr; });
+    if (iter == list.end() || (*iter)->lower > upper)
+      return nullptr;
+    return *iter;
+  }
+
+  // Return the lowest large entry that overlaps [lower, upper], or nullptr if
+  // there is no such entry.
+  Entry* find_large (uint64_t lower, uint64_t upper) {
+    if (large.empty())
+      return nullptr;
+    auto iter = large.lower_bound(lower);
+    if (iter == large.end() || iter->second->lower > upper)
+      return nullptr;
+    return iter->second;
+  }
+
+  // Return the lowest small entry that overlaps [lower, upper], or nullptr if
+  // there is no such entry.  The first page in the range that lists any
+  // overlapping entry necessarily lists the lowest.
+  Entry* find_small (uint64_t lower, uint64_t upper) {
+    uint64_t first_page = lower >> page_bits;
+    uint64_t last_page = upper >> page_bits;
+    if (last_page - first_page < pages.size()) {
+      // Visit each page in the range in turn.
+      for (uint64_t pg = first_page; ; pg++) {
+        auto piter = pages.find(pg);
+        if (piter != pages.end()) {
+          Entry* ent = find_in_list(piter->second, lower, upper);
+          if (ent != nullptr)
+            return ent;
+        }
+        if (pg == last_page)
+          break;
+      }
+      return nullptr;
+    }
+
+    // The range spans more pages than we've populated.  Visit each populated
+    // page instead.
+    Entry* found = nullptr;
+    for (auto piter = pages.begin(); piter != pages.end(); piter++) {
+      if (piter->first < first_page || piter->first > last_page)
+        continue;
+      Entry* ent = find_in_list(piter->second, lower, upper);
+      if (ent != nullptr && (found == nullptr || ent->lower < found->lower))
+        found = ent;
+    }
+    return found;
+  }
+
+public:
+  // Return the entry containing a given address, or nullptr if no entry
+  // contains the address.
+  Entry* find (uint64_t addr) {
+    // Check the last entry this thread found.
+    LastHit& hit = last_hit;
+    if (hit.index == this && hit.version == version
+        && hit.entry->lower <= addr && addr <= hit.entry->upper)
+      return hit.entry;
+
+    // Check the page's list of small entries, then the large entries.
+    Entry* found = nullptr;
+    auto piter = pages.find(addr >> page_bits);
+    if (piter != pages.end())
+      found = find_in_list(piter->second, addr, addr);
+    if (found == nullptr)
+      found = find_large(addr, addr);
+    if (found != nullptr) {
+      hit.index = this;
+      hit.version = version;
+      hit.entry = found;
+    }
+    return found;
+  }
+
+  // Return the lowest entry that overlaps a given range of addresses, or
+  // nullptr if no entry overlaps the range.
+  Entry* find (uint64_t lower, uint64_t upper) {
+    Entry* found = find_small(lower, upper);
+    Entry* found_large = find_large(lower, upper);
+    if (found == nullptr || (found_large != nullptr && found_large->lower < found->lower))
+      found = found_large;
+    return found;
+  }
+
+  // Associate a value with a range of addresses.  As with a std::map whose
+  // keys compare equal when they overlap, if an existing entry overlaps the
+  // range, that entry retains its bounds and merely receives the new value.
+  void assign (uint64_t lower, uint64_t upper, V value) {
+    // Reuse an existing, overlapping entry if there is one.
+    Entry* ent = find(lower, upper);
+    if (ent != nullptr) {
+      ent->value = value;
+      return;
+    }
+
+    // Create a new entry and add it to either each page's list or the map of
+    // large entries.
+    ent = new Entry;
+    ent->lower = lower;
+    ent->upper = upper;
+    ent->value = value;
+    num_entries++;
+    if (!is_small(lower, upper)) {
+      large[upper] = ent;
+      return;
+    }
+    for (uint64_t pg = lower >> page_bits; pg <= upper >> page_bits; pg++) {
+      entry_list_t& list = pages[pg];
+      auto iter = upper_bound(list.begin(), list.end(), lower,
+                              [](uint64_t addr, const Entry* ent) { return addr < ent->lower; });
+      list.insert(iter, ent);
+    }
+  }
+
+  // Remove an entry from the index.
+  void erase (Entry* ent) {
+    if (is_small(ent->lower, ent->upper))
+      for (uint64_t pg = ent->lower >> page_bits; pg <= ent->upper >> page_bits; pg++) {
+        auto piter = pages.find(pg);
+        entry_list_t& list = piter->second;
+        list.erase(std::find(list.begin(), list.end(), ent));
+        if (list.empty())
+          pages.erase(piter);
+      }
+    else
+      large.erase(ent->upper);
+    delete ent;
+    num_entries--;
+    version++;
+  }
+
+  // Return the number of entries in the index.
+  size_t size (void) const {
+    return num_entries;
+  }
+};
+
+// Define storage for each thread's most recently found entry.
+template<typename V>
+__thread typename IntervalIndex<V>::LastHit IntervalIndex<V>::last_hit;
+
+} // namespace bytesflops
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (miss-ratio curves)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include "byfl.h"
+
+using namespace std;
+
+namespace bytesflops {
+
+// A capacity is considered a knee in a miss-ratio curve only if doubling the
+// cache to that capacity eliminates at least 1/knee_divisor of all accesses'
+// misses.
+static const uint64_t knee_divisor = 20;
+
+// Compute a miss-ratio curve for a fully associative LRU cache from a
+// histogram of distances, each measured in units of unit_bytes.  An access
+// with distance d hits in a cache of C units if and only if d < C; accesses
+// not in the histogram always miss.  Capacities are powers of two, which
+// always fall on bin boundaries, so the curve is exact.
+void bf_get_binned_miss_ratio_curve (const BinnedHistogram& hist,
+                                     uint64_t accesses, uint64_t unit_bytes,
+                                     vector<bf_mrc_point_t>& curve)
+{
+  // Subtract from the miss count every access whose distance is less than
+  // the current capacity.  Stop once only compulsory misses remain.
+  size_t num_bins = hist.size();
+  size_t bin = 0;
+  uint64_t misses = accesses;
+  curve.clear();
+  for (unsigned int lg_capacity = 0; lg_capacity < 64; lg_capacity++) {
+    uint64_t capacity = uint64_t(1) << lg_capacity;
+    for (; bin < num_bins && BinnedHistogram::bin_low(bin) < capacity; bin++)
+      misses -= hist[bin];
+    curve.push_back(bf_mrc_point_t(capacity*unit_bytes, misses));
+    if (bin >= num_bins)
+      break;
+  }
+}
+
+// Compute a miss-ratio curve for a fully associative, byte-granularity LRU
+// cache from the reuse-distance histogram.
+void bf_get_reuse_miss_ratio_curve (vector<bf_mrc_point_t>& curve, uint64_t* accesses)
+{
+  BinnedHistogram* hist;   // Histogram of reuse distances
+  uint64_t unique;         // Number of infinite reuse distances
+  bf_get_reuse_distance(&hist, &unique);
+  *accesses = unique + hist->total();
+  bf_get_binned_miss_ratio_curve(*hist, *accesses, 1, curve);
+}
+
+// Compute a miss-ratio curve for a fully associative, line-granularity LRU
+// cache from the cache model's hits.  hits[0] maps an LRU search distance
+// (1 for the most recently used line) to a tally for the single-set case; an
+// access hits in an N-line cache if and only if its search distance is at
+// most N.
+void bf_get_cache_miss_ratio_curve (const vector<unordered_map<uint64_t,uint64_t> >& hits,
+                                    uint64_t accesses,
+                                    vector<bf_mrc_point_t>& curve)
+{
+  curve.clear();
+  if (hits.empty())
+    return;
+  map<uint64_t, uint64_t> sorted_hits(hits[0].cbegin(), hits[0].cend());
+  auto hit_iter = sorted_hits.cbegin();
+  uint64_t misses = accesses;
+  for (unsigned int lg_lines = 0; lg_lines < 64; lg_lines++) {
+    uint64_t num_lines = uint64_t(1) << lg_lines;
+    for (; hit_iter != sorted_hits.cend() && hit_iter->first <= num_lines; hit_iter++)
+      misses -= hit_iter->second;
+    curve.push_back(bf_mrc_point_t(num_lines*bf_line_size, misses));
+    if (hit_iter == sorted_hits.cend())
+      break;
+  }
+}
+
+// Flag the knees in a miss-ratio curve.  A knee is a capacity at which
+// doubling the cache eliminates more misses than either neighboring doubling
+// and at least 1/knee_divisor of all accesses' misses.
+void bf_find_miss_ratio_knees (const vector<bf_mrc_point_t>& curve,
+                               uint64_t accesses,
+                               vector<bool>& is_knee)
+{
+  // Compute the number of misses eliminated at each capacity.
+  size_t num_points = curve.size();
+  vector<uint64_t> drop(num_points);
+  uint64_t prev_misses = accesses;
+  for (size_t i = 0; i < num_points; i++) {
+    drop[i] = prev_misses - curve[i].second;
+    prev_misses = curve[i].second;
+  }
+
+  // Find the local maxima that are large enough to matter.
+  is_knee.assign(num_points, false);
+  for (size_t i = 0; i < num_points; i++) {
+    if (drop[i] == 0 || drop[i]*knee_divisor < accesses)
+      continue;
+    if (i > 0 && drop[i] < drop[i - 1])
+      continue;
+    if (i + 1 < num_points && drop[i] <= drop[i + 1])
+      continue;
+    is_knee[i] = true;
+  }
+}
+
+} // namespace bytesflops
@@ -7,6 +7,12 @@
 
 #include "byfl.h"
 
+// Use vector kernels where the compiler and CPU support them.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# include <immintrin.h>
+# define BF_X86_SIMD
+#endif
+
 using namespace std;
 
 namespace bytesflops {
@@ -32,6 +38,16 @@ BitPageTableEntry::~BitPageTableEntry()
   delete[] bit_vector;
 }
 
+// Set the bits in a word that are set in a mask, and return the number of
+// bits that changed from 0 to 1.
+static inline size_t set_bits (uint64_t* word, uint64_t mask)
+{
+  uint64_t old_word = *word;
+  uint64_t new_word = old_word | mask;
+  *word = new_word;
+  return __builtin_popcountll(old_word ^ new_word);
+}
+
 // Increment the tallies associated with a range of bytes, clamping each at 1.
 void BitPageTableEntry::increment(size_t pos1, size_t pos2)
 {
@@ -42,30 +58,18 @@ void BitPageTableEntry::increment(size_t pos1, size_t pos2)
   // Determine if all bits lie in the same word.
   size_t word_ofs1 = pos1/64;              // Offset of word representing pos1
   size_t word_ofs2 = pos2/64;              // Offset of word representing pos2
-  if (word_ofs1 == word_ofs2) {
+  uint64_t first_mask = ~0ULL << (pos1%64);     // Bits to set in the first word
+  uint64_t last_mask = ~0ULL >> (63 - pos2%64); // Bits to set in the last word
+  if (word_ofs1 == word_ofs2)
     // Fast case -- we have only one word to deal with.
-    uint64_t word = bit_vector[word_ofs1]; // Vector of 64 bits
-    size_t bit_ofs1 = pos1%64;             // First bit to set
-    size_t bit_ofs2 = pos2%64;             // Last bit to set
-    uint64_t mask;                         // All 0s except for the bits to set
-    mask = ((2ULL<<(bit_ofs2 - bit_ofs1)) - 1ULL) << bit_ofs1;
-    uint64_t new_word = word | mask;       // Word with new bits set
-    bytes_touched += __builtin_popcountll(word ^ new_word);   // Tally the number of bits that changed.
-    bit_vector[word_ofs1] = new_word;
-  }
+    bytes_touched += set_bits(&bit_vector[word_ofs1], first_mask & last_mask);
   else {
-    // Slow case -- positions span multiple words.
-    for (size_t pos = pos1; pos <= pos2; pos++) {
-      size_t word_ofs = pos/64;             // Word containing the bit of interest
-      size_t bit_ofs = pos%64;              // Bit offset in the target word
-      uint64_t word = bit_vector[word_ofs]; // Vector of 64 bits
-      uint64_t mask = 1ULL<<bit_ofs;        // All 0s except for bitofs
-      if ((word&mask) == 0ULL) {
-        // Bit was previously 0.  Set it to 1.
-        bit_vector[word_ofs] |= mask;
-        bytes_touched++;
-      }
-    }
+    // Slower case -- positions span multiple words.  Set a partial word at
+    // each end and all bits of every word in between.
+    bytes_touched += set_bits(&bit_vector[word_ofs1], first_mask);
+    for (size_t w = word_ofs1 + 1; w < word_ofs2; w++)
+      bytes_touched += set_bits(&bit_vector[w], ~0ULL);
+    bytes_touched += set_bits(&bit_vector[word_ofs2], last_mask);
   }
 
   // If we filled the page, deallocate the memory used by the bit
@@ -83,98 +87,667 @@ void BitPageTableEntry::merge(BitPageTableEntry* other)
   if (!bit_vector)
     return;
 
-  // If the other PTE is full, set all of our bits to 1.
-  if (other->bit_vector == nullptr) {
-    for (size_t w = 0; w < logical_page_size/64; w++) {
-      uint64_t word0 = bit_vector[w];
-      for (size_t b = 0; b < 64; b++) {
-        uint64_t bit0 = word0 & (1ULL<<b);
-        uint64_t bit1 = 1ULL<<b;
-        if (bit0 == 0ULL) {
-          word0 |= bit1;
-          bytes_touched++;
-        }
-      }
-      bit_vector[w] = word0;
-    }
-    return;
+  // If the other PTE is full, so is ours.  Otherwise, merge a word at a time,
+  // incrementing bytes_touched on any transition from zero to one.
+  if (other->bit_vector == nullptr)
+    bytes_touched = logical_page_size;
+  else
+    for (size_t w = 0; w < logical_page_size/64; w++)
+      bytes_touched += set_bits(&bit_vector[w], other->bit_vector[w]);
+
+  // If we filled the page, deallocate the memory used by the bit vector.
+  if (bytes_touched == logical_page_size) {
+    delete[] bit_vector;
+    bit_vector = NULL;
   }
+}
 
-  // Merge bit-by-bit, incrementing bytes_touched on any transition
-  // from zero to one.
-  for (size_t w = 0; w < logical_page_size/64; w++) {
-    uint64_t word0 = bit_vector[w];
-    uint64_t word1 = other->bit_vector[w];
-    for (size_t b = 0; b < 64; b++) {
-      uint64_t bit0 = word0 & (1ULL<<b);
-      uint64_t bit1 = word1 & (1ULL<<b);
-      if (bit0 == 0ULL && bit1 != 0ULL) {
-        word0 |= bit1;
-        bytes_touched++;
-      }
-    }
-    bit_vector[w] = word0;
+// Increment the tallies associated with a range of bytes, clamping each at the
+// maximum word value.  Return the number of tallies that were previously zero.
+static inline size_t increment_counters_scalar (bytecount_t* counters, size_t num)
+{
+  size_t new_bytes = 0;
+  for (size_t i = 0; i < num; i++) {
+    bytecount_t count = counters[i];
+    new_bytes += count == 0;
+    counters[i] = count + (count != bf_max_bytecount);
+  }
+  return new_bytes;
+}
+
+// Add one set of tallies into another, clamping each at the maximum word value.
+// Return the number of tallies that were previously zero but no longer are.
+static inline size_t merge_counters_scalar (bytecount_t* counters, const bytecount_t* more, size_t num)
+{
+  size_t new_bytes = 0;
+  for (size_t i = 0; i < num; i++) {
+    bytecount_t count0 = counters[i];
+    bytecount_t count1 = more[i];
+    new_bytes += count0 == 0 && count1 != 0;
+    counters[i] = (count1 > bf_max_bytecount - count0) ? bf_max_bytecount : count0 + count1;
+  }
+  return new_bytes;
+}
+
+// Increment a range of narrow (8- or 16-bit) tallies, letting each wrap around
+// to zero on overflow.  Return true if any tally wrapped.  Add to *new_bytes
+// the number of tallies that were previously zero.
+template<typename T>
+static inline bool increment_narrow_scalar (T* counters, size_t num, size_t* new_bytes)
+{
+  size_t zeros = 0;
+  bool wrapped = false;
+  for (size_t i = 0; i < num; i++) {
+    T count = counters[i];
+    zeros += count == 0;
+    count++;
+    counters[i] = count;
+    wrapped |= count == 0;
+  }
+  *new_bytes += zeros;
+  return wrapped;
+}
+
+#ifdef BF_X86_SIMD
+
+// Increment and merge tallies using 256-bit vectors.  AVX2 lacks unsigned
+// saturating 32-bit arithmetic, so clamping is performed with comparisons and
+// unsigned minima.
+__attribute__((target("avx2")))
+static size_t increment_counters_avx2 (bytecount_t* counters, size_t num)
+{
+  const __m256i ones = _mm256_set1_epi32(-1);
+  const __m256i zeros = _mm256_setzero_si256();
+  size_t new_bytes = 0;
+  size_t i;
+  for (i = 0; i + 8 <= num; i += 8) {
+    __m256i* ptr = (__m256i*)&counters[i];
+    __m256i count = _mm256_loadu_si256(ptr);
+    __m256i was_zero = _mm256_cmpeq_epi32(count, zeros);
+    __m256i is_max = _mm256_cmpeq_epi32(count, ones);
+    new_bytes += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(was_zero)));
+    _mm256_storeu_si256(ptr, _mm256_sub_epi32(count, _mm256_andnot_si256(is_max, ones)));
+  }
+  return new_bytes + increment_counters_scalar(&counters[i], num - i);
+}
+
+__attribute__((target("avx2")))
+static size_t merge_counters_avx2 (bytecount_t* counters, const bytecount_t* more, size_t num)
+{
+  const __m256i ones = _mm256_set1_epi32(-1);
+  const __m256i zeros = _mm256_setzero_si256();
+  size_t new_bytes = 0;
+  size_t i;
+  for (i = 0; i + 8 <= num; i += 8) {
+    __m256i* ptr = (__m256i*)&counters[i];
+    __m256i count0 = _mm256_loadu_si256(ptr);
+    __m256i count1 = _mm256_loadu_si256((const __m256i*)&more[i]);
+    __m256i newly_set = _mm256_andnot_si256(_mm256_cmpeq_epi32(count1, zeros),
+                                            _mm256_cmpeq_epi32(count0, zeros));
+    new_bytes += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(newly_set)));
+    __m256i headroom = _mm256_xor_si256(count1, ones);
+    _mm256_storeu_si256(ptr, _mm256_add_epi32(_mm256_min_epu32(count0, headroom), count1));
   }
+  return new_bytes + merge_counters_scalar(&counters[i], &more[i], num - i);
 }
 
-// Construct a page-table entry for word-sized counters.
+// Increment narrow tallies using 256-bit vectors.  These follow the same
+// wrap-around convention as increment_narrow_scalar().
+__attribute__((target("avx2")))
+static bool increment_narrow_avx2 (uint8_t* counters, size_t num, size_t* new_bytes)
+{
+  const __m256i ones = _mm256_set1_epi8(-1);
+  const __m256i zeros = _mm256_setzero_si256();
+  __m256i wrapped = zeros;
+  size_t i;
+  for (i = 0; i + 32 <= num; i += 32) {
+    __m256i* ptr = (__m256i*)&counters[i];
+    __m256i count = _mm256_loadu_si256(ptr);
+    *new_bytes += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(count, zeros)));
+    count = _mm256_sub_epi8(count, ones);
+    wrapped = _mm256_or_si256(wrapped, _mm256_cmpeq_epi8(count, zeros));
+    _mm256_storeu_si256(ptr, count);
+  }
+  bool tail_wrapped = increment_narrow_scalar(&counters[i], num - i, new_bytes);
+  return tail_wrapped || !_mm256_testz_si256(wrapped, wrapped);
+}
+
+__attribute__((target("avx2")))
+static bool increment_narrow_avx2 (uint16_t* counters, size_t num, size_t* new_bytes)
+{
+  const __m256i ones = _mm256_set1_epi16(-1);
+  const __m256i zeros = _mm256_setzero_si256();
+  __m256i wrapped = zeros;
+  size_t i;
+  for (i = 0; i + 16 <= num; i += 16) {
+    __m256i* ptr = (__m256i*)&counters[i];
+    __m256i count = _mm256_loadu_si256(ptr);
+    *new_bytes += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi16(count, zeros)))/2;
+    count = _mm256_sub_epi16(count, ones);
+    wrapped = _mm256_or_si256(wrapped, _mm256_cmpeq_epi16(count, zeros));
+    _mm256_storeu_si256(ptr, count);
+  }
+  bool tail_wrapped = increment_narrow_scalar(&counters[i], num - i, new_bytes);
+  return tail_wrapped || !_mm256_testz_si256(wrapped, wrapped);
+}
+
+// Increment and merge tallies using 512-bit vectors.  Partial vectors are
+// handled with masked loads and stores.
+__attribute__((target("avx512f")))
+static size_t increment_counters_avx512 (bytecount_t* counters, size_t num)
+{
+  const __m512i ones = _mm512_set1_epi32(-1);
+  size_t new_bytes = 0;
+  for (size_t i = 0; i < num; i += 16) {
+    __mmask16 lanes = num - i >= 16 ? 0xFFFF : __mmask16((1U << (num - i)) - 1);
+    __m512i count = _mm512_maskz_loadu_epi32(lanes, &counters[i]);
+    __mmask16 was_zero = _mm512_mask_cmpeq_epi32_mask(lanes, count, _mm512_setzero_si512());
+    __mmask16 not_max = _mm512_mask_cmpneq_epi32_mask(lanes, count, ones);
+    new_bytes += __builtin_popcount(was_zero);
+    _mm512_mask_storeu_epi32(&counters[i], not_max, _mm512_sub_epi32(count, ones));
+  }
+  return new_bytes;
+}
+
+__attribute__((target("avx512f")))
+static size_t merge_counters_avx512 (bytecount_t* counters, const bytecount_t* more, size_t num)
+{
+  const __m512i ones = _mm512_set1_epi32(-1);
+  const __m512i zeros = _mm512_setzero_si512();
+  size_t new_bytes = 0;
+  for (size_t i = 0; i < num; i += 16) {
+    __mmask16 lanes = num - i >= 16 ? 0xFFFF : __mmask16((1U << (num - i)) - 1);
+    __m512i count0 = _mm512_maskz_loadu_epi32(lanes, &counters[i]);
+    __m512i count1 = _mm512_maskz_loadu_epi32(lanes, &more[i]);
+    __mmask16 nonzero = _mm512_mask_cmpneq_epi32_mask(lanes, count1, zeros);
+    __mmask16 newly_set = _mm512_mask_cmpeq_epi32_mask(nonzero, count0, zeros);
+    new_bytes += __builtin_popcount(newly_set);
+    __m512i headroom = _mm512_xor_si512(count1, ones);
+    __m512i sum = _mm512_maskz_add_epi32(nonzero, _mm512_maskz_min_epu32(nonzero, count0, headroom), count1);
+    _mm512_mask_storeu_epi32(&counters[i], nonzero, sum);
+  }
+  return new_bytes;
+}
+
+// Identify the widest set of vector kernels the CPU supports.
+enum simd_level_t { SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512 };
+static simd_level_t get_simd_level (void)
+{
+  static simd_level_t simd_level = []() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+      return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+      return SIMD_AVX2;
+    return SIMD_SCALAR;
+  }();
+  return simd_level;
+}
+
+#endif
+
+// Construct a page-table entry for word-sized counters.  Counters start out
+// 8 bits wide.
 WordPageTableEntry::WordPageTableEntry(size_t pg_size) : BasePageTableEntry(pg_size)
 {
   bytes_touched = 0;
-  byte_counter = new bytecount_t[logical_page_size];
-  memset((void *)byte_counter, 0, sizeof(bytecount_t)*logical_page_size);
+  counter_width = 1;
+  counter8 = new uint8_t[logical_page_size];
+  memset((void *)counter8, 0, logical_page_size);
 }
 
 // Copy an existing page-table entry.
 WordPageTableEntry::WordPageTableEntry(const WordPageTableEntry& other) : BasePageTableEntry(other)
 {
-  byte_counter = new bytecount_t[logical_page_size];
-  memcpy((void *)byte_counter, other.byte_counter, sizeof(bytecount_t)*logical_page_size);
+  counter_width = other.counter_width;
+  counter8 = new uint8_t[counter_width*logical_page_size];
+  memcpy((void *)counter8, other.counter8, counter_width*logical_page_size);
 }
 
 // Destruct a word-sized page-table entry.
 WordPageTableEntry::~WordPageTableEntry()
 {
-  delete[] byte_counter;
+  delete[] counter8;
+}
+
+// Return the counter at a given position, regardless of its width.
+bytecount_t WordPageTableEntry::get_count(size_t pos) const
+{
+  switch (counter_width) {
+    case 1:
+      return counter8[pos];
+    case 2:
+      return counter16[pos];
+    default:
+      return counter32[pos];
+  }
+}
+
+// Assign a counter at a given position, which must fit in the current width.
+void WordPageTableEntry::set_count(size_t pos, bytecount_t count)
+{
+  switch (counter_width) {
+    case 1:
+      counter8[pos] = uint8_t(count);
+      break;
+    case 2:
+      counter16[pos] = uint16_t(count);
+      break;
+    default:
+      counter32[pos] = count;
+      break;
+  }
+}
+
+// Double the width of every counter on the page.
+void WordPageTableEntry::widen(void)
+{
+  uint8_t* new_counters = new uint8_t[2*counter_width*logical_page_size];
+  if (counter_width == 1) {
+    uint16_t* wide = (uint16_t*)new_counters;
+    for (size_t pos = 0; pos < logical_page_size; pos++)
+      wide[pos] = counter8[pos];
+  }
+  else {
+    uint32_t* wide = (uint32_t*)new_counters;
+    for (size_t pos = 0; pos < logical_page_size; pos++)
+      wide[pos] = counter16[pos];
+  }
+  delete[] counter8;
+  counter8 = new_counters;
+  counter_width *= 2;
+}
+
+// Widen every counter on the page after an increment of a range of narrow
+// counters wrapped around.  Counters in the range that are now zero were
+// previously at their maximum value.
+void WordPageTableEntry::promote(size_t pos1, size_t pos2)
+{
+  bytecount_t wrapped_value = bytecount_t(1) << (8*counter_width);
+  widen();
+  for (size_t pos = pos1; pos <= pos2; pos++)
+    if (get_count(pos) == 0)
+      set_count(pos, wrapped_value);
 }
 
 // Increment the tallies associated with a range of bytes, clamping each at the
-// maximum word value.
+// maximum word value.  Narrow counters are widened when they overflow.
 void WordPageTableEntry::increment(size_t pos1, size_t pos2)
 {
-  for (size_t pos = pos1; pos <= pos2; pos++)
-    switch (byte_counter[pos]) {
-      case bf_max_bytecount:
-        /* Maxed out our counter -- don't increment it further. */
+  size_t num = pos2 - pos1 + 1;
+  bool wrapped;
+#ifdef BF_X86_SIMD
+  // Short ranges, which are the common case, aren't worth vectorizing.
+  if (num >= 16 && get_simd_level() != SIMD_SCALAR) {
+    switch (counter_width) {
+      case 1:
+        wrapped = increment_narrow_avx2(&counter8[pos1], num, &bytes_touched);
         break;
 
-      case 0:
-        /* First time a byte was touched */
-        bytes_touched++;
-        /* No break */
+      case 2:
+        wrapped = increment_narrow_avx2(&counter16[pos1], num, &bytes_touched);
+        break;
 
       default:
-        /* Common case -- increment the counter. */
-        byte_counter[pos]++;
-        break;
+        if (get_simd_level() == SIMD_AVX512)
+          bytes_touched += increment_counters_avx512(&counter32[pos1], num);
+        else
+          bytes_touched += increment_counters_avx2(&counter32[pos1], num);
+        return;
     }
+    if (wrapped)
+      promote(pos1, pos2);
+    return;
+  }
+#endif
+  switch (counter_width) {
+    case 1:
+      wrapped = increment_narrow_scalar(&counter8[pos1], num, &bytes_touched);
+      break;
+
+    case 2:
+      wrapped = increment_narrow_scalar(&counter16[pos1], num, &bytes_touched);
+      break;
+
+    default:
+      bytes_touched += increment_counters_scalar(&counter32[pos1], num);
+      return;
+  }
+  if (wrapped)
+    promote(pos1, pos2);
 }
 
 // Merge the counts from another WordPageTableEntry into ours.
 void WordPageTableEntry::merge(WordPageTableEntry* other)
 {
-  for (size_t pos = 0; pos < logical_page_size; pos++) {
-    bytecount_t count0 = byte_counter[pos];
-    bytecount_t count1 = other->byte_counter[pos];
-    if (count1 == 0)
-      continue;
-    if (count0 != 0) {
-      byte_counter[pos] = count1;
-      bytes_touched++;
+  // Our counters must be at least as wide as the other PTE's.
+  while (counter_width < other->counter_width)
+    widen();
+
+  // Merge narrow counters one at a time, widening ours on overflow.
+  if (other->counter_width < 4 || counter_width < 4) {
+    for (size_t pos = 0; pos < logical_page_size; pos++) {
+      bytecount_t count1 = other->get_count(pos);
+      if (count1 == 0)
+        continue;
+      bytecount_t count0 = get_count(pos);
+      if (count0 == 0)
+        bytes_touched++;
+      bytecount_t sum = (count1 > bf_max_bytecount - count0) ? bf_max_bytecount : count0 + count1;
+      while (counter_width < 4 && (sum >> (8*counter_width)) != 0)
+        widen();
+      set_count(pos, sum);
+    }
+    return;
+  }
+
+  // Merge full-width counters with the fastest available kernel.
+#ifdef BF_X86_SIMD
+  switch (get_simd_level()) {
+    case SIMD_AVX512:
+      bytes_touched += merge_counters_avx512(counter32, other->counter32, logical_page_size);
+      return;
+
+    case SIMD_AVX2:
+      bytes_touched += merge_counters_avx2(counter32, other->counter32, logical_page_size);
+      return;
+
+    default:
+      break;
+  }
+#endif
+  bytes_touched += merge_counters_scalar(counter32, other->counter32, logical_page_size);
+}
+
+// Add a range of bytes to a CompactByteSet, and return the number of bytes
+// that were not already present.
+size_t CompactByteSet::insert(size_t pos1, size_t pos2, size_t pg_size)
+{
+  // Use the bit vector if we have one.
+  if (bits != nullptr) {
+    size_t old_count = bits->count();
+    bits->increment(pos1, pos2);
+    return bits->count() - old_count;
+  }
+
+  // Common cases -- the bytes are already contained in a single range, or
+  // they extend a range upwards without reaching the next range.
+  for (uint32_t i = 0; i < num_ranges; i++)
+    if (first[i] <= pos1 && pos1 <= size_t(last[i]) + 1) {
+      if (pos2 <= last[i])
+        return 0;
+      if (i + 1 == num_ranges || pos2 + 1 < first[i + 1]) {
+        size_t added = pos2 - last[i];
+        last[i] = uint32_t(pos2);
+        return added;
+      }
+      break;
+    }
+
+  // Merge the new range with all ranges it overlaps or abuts, keeping the
+  // result sorted.
+  uint32_t new_first[max_ranges + 1];   // First byte in each resulting range
+  uint32_t new_last[max_ranges + 1];    // Last byte in each resulting range
+  uint32_t new_num = 0;                 // Number of resulting ranges
+  size_t merged_first = pos1;           // First byte of the merged range
+  size_t merged_last = pos2;            // Last byte of the merged range
+  size_t overlap = 0;                   // Number of bytes already present
+  size_t old_count = 0;                 // Number of bytes previously in the set
+  bool placed = false;                  // true=merged range was emitted
+  for (uint32_t i = 0; i < num_ranges; i++) {
+    old_count += last[i] - first[i] + 1;
+    if (size_t(last[i]) + 1 < pos1) {
+      // Range lies entirely before the new range.
+      new_first[new_num] = first[i];
+      new_last[new_num++] = last[i];
+    }
+    else if (first[i] > pos2 + 1) {
+      // Range lies entirely after the new range.
+      if (!placed) {
+        new_first[new_num] = uint32_t(merged_first);
+        new_last[new_num++] = uint32_t(merged_last);
+        placed = true;
+      }
+      new_first[new_num] = first[i];
+      new_last[new_num++] = last[i];
+    }
+    else {
+      // Range overlaps or abuts the new range.
+      size_t lo = max(size_t(first[i]), pos1);
+      size_t hi = min(size_t(last[i]), pos2);
+      if (lo <= hi)
+        overlap += hi - lo + 1;
+      merged_first = min(merged_first, size_t(first[i]));
+      merged_last = max(merged_last, size_t(last[i]));
+    }
+  }
+  if (!placed) {
+    new_first[new_num] = uint32_t(merged_first);
+    new_last[new_num++] = uint32_t(merged_last);
+  }
+
+  // If there are too many ranges, convert the set to a bit vector.
+  if (new_num > max_ranges) {
+    bits = new BitPageTableEntry(pg_size);
+    for (uint32_t i = 0; i < new_num; i++)
+      bits->increment(new_first[i], new_last[i]);
+    num_ranges = 0;
+    return bits->count() - old_count;
+  }
+
+  // Otherwise, store the new ranges.
+  memcpy(first, new_first, new_num*sizeof(uint32_t));
+  memcpy(last, new_last, new_num*sizeof(uint32_t));
+  num_ranges = new_num;
+  return pos2 - pos1 + 1 - overlap;
+}
+
+// Add a range of bytes to a given function's set, and add to *unique_bytes the
+// number of bytes that were not already present.
+void FunctionSetPageTableEntry::increment(size_t pos1, size_t pos2,
+                                          uint32_t func_id, uint64_t* unique_bytes)
+{
+  // Find the function's set, creating it if necessary.  Consecutive accesses
+  // to a page usually come from the same function so check that first.
+  if (last_set >= func_sets.size() || func_sets[last_set].func_id != func_id) {
+    auto set_iter = lower_bound(func_sets.begin(), func_sets.end(), func_id,
+                                [](const CompactByteSet& set, uint32_t id) {
+                                  return set.func_id < id;
+                                });
+    if (set_iter == func_sets.end() || set_iter->func_id != func_id) {
+      CompactByteSet new_set;
+      new_set.func_id = func_id;
+      new_set.num_ranges = 0;
+      new_set.bits = nullptr;
+      set_iter = func_sets.insert(set_iter, new_set);
     }
-    else
-      byte_counter[pos] = (count1 > bf_max_bytecount - count0) ? bf_max_bytecount : count0 + count1;
+    last_set = set_iter - func_sets.begin();
+  }
+
+  // Add the range to the set.
+  *unique_bytes += func_sets[last_set].insert(pos1, pos2, logical_page_size);
+}
+
+// Destruct a function-set page-table entry.
+FunctionSetPageTableEntry::~FunctionSetPageTableEntry()
+{
+  for (auto set_iter = func_sets.begin(); set_iter != func_sets.end(); set_iter++)
+    delete set_iter->bits;
+}
+
+// Mark a range of bytes as accessed during a given epoch.  Increment
+// *new_pages if this is the epoch's first access to the page, and add to
+// *new_lines the number of lines not previously accessed during the epoch.
+void EpochPageTableEntry::increment(size_t pos1, size_t pos2, uint64_t epoch,
+                                    unsigned int lg_line_size,
+                                    uint64_t* new_pages, uint64_t* new_lines)
+{
+  // Clear the page's lines the first time it's accessed in a new epoch.
+  size_t num_words = ((logical_page_size >> lg_line_size) + 63)/64;
+  if (generation != epoch) {
+    if (line_bits == nullptr)
+      line_bits = new uint64_t[num_words];
+    memset(line_bits, 0, num_words*sizeof(uint64_t));
+    generation = epoch;
+    (*new_pages)++;
+  }
+
+  // Set the bit for each line in the range.
+  size_t line1 = pos1 >> lg_line_size;
+  size_t line2 = pos2 >> lg_line_size;
+  size_t word_ofs1 = line1/64;
+  size_t word_ofs2 = line2/64;
+  uint64_t first_mask = ~0ULL << (line1%64);
+  uint64_t last_mask = ~0ULL >> (63 - line2%64);
+  if (word_ofs1 == word_ofs2)
+    *new_lines += set_bits(&line_bits[word_ofs1], first_mask & last_mask);
+  else {
+    *new_lines += set_bits(&line_bits[word_ofs1], first_mask);
+    for (size_t w = word_ofs1 + 1; w < word_ofs2; w++)
+      *new_lines += set_bits(&line_bits[w], ~0ULL);
+    *new_lines += set_bits(&line_bits[word_ofs2], last_mask);
+  }
+}
+
+// Keep track of every PageSizeChooser so we can report their page sizes.
+static vector<PageSizeChooser*>* all_page_size_choosers = nullptr;
+
+// Define the parameters of PageSizeChooser's cost function.
+static const size_t min_auto_page_size = 256;   // Smallest page size to consider
+static const double page_cost = 1024.0;         // Cost of creating and maintaining a page, in bytes of memory
+static const double lookup_cost = 16.0;         // Cost of one page-table lookup, in bytes of memory
+
+extern BinaryOStream* bfbin;
+
+// Determine the page size from a given environment variable.
+PageSizeChooser::PageSizeChooser(const char* env_var, const char* desc,
+                                 double bytes_per_addr) :
+  description(desc), bytes_per_address(bytes_per_addr), chosen_size(0),
+  automatic(true)
+{
+  if (all_page_size_choosers == nullptr)
+    all_page_size_choosers = new vector<PageSizeChooser*>;
+  all_page_size_choosers->push_back(this);
+  const char* size_str = getenv(env_var);
+  if (size_str == nullptr || strcmp(size_str, "auto") == 0)
+    return;
+  char* endptr;
+  uint64_t size = strtoull(size_str, &endptr, 10);
+  if (*endptr != '\0' || size < 64 || (size & (size - 1)) != 0) {
+    cerr << "Failed to parse " << env_var << " (\"" << size_str
+         << "\") as either \"auto\" or a power of two no smaller than 64\n";
+    bf_abend();
+  }
+  chosen_size = size_t(size);
+  automatic = false;
+}
+
+// Return the system's huge-page size, or 2 MB if we can't determine it.
+static size_t huge_page_size (void)
+{
+  size_t hp_size = 2*1024*1024;
+  ifstream hp_file("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size");
+  size_t value;
+  if (hp_file >> value && value > 0 && (value & (value - 1)) == 0)
+    hp_size = value;
+  return hp_size;
+}
+
+// Choose a page size based on the accesses sampled so far.  We consider every
+// power of two from min_auto_page_size up to the huge-page size.  Small pages
+// waste little memory on bytes that are never accessed, while large pages
+// amortize per-page overhead across more bytes and split fewer accesses.
+// Because the sample sees only the beginning of the run, when pages have not
+// yet filled in, the per-page cost deliberately exceeds a page's bookkeeping
+// memory.
+void PageSizeChooser::choose (void)
+{
+  if (chosen_size != 0)
+    return;
+  size_t max_size = huge_page_size();
+  size_t best_size = min_auto_page_size;
+  double best_cost = -1.0;
+
+  // Sort each owner's sampled address ranges and merge the overlapping and
+  // adjacent ones so that pages can be counted without enumerating them.
+  typedef tuple<const void*, uint64_t, uint64_t> owner_range_t;   // {owner, first address, last address}
+  vector<owner_range_t> ranges;
+  ranges.reserve(sampled.size());
+  for (auto access_iter = sampled.cbegin(); access_iter != sampled.cend(); access_iter++)
+    if (access_iter->numaddrs > 0)
+      ranges.push_back(owner_range_t(access_iter->owner, access_iter->baseaddr,
+                                     access_iter->baseaddr + access_iter->numaddrs - 1));
+  sort(ranges.begin(), ranges.end());
+  size_t num_ranges = 0;
+  for (auto range_iter = ranges.cbegin(); range_iter != ranges.cend(); range_iter++) {
+    if (num_ranges > 0) {
+      owner_range_t& prev = ranges[num_ranges - 1];
+      if (get<0>(prev) == get<0>(*range_iter)
+          && get<1>(*range_iter) <= get<2>(prev) + 1) {
+        get<2>(prev) = max(get<2>(prev), get<2>(*range_iter));
+        continue;
+      }
+    }
+    ranges[num_ranges++] = *range_iter;
+  }
+  ranges.resize(num_ranges);
+
+  for (size_t pg_size = min_auto_page_size; pg_size <= max_size; pg_size *= 2) {
+    // Tally the number of page-table lookups needed.
+    unsigned int lg_page_size = __builtin_ctzll(pg_size);
+    uint64_t lookups = 0;
+    for (auto access_iter = sampled.cbegin(); access_iter != sampled.cend(); access_iter++) {
+      if (access_iter->numaddrs == 0)
+        continue;
+      uint64_t first_page = access_iter->baseaddr >> lg_page_size;
+      uint64_t last_page = (access_iter->baseaddr + access_iter->numaddrs - 1) >> lg_page_size;
+      lookups += last_page - first_page + 1;
+    }
+
+    // Tally the number of distinct pages each owner accessed.  An owner's
+    // consecutive ranges are disjoint but may share a page at their ends.
+    uint64_t num_pages = 0;
+    const void* prev_owner = nullptr;
+    uint64_t prev_last_page = 0;
+    for (auto range_iter = ranges.cbegin(); range_iter != ranges.cend(); range_iter++) {
+      uint64_t first_page = get<1>(*range_iter) >> lg_page_size;
+      uint64_t last_page = get<2>(*range_iter) >> lg_page_size;
+      if (range_iter != ranges.cbegin() && get<0>(*range_iter) == prev_owner
+          && first_page <= prev_last_page)
+        first_page = prev_last_page + 1;
+      if (first_page <= last_page)
+        num_pages += last_page - first_page + 1;
+      prev_owner = get<0>(*range_iter);
+      prev_last_page = last_page;
+    }
+
+    // Keep track of the least-cost page size.
+    double cost = double(num_pages)*(page_cost + double(pg_size)*bytes_per_address)
+      + double(lookups)*lookup_cost;
+    if (best_cost < 0.0 || cost < best_cost) {
+      best_cost = cost;
+      best_size = pg_size;
+    }
+  }
+  chosen_size = best_size;
+}
+
+// Output each analysis's page size.
+void PageSizeChooser::report_all (void)
+{
+  if (all_page_size_choosers == nullptr)
+    return;
+  *bfbin << uint8_t(BINOUT_TABLE_KEYVAL) << "Logical page sizes";
+  for (auto chooser : *all_page_size_choosers) {
+    if (chooser->chosen_size == 0)
+      continue;
+    string desc(chooser->description);
+    *bfbin << uint8_t(BINOUT_COL_UINT64) << desc + " page size"
+           << uint64_t(chooser->chosen_size)
+           << uint8_t(BINOUT_COL_BOOL) << desc + " page size was chosen automatically"
+           << chooser->automatic;
   }
+  *bfbin << uint8_t(BINOUT_COL_NONE);
 }
 
 } // namespace bytesflops
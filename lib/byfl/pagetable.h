@@ -36,7 +36,7 @@ public:
 };
 
 // Specialize BasePageTableEntry for bit-sized counters.
-class BitPageTableEntry : public BasePageTableEntry {
+class BitPageTableEntry final : public BasePageTableEntry {
 private:
   uint64_t* bit_vector;           // One bit per byte on the page, packed into words
 
@@ -53,10 +53,41 @@ public:
   ~BitPageTableEntry();
 };
 
-// Specialize BasePageTableEntry for word-sized counters.
-class WordPageTableEntry : public BasePageTableEntry {
+// Specialize BasePageTableEntry for word-sized counters.  To save memory,
+// each page's counters start out 8 bits wide and are widened to 16 and then 32
+// bits (bytecount_t) only when some counter on the page overflows.
+class WordPageTableEntry final : public BasePageTableEntry {
 private:
-  bytecount_t* byte_counter;      // One counter per byte on the page
+  union {
+    uint8_t* counter8;            // One 8-bit counter per byte on the page
+    uint16_t* counter16;          // One 16-bit counter per byte on the page
+    bytecount_t* counter32;       // One full-width counter per byte on the page
+  };
+  unsigned int counter_width;     // Bytes per counter (1, 2, or 4)
+
+  // Get and set a counter regardless of its width.
+  bytecount_t get_count(size_t pos) const;
+  void set_count(size_t pos, bytecount_t count);
+
+  // Double the width of every counter on the page.
+  void widen(void);
+
+  // Widen every counter on the page after a range of counters wrapped around.
+  void promote(size_t pos1, size_t pos2);
+
+  // Invoke a function on each run of identical, nonzero counts.
+  template<typename T, typename Visitor>
+  void visit_runs(const T* counters, Visitor visit) const {
+    for (size_t pos = 0; pos < logical_page_size; ) {
+      T count = counters[pos];
+      size_t run_end = pos + 1;
+      while (run_end < logical_page_size && counters[run_end] == count)
+        run_end++;
+      if (count > 0)
+        visit(bytecount_t(count), run_end - pos);
+      pos = run_end;
+    }
+  }
 
 public:
   // Increment the tallies associated with a range of bytes, clamping each at
@@ -66,8 +97,21 @@ public:
   // Merge the counts from another WordPageTableEntry into ours.
   void merge(WordPageTableEntry* other);
 
-  // Expose the raw counts.
-  bytecount_t* raw_counts() { return byte_counter; }
+  // Invoke visit(count, length) on each run of identical, nonzero counts.
+  template<typename Visitor>
+  void visit_runs(Visitor visit) const {
+    switch (counter_width) {
+      case 1:
+        visit_runs(counter8, visit);
+        break;
+      case 2:
+        visit_runs(counter16, visit);
+        break;
+      default:
+        visit_runs(counter32, visit);
+        break;
+    }
+  }
 
   // Define a constructor, copy constructor, and destructor.
   WordPageTableEntry(size_t pg_size);
@@ -75,96 +119,309 @@ public:
   ~WordPageTableEntry();
 };
 
+// Represent the set of bytes on a page that a single function accessed.  A set
+// starts out as a short, sorted list of disjoint byte ranges, which suffices
+// for most functions' access patterns, and is converted to a bit vector only
+// when it becomes fragmented.
+struct CompactByteSet {
+  static const unsigned int max_ranges = 4;  // Maximum number of ranges before converting to bits
+
+  uint32_t func_id;               // Function that accessed the bytes
+  uint32_t num_ranges;            // Number of ranges in use
+  uint32_t first[max_ranges];     // First byte in each range
+  uint32_t last[max_ranges];      // Last byte in each range
+  BitPageTableEntry* bits;        // Bit vector if too fragmented for ranges, else NULL
+
+  // Add a range of bytes to the set, and return the number of bytes that were
+  // not already present.
+  size_t insert(size_t pos1, size_t pos2, size_t pg_size);
+};
+
+// Define a mapping from a page-aligned memory address to the set of bytes on
+// that page accessed by each of any number of functions.
+class FunctionSetPageTableEntry {
+private:
+  size_t logical_page_size;          // Logical page size in bytes represented
+  vector<CompactByteSet> func_sets;  // Sets of bytes, sorted by function ID
+  size_t last_set;                   // Index into func_sets of the most recently used set
+
+public:
+  // Add a range of bytes to a given function's set, and add to *unique_bytes
+  // the number of bytes that were not already present.
+  void increment(size_t pos1, size_t pos2, uint32_t func_id, uint64_t* unique_bytes);
+
+  // Define a constructor and destructor.  Entries can't be copied.
+  FunctionSetPageTableEntry(size_t pg_size) : logical_page_size(pg_size), last_set(0) { }
+  FunctionSetPageTableEntry(const FunctionSetPageTableEntry& other) = delete;
+  ~FunctionSetPageTableEntry();
+};
+
+// Define a mapping from a page-aligned memory address to the set of cache lines
+// on that page accessed during the current epoch.  Each page is tagged with
+// the epoch in which it was last accessed.  Starting a new epoch therefore
+// costs nothing: a page whose tag is stale is cleared lazily the next time it's
+// accessed.
+class EpochPageTableEntry {
+private:
+  size_t logical_page_size;   // Logical page size in bytes represented
+  uint64_t generation;        // Epoch in which the page was last accessed (0=never)
+  uint64_t* line_bits;        // One bit per line accessed during that epoch
+
+public:
+  // Mark a range of bytes as accessed during a given epoch.  Increment
+  // *new_pages if this is the epoch's first access to the page, and add to
+  // *new_lines the number of lines not previously accessed during the epoch.
+  void increment(size_t pos1, size_t pos2, uint64_t epoch,
+                 unsigned int lg_line_size, uint64_t* new_pages,
+                 uint64_t* new_lines);
+
+  // Define a constructor and destructor.  Entries can't be copied.
+  EpochPageTableEntry(size_t pg_size) :
+    logical_page_size(pg_size), generation(0), line_bits(nullptr) { }
+  EpochPageTableEntry(const EpochPageTableEntry& other) = delete;
+  ~EpochPageTableEntry() {
+    delete[] line_bits;
+  }
+};
+
 // Define a page table that associates a counter with each byte of program
-// memory.
+// memory.  Page numbers are mapped to page-table entries by a four-level radix
+// tree, much like an x86-64 page table, so a lookup is a handful of dependent
+// loads rather than a hash.  Each thread additionally caches its most recently
+// used leaves in a small, direct-mapped cache shared by all page tables.
+// Because a tree costs at least four nodes, a table that has touched only a
+// few pages instead searches its page list linearly and builds the tree only
+// once it outgrows that list.
 template<typename PTE>
 class PageTable {
 private:
-  // Define an equality functors for use in constructing various hash tables.
-  struct eqaddr {
-    bool operator()(uintptr_t p1, uintptr_t p2) const { return p1 == p2; }
+  static const unsigned int radix_bits = 9;      // Bits of page number consumed per level
+  static const uint64_t radix_fanout = uint64_t(1) << radix_bits;  // Children per node
+  static const unsigned int radix_levels = 4;    // Levels, including the leaves
+  static const unsigned int radix_span = radix_bits*radix_levels;  // Bits of page number covered by one tree
+
+  // A RadixNode is one node of the page directory.  Interior nodes point to
+  // other RadixNodes; leaves point to PTEs.
+  struct RadixNode {
+    void* child[radix_fanout];
+    RadixNode() { memset(child, 0, sizeof(child)); }
+  };
+
+  // A LeafCache entry remembers a leaf a thread recently used in a given page
+  // table.
+  struct LeafCache {
+    uint64_t table_id;   // Page table that owns the leaf (0=none)
+    uint64_t leaf_tag;   // Page number shifted right by radix_bits
+    RadixNode* leaf;     // The leaf itself
   };
+  static const size_t leaf_cache_size = 16;  // Number of leaves to cache per thread (a power of two)
+  static __thread LeafCache leaf_cache[leaf_cache_size];
+
+  // Page numbers too large for a single tree are rare on current hardware.
+  // They select a tree from an auxiliary map.
+  RadixNode* root;                                // Tree for page numbers below 2^radix_span
+  unordered_map<uint64_t, RadixNode*> far_roots;  // Trees for all other page numbers
+
+  // Record every page in the order in which it was created.
+  typedef vector<pair<uint64_t, PTE*> > page_list_t;
+  page_list_t all_pages;
 
-  // Define a mapping from a page number to the associated PageTableEntry.
-  typedef CachedUnorderedMap<uintptr_t, PTE*, hash<uintptr_t>, eqaddr> page_to_PTE_t;
-  page_to_PTE_t mapping;
+  // Search all_pages linearly until it holds more than max_list_pages pages.
+  static const size_t max_list_pages = 16;  // Maximum number of pages to search linearly
+  bool use_tree;                            // true=pages are indexed by the radix tree
+  size_t last_listed;                       // Index into all_pages of the most recently found page
 
-  // Logical page size in bytes represented
+  // Logical page size in bytes represented (a power of two) and its base-2
+  // logarithm
   size_t logical_page_size;
+  unsigned int lg_page_size;
+
+  // Unique identifier for this page table, used to tag cached leaves.
+  // Identifiers are never reused so stale cache entries can never match.
+  uint64_t table_id;
+
+  // Return a new, unique page-table identifier.
+  static uint64_t new_table_id() {
+    static uint64_t next_id = 0;
+    return __sync_add_and_fetch(&next_id, 1);
+  }
+
+  // Recursively free a subtree of the page directory but not the PTEs to
+  // which it points.
+  static void free_tree(RadixNode* node, unsigned int level) {
+    if (level + 1 < radix_levels)
+      for (uint64_t i = 0; i < radix_fanout; i++)
+        if (node->child[i] != nullptr)
+          free_tree((RadixNode*)node->child[i], level + 1);
+    delete node;
+  }
+
+  // Return the leaf covering a given page number, creating it and its
+  // ancestors if necessary.
+  RadixNode* find_or_create_leaf (uint64_t pagenum) {
+    // Check the current thread's cache.
+    uint64_t leaf_tag = pagenum >> radix_bits;
+    LeafCache& cache = leaf_cache[(table_id*7 + leaf_tag) & (leaf_cache_size - 1)];
+    if (__builtin_expect(cache.table_id == table_id && cache.leaf_tag == leaf_tag, 1))
+      return cache.leaf;
 
-  // Given a mapping of page numbers to counter vectors and a page number,
-  // return a counter vector, creating it if not found.
-  PTE* find_or_create_page (page_to_PTE_t& mapping, uint64_t pagenum) {
-    auto counters_iter = mapping.find(pagenum);
-    if (counters_iter == mapping.end()) {
+    // Find the root of the tree.
+    RadixNode* node;
+    uint64_t root_tag = pagenum >> radix_span;
+    if (__builtin_expect(root_tag == 0, 1)) {
+      if (root == nullptr)
+        root = new RadixNode();
+      node = root;
+    }
+    else {
+      RadixNode*& far_root = far_roots[root_tag];
+      if (far_root == nullptr)
+        far_root = new RadixNode();
+      node = far_root;
+    }
+
+    // Walk the tree down to the leaf.
+    for (unsigned int shift = radix_span - radix_bits; shift >= radix_bits; shift -= radix_bits) {
+      void*& child = node->child[(pagenum >> shift) & (radix_fanout - 1)];
+      if (child == nullptr)
+        child = new RadixNode();
+      node = (RadixNode*)child;
+    }
+
+    // Cache and return the leaf.
+    cache.table_id = table_id;
+    cache.leaf_tag = leaf_tag;
+    cache.leaf = node;
+    return node;
+  }
+
+  // Search the page list for a given page number, returning the page's PTE or
+  // nullptr if the page isn't listed.
+  PTE* find_listed_page (uint64_t pagenum) {
+    if (last_listed < all_pages.size() && all_pages[last_listed].first == pagenum)
+      return all_pages[last_listed].second;
+    for (size_t i = 0; i < all_pages.size(); i++)
+      if (all_pages[i].first == pagenum) {
+        last_listed = i;
+        return all_pages[i].second;
+      }
+    return nullptr;
+  }
+
+  // Index every listed page in the radix tree, which is used for all
+  // subsequent lookups.
+  void build_tree (void) {
+    use_tree = true;
+    for (auto page_iter = all_pages.begin(); page_iter != all_pages.end(); page_iter++) {
+      uint64_t pagenum = page_iter->first;
+      RadixNode* leaf = find_or_create_leaf(pagenum);
+      leaf->child[pagenum & (radix_fanout - 1)] = page_iter->second;
+    }
+  }
+
+  // Given a page number, return a counter vector, creating it if not found.
+  PTE* find_or_create_page (uint64_t pagenum) {
+    if (!use_tree) {
+      // The table is small enough to search its list of pages.
+      PTE* listed = find_listed_page(pagenum);
+      if (listed != nullptr)
+        return listed;
+      if (all_pages.size() < max_list_pages) {
+        listed = new PTE(logical_page_size);
+        last_listed = all_pages.size();
+        all_pages.push_back(make_pair(pagenum, listed));
+        return listed;
+      }
+      build_tree();
+    }
+    RadixNode* leaf = find_or_create_leaf(pagenum);
+    void*& pte = leaf->child[pagenum & (radix_fanout - 1)];
+    if (pte == nullptr) {
       // This is the first byte we've touched on the page.
-      mapping[pagenum] = new PTE(logical_page_size);
-      return mapping[pagenum];
+      PTE* new_pte = new PTE(logical_page_size);
+      pte = new_pte;
+      all_pages.push_back(make_pair(pagenum, new_pte));
     }
-    else
-      // We've seen other bytes on this page.
-      return counters_iter->second;
+    return (PTE*)pte;
   }
 
 public:
   // Store the logical page size.
-  PageTable(size_t pg_size) : logical_page_size(pg_size) { }
+  PageTable(size_t pg_size) : logical_page_size(pg_size) {
+    lg_page_size = __builtin_ctzll(pg_size);
+    root = nullptr;
+    use_tree = false;
+    last_listed = 0;
+    table_id = new_table_id();
+  }
+
+  // Page tables own their PTEs and therefore can't be copied.
+  PageTable(const PageTable& other) = delete;
+  PageTable& operator=(const PageTable& other) = delete;
 
-  // Expose iterators to our underlying address-to-PTE mapping.
-  typename page_to_PTE_t::iterator begin() { return mapping.begin(); }
-  typename page_to_PTE_t::iterator end() { return mapping.end(); }
+  // Free the page directory and all PTEs.
+  ~PageTable() {
+    for (auto page_iter = all_pages.begin(); page_iter != all_pages.end(); page_iter++)
+      delete page_iter->second;
+    if (root != nullptr)
+      free_tree(root, 0);
+    for (auto root_iter = far_roots.begin(); root_iter != far_roots.end(); root_iter++)
+      free_tree(root_iter->second, 0);
+  }
+
+  // Expose iterators to our list of {page number, PTE} pairs.
+  typename page_list_t::iterator begin() { return all_pages.begin(); }
+  typename page_list_t::iterator end() { return all_pages.end(); }
 
-  // Increment each counter in a given range.
-  void access (uint64_t baseaddr, uint64_t numaddrs) {
-    uint64_t first_page = baseaddr / logical_page_size;
-    uint64_t last_page = (baseaddr + numaddrs - 1) / logical_page_size;
-    if (first_page == last_page) {
+  // Increment each counter in a given range.  Any additional arguments are
+  // passed along to each PTE's increment() method.
+  template<typename... Args>
+  void access (uint64_t baseaddr, uint64_t numaddrs, Args... args) {
+    if (numaddrs == 0)
+      return;
+    uint64_t lastaddr = baseaddr + numaddrs - 1;
+    uint64_t first_page = baseaddr >> lg_page_size;
+    uint64_t last_page = lastaddr >> lg_page_size;
+    size_t first_ofs = baseaddr & (logical_page_size - 1);
+    size_t last_ofs = lastaddr & (logical_page_size - 1);
+    if (__builtin_expect(first_page == last_page, 1)) {
       // Common case (we hope) -- all addresses lie on the same logical page.
-      PTE* counters = find_or_create_page(mapping, first_page);
-      uint64_t pagebase = baseaddr % logical_page_size;
-      counters->increment(pagebase, pagebase + numaddrs - 1);
+      find_or_create_page(first_page)->increment(first_ofs, last_ofs, args...);
+      return;
     }
-    else
-      // Less common case -- addresses may span logical pages.
-      for (uint64_t i = 0; i < numaddrs; i++) {
-        uint64_t address = baseaddr + i;
-        uint64_t pagenum = address / logical_page_size;
-        uint64_t byteoffset = address % logical_page_size;
-        PTE* counters = find_or_create_page(mapping, pagenum);
-        counters->increment(byteoffset, byteoffset);
-      }
+
+    // Less common case -- addresses span logical pages.  Split the range at
+    // page boundaries.
+    find_or_create_page(first_page)->increment(first_ofs, logical_page_size - 1, args...);
+    for (uint64_t pagenum = first_page + 1; pagenum < last_page; pagenum++)
+      find_or_create_page(pagenum)->increment(0, logical_page_size - 1, args...);
+    find_or_create_page(last_page)->increment(0, last_ofs, args...);
   }
 
   // Merge another page table into ours.
   void merge (PageTable<PTE>* other) {
-    // Ensure we have a superset of the other page table's pages.
-    for (auto page_iter = other->mapping.begin();
-         page_iter != other->mapping.end();
-         page_iter++) {
-      uint64_t page_num = page_iter->first;
-      if (mapping.find(page_num) != mapping.end())
-        continue;
-      mapping[page_num] = new PTE(logical_page_size);
-    }
+    for (auto page_iter = other->all_pages.begin();
+         page_iter != other->all_pages.end();
+         page_iter++)
+      find_or_create_page(page_iter->first)->merge(page_iter->second);
+  }
 
-    // Merge page-by-page.
-    for (auto page_iter = mapping.begin();
-         page_iter != mapping.end();
-         page_iter++) {
-      uint64_t page_num = page_iter->first;
-      auto other_page_iter = other->mapping.find(page_num);
-      if (other_page_iter == other->mapping.end())
-        continue;
-      BitPageTableEntry* pte = other_page_iter->second;
-      page_iter->second->merge(pte);
-    }
+  // Merge into ours only those of another page table's pages that belong to
+  // a given shard.  Pages are assigned to shards one radix leaf at a time so
+  // that page tables built for different shards share no leaves.
+  void merge (PageTable<PTE>* other, size_t shard, size_t num_shards) {
+    for (auto page_iter = other->all_pages.begin();
+         page_iter != other->all_pages.end();
+         page_iter++)
+      if ((page_iter->first >> radix_bits) % num_shards == shard)
+        find_or_create_page(page_iter->first)->merge(page_iter->second);
   }
 
   // Return the number of unique addresses accessed.
   uint64_t tally_unique (void) {
     uint64_t unique_addrs = 0;
-    for (auto page_iter = mapping.begin();
-         page_iter != mapping.end();
+    for (auto page_iter = all_pages.begin();
+         page_iter != all_pages.end();
          page_iter++) {
       const PTE* counters = page_iter->second;
       unique_addrs += counters->count();
@@ -173,10 +430,111 @@ public:
   }
 };
 
+// Define storage for each thread's leaf cache.
+template<typename PTE>
+__thread typename PageTable<PTE>::LeafCache PageTable<PTE>::leaf_cache[PageTable<PTE>::leaf_cache_size];
+
 // For convenience, define concrete BitPageTable and WordPageTable classes.
 typedef PageTable<BitPageTableEntry> BitPageTable;
 typedef PageTable<WordPageTableEntry> WordPageTable;
 
+// Define a page table that records which bytes each of many functions
+// accessed.  All functions share a single page directory, and each page stores
+// only compact per-function byte sets, so memory grows with the program's
+// footprint rather than with the number of functions times their footprints.
+class FunctionPageTable {
+private:
+  PageTable<FunctionSetPageTableEntry> pages;      // Per-page, per-function byte sets
+  CachedUnorderedMap<const char*, uint32_t> func_ids;  // Map from a function name to a dense ID
+  vector<uint64_t> unique_bytes;                   // Number of unique bytes accessed by each function
+
+public:
+  // Store the logical page size.
+  FunctionPageTable(size_t pg_size) : pages(pg_size) { }
+
+  // Associate a range of addresses with a given function.
+  void access (const char* funcname, uint64_t baseaddr, uint64_t numaddrs) {
+    uint32_t func_id;
+    auto id_iter = func_ids.find(funcname);
+    if (id_iter == func_ids.end()) {
+      // This is the first time we've seen this function.
+      func_id = uint32_t(unique_bytes.size());
+      func_ids[funcname] = func_id;
+      unique_bytes.push_back(0);
+    }
+    else
+      func_id = id_iter->second;
+    pages.access(baseaddr, numaddrs, func_id, &unique_bytes[func_id]);
+  }
+
+  // Return the number of unique addresses a given function accessed.
+  uint64_t tally_unique (const char* funcname) {
+    auto id_iter = func_ids.find(funcname);
+    return id_iter == func_ids.end() ? 0 : unique_bytes[id_iter->second];
+  }
+};
+
+// Choose the logical page size for one analysis.  The size is read from an
+// environment variable, which may specify either a power of two or "auto"
+// (the default).  In auto mode, the analysis's first accesses are sampled,
+// and the page size is chosen to minimize the memory the analysis's page
+// tables would consume plus a cost for each page-table lookup.  Until a size
+// is chosen, the analysis is expected to defer creating its page tables and
+// afterwards to replay the sampled accesses into them.
+class PageSizeChooser {
+public:
+  // Record a single sampled access.
+  struct SampledAccess {
+    const void* owner;       // Analysis-specific owner of the access (e.g., a function name)
+    uint64_t baseaddr;       // First address accessed
+    uint64_t numaddrs;       // Number of addresses accessed
+  };
+
+private:
+  static const size_t max_samples = 65536;        // Number of accesses to sample
+  const char* description;          // Name of the analysis, for reporting
+  double bytes_per_address;         // Page-table memory per address on a page
+  size_t chosen_size;               // Logical page size (0=not yet chosen)
+  bool automatic;                   // true=size chosen by sampling; false=specified by the user
+  vector<SampledAccess> sampled;    // Accesses sampled so far
+
+public:
+  // Determine the page size from a given environment variable.
+  PageSizeChooser(const char* env_var, const char* desc, double bytes_per_addr);
+
+  // Return the chosen page size, or 0 if we're still sampling.
+  size_t page_size() const {
+    return chosen_size;
+  }
+
+  // Record an access while sampling.  Return true if this access completes
+  // the sample and a page size has been chosen.
+  bool sample(const void* owner, uint64_t baseaddr, uint64_t numaddrs) {
+    SampledAccess access = {owner, baseaddr, numaddrs};
+    sampled.push_back(access);
+    if (sampled.size() < max_samples)
+      return false;
+    choose();
+    return true;
+  }
+
+  // Choose a page size based on the accesses sampled so far.
+  void choose();
+
+  // Expose the sampled accesses so they can be replayed.
+  const vector<SampledAccess>& samples() const {
+    return sampled;
+  }
+
+  // Free the memory used by the sampled accesses.
+  void discard_samples() {
+    vector<SampledAccess>().swap(sampled);
+  }
+
+  // Output each analysis's page size.
+  static void report_all();
+};
+
 } // namespace bytesflops
 
 #endif
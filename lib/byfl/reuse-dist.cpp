@@ -12,329 +12,522 @@ using namespace std;
 
 namespace bytesflops {
 
-typedef CachedUnorderedMap<uint64_t, uint64_t> addr_to_time_t;
-addr_to_time_t last_access;   // Last access time of a given address
-
-// An RDnode is one node in a reuse-distance tree.
-class RDnode {
+// An AddressTimeMap maps an address to the time of its most recent access.
+// It is implemented as an open-addressing hash table with Robin Hood
+// insertion and backward-shift deletion so lookups touch only a few adjacent
+// cache lines and deletions leave no tombstones behind.
+class AddressTimeMap {
 private:
-  RDnode* left;         // Left child
-  RDnode* right;        // Right child
+  // An Entry is one slot in the hash table.
+  struct Entry {
+    uint64_t address;   // Key
+    uint64_t time;      // Value, or empty_time if the slot is unused
+  };
+  static const uint64_t empty_time = ~(uint64_t)0;  // Marker for an unused slot
+  static const uint64_t no_slot = ~(uint64_t)0;     // Marker for a failed search
+  Entry* table;         // The hash table proper
+  uint64_t mask;        // Number of slots minus one (a power of two minus one)
+  unsigned int shift;   // 64 minus log base 2 of the number of slots
+  uint64_t num_entries; // Number of slots in use
+
+  // Return the preferred slot for a given address (Fibonacci hashing).
+  uint64_t home(uint64_t address) const {
+    return (address*0x9E3779B97F4A7C15ULL) >> shift;
+  }
 
-  // Fix the node's weight (subtree size).
-  void fix_node_weight();
+  // Return how far a slot's entry lies from its preferred slot.
+  uint64_t probe_distance(uint64_t slot) const {
+    return (slot - home(table[slot].address)) & mask;
+  }
+
+  // Return the slot containing a given address or no_slot if the address is
+  // not in the map.  Because of Robin Hood ordering, the search can stop as
+  // soon as it reaches an entry closer to its preferred slot than the address
+  // would be.
+  uint64_t find_slot(uint64_t address) const {
+    uint64_t slot = home(address);
+    for (uint64_t dist = 0; ; dist++, slot = (slot + 1) & mask) {
+      const Entry& entry = table[slot];
+      if (entry.time == empty_time || probe_distance(slot) < dist)
+        return no_slot;
+      if (entry.address == address)
+        return slot;
+    }
+  }
 
-  // Fix the weight of all nodes along the path to a given time.
-  void fix_path_weights(uint64_t time);
+  // Allocate an empty table with 2^lg_slots slots.
+  void allocate(unsigned int lg_slots) {
+    uint64_t num_slots = uint64_t(1) << lg_slots;
+    table = (Entry*) malloc(num_slots*sizeof(Entry));
+    if (table == nullptr) {
+      cerr << "Failed to allocate memory for the reuse-distance address map\n";
+      bf_abend();
+    }
+    for (uint64_t i = 0; i < num_slots; i++)
+      table[i].time = empty_time;
+    mask = num_slots - 1;
+    shift = 64 - lg_slots;
+    num_entries = 0;
+  }
 
-  // Splay a value to the top of the tree, returning the new tree.
-  RDnode* splay(uint64_t target);
+  // Double the number of slots in the table.
+  void grow() {
+    Entry* old_table = table;
+    uint64_t old_slots = mask + 1;
+    allocate(65 - shift);
+    for (uint64_t i = 0; i < old_slots; i++)
+      if (old_table[i].time != empty_time)
+        insert(old_table[i].address, old_table[i].time);
+    free(old_table);
+  }
 
 public:
+  // Initialize an empty map.
+  AddressTimeMap() {
+    allocate(16);
+  }
+
+  // Return the number of addresses in the map.
+  uint64_t size() const {
+    return num_entries;
+  }
+
+  // Return a pointer to the time associated with a given address or nullptr
+  // if the address is not in the map.  The pointer remains valid until the
+  // next insertion or deletion.
+  uint64_t* find(uint64_t address) {
+    uint64_t slot = find_slot(address);
+    return slot == no_slot ? nullptr : &table[slot].time;
+  }
+
+  // Insert an address that is known not to be in the map.
+  void insert(uint64_t address, uint64_t time) {
+    if ((num_entries + 1)*5 > (mask + 1)*4)
+      grow();
+    Entry new_entry = {address, time};
+    uint64_t slot = home(address);
+    for (uint64_t dist = 0; ; dist++, slot = (slot + 1) & mask) {
+      Entry& entry = table[slot];
+      if (entry.time == empty_time) {
+        entry = new_entry;
+        num_entries++;
+        return;
+      }
+
+      // Steal the slot from any entry that is closer to its preferred slot
+      // than we are to ours, and continue by inserting that entry instead.
+      uint64_t entry_dist = probe_distance(slot);
+      if (entry_dist < dist) {
+        swap(entry, new_entry);
+        dist = entry_dist;
+      }
+    }
+  }
+
+  // Remove an address from the map if present.
+  void erase(uint64_t address) {
+    uint64_t slot = find_slot(address);
+    if (slot == no_slot)
+      return;
+
+    // Shift each subsequent displaced entry back by one slot.
+    uint64_t next = (slot + 1) & mask;
+    while (table[next].time != empty_time && probe_distance(next) != 0) {
+      table[slot] = table[next];
+      slot = next;
+      next = (next + 1) & mask;
+    }
+    table[slot].time = empty_time;
+    num_entries--;
+  }
+};
+
+AddressTimeMap last_access;   // Last access time of a given address
+
+// An RDindex identifies an RDnode within an RDtree's node pool.  Index 0 is
+// reserved to represent a null child.
+typedef uint32_t RDindex;
+const RDindex RDnil = 0;
+
+// An RDnode is one node in a reuse-distance tree.
+struct RDnode {
   uint64_t address;     // Address from trace
   uint64_t time;        // Time of the address's last access
-  uint64_t weight;      // Number of items in this subtree (self included)
+  RDindex left;         // Left child
+  RDindex right;        // Right child
+  uint32_t weight;      // Number of items in this subtree (self included)
+};
+
+// An RDtree is a splay tree of RDnodes ordered by timestamp.  Nodes are
+// allocated from a single, growable arena and referenced by 32-bit index
+// rather than by pointer, which roughly halves the per-node memory cost
+// relative to individually allocated nodes.  Deleted nodes are kept on a free
+// list for reuse.
+class RDtree {
+private:
+  RDnode* pool;            // Arena of all nodes, including freed ones
+  RDindex pool_size;       // Number of nodes the arena can hold
+  RDindex next_unused;     // Index of the first never-allocated node
+  RDindex free_list;       // Freed nodes, linked through their left child
+  RDindex root;            // Root of the tree
+
+  // Map an index to a node.  Node 0 has weight 0 and otherwise serves as
+  // scratch space for splay().
+  RDnode& node(RDindex idx) {
+    return pool[idx];
+  }
 
-  // Initialize a new RDnode with a given address and timestamp (defaulting to
-  // dummy values).
-  RDnode();
-  RDnode(uint64_t address, uint64_t time);
+  // Allocate a node with a given address and timestamp.
+  RDindex allocate(uint64_t address, uint64_t time);
 
-  // Reinitialize an existing RDnode with a given address and timestamp.
-  void initialize(uint64_t address, uint64_t time);
+  // Return a node to the free list.
+  void release(RDindex idx) {
+    node(idx).left = free_list;
+    free_list = idx;
+  }
 
-  // Insert a node into the tree and return the new tree.
-  RDnode* insert(RDnode* new_node);
+  // Fix a node's weight (subtree size).
+  void fix_node_weight(RDindex idx) {
+    RDnode& n = node(idx);
+    n.weight = 1 + node(n.left).weight + node(n.right).weight;
+  }
 
-  // Remove a timestamp from the tree and return the new tree and the node that
-  // was deleted.
-  RDnode* remove(uint64_t timestamp, RDnode** removed_node);
+  // Fix the weight of all nodes along the path from a subtree to a given
+  // time.
+  void fix_path_weights(RDindex subtree, uint64_t target);
+
+  // Splay a value to the top of a subtree, returning the new subtree.
+  RDindex splay(RDindex subtree, uint64_t target);
+
+  // Recursively ensure that all nodes in a subtree have a valid weight.
+  uint64_t validate_weights(RDindex subtree);
+
+public:
+  // Create an empty tree.
+  RDtree();
+
+  // Return true if the tree contains no nodes.
+  bool empty() const { return root == RDnil; }
+
+  // Insert an address with a given timestamp into the tree.
+  void insert(uint64_t address, uint64_t time);
+
+  // Remove a timestamp from the tree.
+  void remove(uint64_t timestamp);
 
   // Remove all timestamps less than a given value from the tree and from a
-  // given histogram, and return the new tree.
-  RDnode* prune_tree(uint64_t timestamp, addr_to_time_t* histogram);
+  // given histogram.
+  void prune_tree(uint64_t timestamp, AddressTimeMap* histogram);
 
-  // Return the number of nodes in a splay tree whose timestamp is larger than
-  // a given value.
+  // Return the number of nodes in the tree whose timestamp is larger than a
+  // given value.
   uint64_t tree_dist(uint64_t timestamp);
 
   // Ensure that all nodes have a valid weight.
-  void validate_weights();
+  void validate_weights() { validate_weights(root); }
 };
 
-// fix_node_weight() sets the weight of a given node to the sum of its
-// immediate children's weight plus one.
-void RDnode::fix_node_weight()
+// Create an empty tree.  Node 0 is permanently allocated to represent null.
+RDtree::RDtree()
 {
-  uint64_t new_weight = 1;
-  if (left != nullptr)
-    new_weight += left->weight;
-  if (right != nullptr)
-    new_weight += right->weight;
-  weight = new_weight;
+  pool_size = 1024;
+  pool = (RDnode*) malloc(pool_size*sizeof(RDnode));
+  RDnode& nil_node = node(RDnil);
+  nil_node.address = 0;
+  nil_node.time = 0;
+  nil_node.left = RDnil;
+  nil_node.right = RDnil;
+  nil_node.weight = 0;
+  next_unused = 1;
+  free_list = RDnil;
+  root = RDnil;
+}
+
+// allocate() returns a node from the free list if possible or from the
+// pool of never-used nodes, doubling the size of the pool if necessary.
+RDindex RDtree::allocate(uint64_t address, uint64_t time)
+{
+  RDindex idx;
+  if (free_list != RDnil) {
+    // Reuse a previously freed node.
+    idx = free_list;
+    free_list = node(idx).left;
+  }
+  else {
+    // Allocate a new node.
+    if (__builtin_expect(next_unused == pool_size, 0)) {
+      if (pool_size == ~RDindex(0)) {
+        cerr << "Reuse-distance tree exceeded "
+             << pool_size << " nodes; try -bf-max-rdist\n";
+        bf_abend();
+      }
+      uint64_t new_size = min(uint64_t(pool_size)*2, uint64_t(~RDindex(0)));
+      pool = (RDnode*) realloc(pool, new_size*sizeof(RDnode));
+      if (pool == nullptr) {
+        cerr << "Failed to allocate memory for the reuse-distance tree\n";
+        bf_abend();
+      }
+      pool_size = RDindex(new_size);
+    }
+    idx = next_unused++;
+  }
+  RDnode& n = node(idx);
+  n.address = address;
+  n.time = time;
+  n.left = RDnil;
+  n.right = RDnil;
+  n.weight = 1;
+  return idx;
 }
 
 
 // fix_path_weights() fixes node weights along the path to a given time.
-void RDnode::fix_path_weights(uint64_t target)
+void RDtree::fix_path_weights(RDindex subtree, uint64_t target)
 {
   // Do an ordinary binary tree search for target -- which we expect not to
-  // find -- but change child pointers to parent pointers as we go (instead of
+  // find -- but change child indexes to parent indexes as we go (instead of
   // requiring extra memory to maintain our path back to the root).
-  RDnode* parent = nullptr;
-  RDnode* node = this;
-  while (node != nullptr) {
-    RDnode* child;
-    if (target < node->time) {
-      child = node->left;
-      node->left = parent;
+  RDindex parent = RDnil;
+  RDindex idx = subtree;
+  while (idx != RDnil) {
+    RDnode& n = node(idx);
+    RDindex child;
+    if (target < n.time) {
+      child = n.left;
+      n.left = parent;
     }
     else {
-      child = node->right;
-      node->right = parent;
+      child = n.right;
+      n.right = parent;
     }
-    parent = node;
-    node = child;
-  }
-
-  // Walk back up the tree, fixing weights and child pointers as we go.
-  while (parent != nullptr) {
-    RDnode* prev_node = node;
-    node = parent;
-    if (target < node->time) {
-      // We borrowed our left child's pointer.
-      parent = node->left;
-      node->left = prev_node;
+    parent = idx;
+    idx = child;
+  }
+
+  // Walk back up the tree, fixing weights and child indexes as we go.
+  while (parent != RDnil) {
+    RDindex prev_idx = idx;
+    idx = parent;
+    RDnode& n = node(idx);
+    if (target < n.time) {
+      // We borrowed our left child's index.
+      parent = n.left;
+      n.left = prev_idx;
     }
     else {
-      // We borrowed our right child's pointer.
-      parent = node->right;
-      node->right = prev_node;
+      // We borrowed our right child's index.
+      parent = n.right;
+      n.right = prev_idx;
     }
-    node->fix_node_weight();
+    fix_node_weight(idx);
   }
 }
 
 
 // splay() splays a value (or a nearby value if the value doesn't appear in the
-// tree) to the top of the tree, returning the new tree.
-RDnode* RDnode::splay(uint64_t target)
+// tree) to the top of a subtree, returning the new subtree.
+RDindex RDtree::splay(RDindex subtree, uint64_t target)
 {
-  RDnode* node = this;
-  RDnode new_node;
-  new_node.left = nullptr;
-  new_node.right = nullptr;
-  RDnode* left = &new_node;
-  RDnode* right = &new_node;
+  // Node 0 serves as the temporary header node whose children accumulate
+  // the left and right trees.
+  RDindex idx = subtree;
+  RDnode& header = node(RDnil);
+  header.left = RDnil;
+  header.right = RDnil;
+  RDindex left = RDnil;
+  RDindex right = RDnil;
 
   while (true) {
-    if (target < node->time) {
-      if (node->left == nullptr)
+    RDnode* n = &node(idx);
+    if (target < n->time) {
+      if (n->left == RDnil)
         break;
-      if (target < node->left->time) {
+      if (target < node(n->left).time) {
         // Rotate right
-        RDnode* parent = node->left;
-        node->left = parent->right;
-        parent->right = node;
-        node = parent;
+        RDindex parent = n->left;
+        n->left = node(parent).right;
+        node(parent).right = idx;
+        idx = parent;
+        n = &node(idx);
 
         // Fix weights.
-        node->right->fix_node_weight();
-        node->fix_node_weight();
-        if (node->left == nullptr)
+        fix_node_weight(n->right);
+        fix_node_weight(idx);
+        if (n->left == RDnil)
           break;
       }
 
       // Link right
-      right->left = node;
-      right = node;
-      node = node->left;
+      node(right).left = idx;
+      right = idx;
+      idx = n->left;
     }
     else
-      if (target > node->time) {
-        if (node->right == nullptr)
+      if (target > n->time) {
+        if (n->right == RDnil)
           break;
-        if (target > node->right->time) {
+        if (target > node(n->right).time) {
           // Rotate left
-          RDnode* parent = node->right;
-          node->right = parent->left;
-          parent->left = node;
-          node = parent;
+          RDindex parent = n->right;
+          n->right = node(parent).left;
+          node(parent).left = idx;
+          idx = parent;
+          n = &node(idx);
 
           // Fix weights.
-          node->left->fix_node_weight();
-          node->fix_node_weight();
-          if (node->right == nullptr)
+          fix_node_weight(n->left);
+          fix_node_weight(idx);
+          if (n->right == RDnil)
             break;
         }
 
         // Link left
-        left->right = node;
-        left = node;
-        node = node->right;
+        node(left).right = idx;
+        left = idx;
+        idx = n->right;
       }
       else
         break;
   }
 
   // Assemble the final tree.
-  left->right = node->left;
-  right->left = node->right;
-  node->left = new_node.right;
-  node->right = new_node.left;
+  RDnode& n = node(idx);
+  node(left).right = n.left;
+  node(right).left = n.right;
+  n.left = header.right;
+  n.right = header.left;
+  header.left = RDnil;
+  header.right = RDnil;
 
   // Fix weights up to the node from its previous position.
-  if (node->left != nullptr)
-    node->left->fix_path_weights(node->time);
-  if (node->right != nullptr)
-    node->right->fix_path_weights(node->time);
-  return node;
+  if (n.left != RDnil)
+    fix_path_weights(n.left, n.time);
+  if (n.right != RDnil)
+    fix_path_weights(n.right, n.time);
+  return idx;
 }
 
-// insert() inserts a new node into a splay tree and returns the new tree.
-// Duplicates insertions produce undefined behavior.  Insertions into NULL
-// trees produce undefined behavior.  (The caller should check for the
-// first-insertion and allocate memory accordingly.)
-RDnode* RDnode::insert(RDnode* new_node)
+// insert() inserts a new address and timestamp into the tree.  Duplicate
+// timestamps produce undefined behavior.
+void RDtree::insert(uint64_t address, uint64_t time)
 {
+  // Handle the first insertion into the tree.
+  RDindex new_idx = allocate(address, time);
+  if (__builtin_expect(root == RDnil, 0)) {
+    root = new_idx;
+    return;
+  }
+
   // Handle some simple cases.
-  RDnode* node = this;
-  node = node->splay(new_node->time);
-  if (new_node->time == node->time)
+  RDindex idx = splay(root, time);
+  RDnode& n = node(idx);
+  RDnode& new_node = node(new_idx);
+  if (time == n.time)
     // The timestamp is already in the tree.  This should never happen when the
     // tree is used for reuse-distance calculations.
     abort();
 
   // Handle the normal cases.
-  if (new_node->time > node->time) {
-    new_node->right = node->right;
-    new_node->left = node;
-    node->right = nullptr;
+  if (time > n.time) {
+    new_node.right = n.right;
+    new_node.left = idx;
+    n.right = RDnil;
   }
   else {
-    new_node->left = node->left;
-    new_node->right = node;
-    node->left = nullptr;
+    new_node.left = n.left;
+    new_node.right = idx;
+    n.left = RDnil;
   }
-  node->fix_node_weight();
-  new_node->fix_node_weight();
-  return new_node;
+  fix_node_weight(idx);
+  fix_node_weight(new_idx);
+  root = new_idx;
 }
 
 
-// remove() deletes a timestamp from the tree and returns the new tree and the
-// deleted node.  Missing timestamps produce undefined behavior.
-RDnode* RDnode::remove(uint64_t target, RDnode** removed_node)
+// remove() deletes a timestamp from the tree and frees the corresponding node.
+// Missing timestamps produce undefined behavior.
+void RDtree::remove(uint64_t target)
 {
-  RDnode* node = this;
-  node = node->splay(target);
-  if (node->time != target)
+  RDindex idx = splay(root, target);
+  RDnode& n = node(idx);
+  if (n.time != target)
     // Not found
     abort();
-  RDnode* new_root;
-  if (node->left == nullptr)
+  RDindex new_root;
+  if (n.left == RDnil)
     // Smallest value in the tree
-    new_root = node->right;
+    new_root = n.right;
   else {
     // Any other value
-    new_root = node->left->splay(target);
-    if (new_root != nullptr) {
-      new_root->right = node->right;
-      if (new_root->right != nullptr)
-        new_root->right->fix_node_weight();
-      new_root->fix_node_weight();
+    new_root = splay(n.left, target);
+    if (new_root != RDnil) {
+      RDnode& r = node(new_root);
+      r.right = n.right;
+      if (r.right != RDnil)
+        fix_node_weight(r.right);
+      fix_node_weight(new_root);
     }
   }
-  *removed_node = node;
-  return new_root;
+  release(idx);
+  root = new_root;
 }
 
 
 // Remove all timestamps less than a given value from the tree and from a given
-// histogram, and return the new tree and new set of symbols.
-RDnode* RDnode::prune_tree(uint64_t timestamp, addr_to_time_t* histogram)
+// histogram.
+void RDtree::prune_tree(uint64_t timestamp, AddressTimeMap* histogram)
 {
-  RDnode* new_tree = splay(0);
-  while (new_tree && new_tree->time < timestamp) {
-    RDnode* dead_node = new_tree;
-    new_tree = new_tree->right;
-    if (new_tree->left)
-      new_tree = new_tree->splay(0);
-    histogram->erase(dead_node->address);
-    delete dead_node;
-  }
-  return new_tree;
+  if (root == RDnil)
+    return;
+  RDindex new_tree = splay(root, 0);
+  while (new_tree != RDnil && node(new_tree).time < timestamp) {
+    RDindex dead_idx = new_tree;
+    new_tree = node(new_tree).right;
+    if (new_tree != RDnil && node(new_tree).left != RDnil)
+      new_tree = splay(new_tree, 0);
+    histogram->erase(node(dead_idx).address);
+    release(dead_idx);
+  }
+  root = new_tree;
 }
 
 
-// tree_dist() returns the number of nodes in a splay tree whose timestamp is
+// tree_dist() returns the number of nodes in the tree whose timestamp is
 // larger than a given value.
-uint64_t RDnode::tree_dist(uint64_t timestamp)
+uint64_t RDtree::tree_dist(uint64_t timestamp)
 {
-  RDnode* node = this;
+  RDindex idx = root;
   uint64_t num_larger = 0;
   while (true) {
-    if (timestamp > node->time) {
-      node = node->right;
+    RDnode& n = node(idx);
+    if (timestamp > n.time) {
+      idx = n.right;
     }
     else
-      if (timestamp < node->time) {
-        num_larger++;
-        if (node->right != nullptr)
-          num_larger += node->right->weight;
-        node = node->left;
-      }
-      else {
-        if (node->right != nullptr)
-          num_larger += node->right->weight;
-        return num_larger;
+      if (timestamp < n.time) {
+        num_larger += 1 + node(n.right).weight;
+        idx = n.left;
       }
+      else
+        return num_larger + node(n.right).weight;
   }
 }
 
 
-// For debugging purposes, ensure that every node of a tree contains correct
-// weights.
-void RDnode::validate_weights()
+// For debugging purposes, ensure that every node of a subtree contains correct
+// weights.  Return the subtree's weight.
+uint64_t RDtree::validate_weights(RDindex subtree)
 {
-  uint64_t true_weight = 1;
-  if (left != nullptr) {
-    left->validate_weights();
-    true_weight += left->weight;
-  }
-  if (right != nullptr) {
-    right->validate_weights();
-    true_weight += right->weight;
-  }
-  if (weight != true_weight) {
-    cerr << "*** Internal error: Node " << this << " has weight "
-         << weight << " but expected weight " << true_weight << " ***\n";
+  if (subtree == RDnil)
+    return 0;
+  RDnode& n = node(subtree);
+  uint64_t true_weight = 1 + validate_weights(n.left) + validate_weights(n.right);
+  if (n.weight != true_weight) {
+    cerr << "*** Internal error: Node " << subtree << " has weight "
+         << n.weight << " but expected weight " << true_weight << " ***\n";
     abort();
   }
-}
-
-// Reinitialize an existing RDnode with a given address and timestamp.
-void RDnode::initialize(uint64_t new_address, uint64_t new_time)
-{
-  address = new_address;
-  time = new_time;
-  weight = 1;
-  left = nullptr;
-  right = nullptr;
-}
-
-
-// Initialize a new RDnode with a dummy address and timestamp.
-RDnode::RDnode()
-{
-  initialize(0, 0);
-}
-
-
-// Initialize a new RDnode with a given address and timestamp.
-RDnode::RDnode(uint64_t address, uint64_t time)
-{
-  initialize(address, time);
+  return true_weight;
 }
 
 
@@ -347,121 +540,128 @@ const uint64_t infinite_distance = ~(uint64_t)0;
 class ReuseDistance {
 private:
   uint64_t clock;           // Current time
-  vector<uint64_t> hist;    // Histogram of the number of times each reuse distance was observed
+  BinnedHistogram hist;     // Histogram of the number of times each reuse distance was observed
   uint64_t unique_entries;  // Number of unique addresses (infinite reuse distance)
-  RDnode* dist_tree;        // Tree of reuse distances
+  RDtree dist_tree;         // Tree of reuse distances
 
 public:
   // Initialize our various fields.
   ReuseDistance() {
     clock = 0;
     unique_entries = 0;
-    dist_tree = nullptr;
   }
 
-  // Incorporate a new address into the reuse-distance histogram.
-  void process_address(uint64_t address);
+  // Incorporate a new address into the reuse-distance histogram and return
+  // its reuse distance.
+  uint64_t process_address(uint64_t address);
 
   // Return a pointer to the reuse-distance histogram.
-  vector<uint64_t>* get_histogram() { return &hist; }
+  BinnedHistogram* get_histogram() { return &hist; }
 
   // Return the number of unique addresses.
   uint64_t get_unique_addrs() { return unique_entries; }
 
   // Compute the median reuse distance.
-  void compute_median(uint64_t* median_value, uint64_t* mad_value);
+  void compute_median(uint64_t* median_value, uint64_t* mad_value) {
+    bf_compute_median_distance(hist, unique_entries, median_value, mad_value);
+  }
 };
 
 
-// Incorporate a new address into the reuse-distance histogram.
-void ReuseDistance::process_address(uint64_t address)
+// Incorporate a new address into the reuse-distance histogram and return its
+// reuse distance.
+uint64_t ReuseDistance::process_address(uint64_t address)
 {
   // Update the histogram.
   uint64_t distance = infinite_distance;
-  addr_to_time_t::iterator prev_time_iter = last_access.find(address);
-  RDnode* new_node = nullptr;
-  if (prev_time_iter != last_access.end()) {
+  uint64_t* prev_time = last_access.find(address);
+  if (prev_time != nullptr) {
     // We've previously seen this address.
-    uint64_t prev_time = prev_time_iter->second;
-    distance = dist_tree->tree_dist(prev_time);
-    dist_tree = dist_tree->remove(prev_time, &new_node);
-  }
-  uint64_t hist_len = hist.size();
-  if (distance < hist_len)
-    // We've previously seen both this symbol and this reuse distance.
-    hist[distance]++;
-  else {
-    if (distance == infinite_distance)
-      // This is the first time we've seen this symbol.
-      unique_entries++;
-    else {
-      // We've previously seen this symbol but not this reuse distance.
-      hist.resize(distance+1, 0);
-      hist[distance]++;
-    }
+    distance = dist_tree.tree_dist(*prev_time);
+    dist_tree.remove(*prev_time);
   }
-
-  // Update the tree and the map.
-  if (new_node == nullptr)
-    new_node = new RDnode(address, clock);
+  if (distance == infinite_distance)
+    // This is the first time we've seen this symbol.
+    unique_entries++;
   else
-    new_node->initialize(address, clock);
-  if (__builtin_expect(dist_tree == nullptr, 0))
-    // First insertion into the tree.
-    dist_tree = new_node;
+    // We've previously seen this symbol.
+    hist.increment(distance);
+
+  // Update the tree and the map.  The node freed by remove() above, if any,
+  // is immediately reused by insert().  The map has not been modified since
+  // the find() above so prev_time, if non-null, is still valid.
+  dist_tree.insert(address, clock);
+  if (prev_time != nullptr)
+    *prev_time = clock;
   else
-    // All other tree insertions.
-    dist_tree = dist_tree->insert(new_node);
-  last_access[address] = clock;
+    last_access.insert(address, clock);
   clock++;
 
   // If the tree and the map have grown too large, prune old addresses from
   // them.
   if (last_access.size() > bf_max_reuse_distance)
-    dist_tree = dist_tree->prune_tree(clock - bf_max_reuse_distance, &last_access);
+    dist_tree.prune_tree(clock - bf_max_reuse_distance, &last_access);
+  return distance;
 }
 
 
-// Compute the median reuse distance and the median absolute deviation of that.
-void ReuseDistance::compute_median(uint64_t* median_value, uint64_t* mad_value) {
+// Compute the median of a histogram of reuse distances plus a number of
+// infinite distances, and the median absolute deviation of that.  Both are
+// computed from the binned histogram and are therefore exact only for small
+// distances and within a bin's width for larger distances.
+void bf_compute_median_distance (const BinnedHistogram& hist,
+                                 uint64_t unique_entries,
+                                 uint64_t* median_value, uint64_t* mad_value)
+{
   // Find the total tally.
-  uint64_t hist_len = hist.size();   // Entries in the histogram
+  size_t num_bins = hist.size();     // Number of bins in use
   uint64_t total_tally;              // Total number of accesses including one-time accesses
-  total_tally = unique_entries - hist_len;
-  for (size_t dist = 0; dist < hist_len; dist++)
-    total_tally += hist[dist];
+  total_tally = unique_entries + hist.total();
 
-  // Find the distance that lies at half the total tally.
+  // Find the bin that lies at half the total tally.  If we never get there,
+  // the median distance is infinite.
   uint64_t median_distance = infinite_distance;
   uint64_t median_tally = 0;
-  for (size_t dist = 0; dist < hist_len; dist++) {
-    median_distance = dist;
-    median_tally += hist[dist];
-    if (median_tally > total_tally/2)
+  for (size_t bin = 0; bin < num_bins; bin++) {
+    median_tally += hist[bin];
+    if (median_tally > total_tally/2) {
+      median_distance = BinnedHistogram::bin_value(bin);
       break;
+    }
+  }
+  if (median_distance == infinite_distance) {
+    *median_value = infinite_distance;
+    *mad_value = 0;
+    return;
   }
 
-  // Tally the absolute deviations.
-  vector<uint64_t> absdev(hist_len, 0);
-  for (size_t dist = 0; dist < hist_len; dist++) {
-    uint64_t tally = hist[dist];
+  // Tally the absolute deviations of each bin's representative distance.
+  // Infinite distances are infinitely far from the median.
+  static BinnedHistogram absdev;
+  absdev.clear();
+  for (size_t bin = 0; bin < num_bins; bin++) {
+    uint64_t tally = hist[bin];
+    if (tally == 0)
+      continue;
+    uint64_t dist = BinnedHistogram::bin_value(bin);
     uint64_t deviation;
     if (dist > median_distance)
       deviation = dist - median_distance;
     else
       deviation = median_distance - dist;
-    absdev[deviation] += tally;
+    absdev.increment(deviation, tally);
   }
 
   // Find the deviation that lies at half the total tally.
-  uint64_t mad = 0;
+  uint64_t mad = infinite_distance;
   uint64_t absdev_tally = 0;
-  uint64_t absdev_len = absdev.size();
-  for (size_t dev = 0; dev < absdev_len; dev++) {
-    mad = dev;
-    absdev_tally += absdev[dev];
-    if (absdev_tally > total_tally/2)
+  size_t absdev_len = absdev.size();
+  for (size_t bin = 0; bin < absdev_len; bin++) {
+    absdev_tally += absdev[bin];
+    if (absdev_tally > total_tally/2) {
+      mad = BinnedHistogram::bin_value(bin);
       break;
+    }
   }
 
   // Return the results.
@@ -481,21 +681,34 @@ void initialize_reuse (void)
 }
 
 
+// Process the reuse distance of a set of addresses relative to the
+// program as a whole.  Optionally, also tally each address's reuse distance
+// in a set of locality statistics.
+void bf_reuse_dist_addrs (uint64_t baseaddr, uint64_t numaddrs, LocalityStats* stats)
+{
+  if (bf_suppress_counting)
+    return;
+  if (stats == nullptr)
+    for (uint64_t ofs = 0; ofs < numaddrs; ofs++)
+      global_reuse_dist->process_address(baseaddr + ofs);
+  else
+    for (uint64_t ofs = 0; ofs < numaddrs; ofs++)
+      stats->record_reuse(global_reuse_dist->process_address(baseaddr + ofs));
+}
+
+
 // Process the reuse distance of a set of addresses relative to the
 // program as a whole.
 extern "C"
 void bf_reuse_dist_addrs_prog (uint64_t baseaddr, uint64_t numaddrs)
 {
-  if (bf_suppress_counting)
-    return;
-  for (uint64_t ofs = 0; ofs < numaddrs; ofs++)
-    global_reuse_dist->process_address(baseaddr + ofs);
+  bf_reuse_dist_addrs(baseaddr, numaddrs, nullptr);
 }
 
 
 // Return the reuse distance histogram and count of unique bytes for
 // the program as a whole.
-void bf_get_reuse_distance (vector<uint64_t>** hist, uint64_t* unique_addrs)
+void bf_get_reuse_distance (BinnedHistogram** hist, uint64_t* unique_addrs)
 {
   *hist = global_reuse_dist->get_histogram();
   *unique_addrs = global_reuse_dist->get_unique_addrs();
@@ -17,8 +17,9 @@ namespace bytesflops {
 #define OTHER_STRIDE (ZERO_STRIDE + 1)     // Non-zero and non-power-of-two word stride
 #define NUM_STRIDES (OTHER_STRIDE + 1)     // Array elements to allocate for all of the above
 
-// Define a logical page size to use throughout this file.
-static const size_t logical_page_size = 1024;
+// Choose a logical page size to use throughout this file.
+static PageSizeChooser* page_sizer = nullptr;
+static void create_page_tables(void);
 
 // Track a single call point's data-access pattern.
 class AccessPattern {
@@ -32,44 +33,69 @@ public:
   bool is_store;                        // true=store; false=load
   bool is_const;                        // true=provably constant address at compile time; false=may vary
   BitPageTable* touched_data;           // Flags for every byte of memory accessed
+  HyperLogLog* touched_sketch;          // Estimate of the number of bytes accessed (approximate mode)
 
   // Initialize an AccessPattern with all zero tallies.
   AccessPattern(bf_symbol_info_t sinfo, uint64_t addr, uint64_t nbytes,
                 bool st, bool cons) :
     syminfo(sinfo), prev_addr(addr), num_bytes(nbytes),  backward_strides(0),
-    total_strides(0), is_store(st), is_const(cons), touched_data(nullptr) {
+    total_strides(0), is_store(st), is_const(cons), touched_data(nullptr),
+    touched_sketch(nullptr) {
     memset(stride_tally, 0, NUM_STRIDES*sizeof(uint64_t));
-    if (bf_unique_bytes || bf_mem_footprint) {
-      touched_data = new BitPageTable(logical_page_size);
-      touched_data->access(addr, nbytes);
-    }
+    if (bf_unique_approx)
+      touched_sketch = new HyperLogLog(bf_unique_granularity);
+    else if ((bf_unique_bytes || bf_mem_footprint) && page_sizer->page_size() != 0)
+      touched_data = new BitPageTable(page_sizer->page_size());
+    touch(addr, nbytes);
   }
 
   // Free any memory we allocated.
   ~AccessPattern() {
     if (touched_data != nullptr)
       delete touched_data;
+    delete touched_sketch;
+  }
+
+  // Mark a range of addresses as accessed.  While a logical page size is
+  // still being chosen, merely sample the range.
+  void touch(uint64_t addr, uint64_t nbytes) {
+    if (touched_data != nullptr)
+      touched_data->access(addr, nbytes);
+    else if (touched_sketch != nullptr)
+      touched_sketch->access(addr, nbytes);
+    else if (bf_unique_bytes || bf_mem_footprint) {
+      if (page_sizer->sample(this, addr, nbytes))
+        create_page_tables();
+    }
   }
 
-  // Given an address, increment the appropriate stride tally.
-  void increment_tally(uint64_t new_addr) {
+  // Return the number of unique bytes accessed, exactly or approximately.
+  uint64_t tally_unique() {
+    if (touched_sketch != nullptr)
+      return touched_sketch->tally_unique();
+    return touched_data->tally_unique();
+  }
+
+  // Given an address, increment the appropriate stride tally.  Optionally
+  // tally the same stride multiple times.
+  void increment_tally(uint64_t new_addr, uint64_t repeat=1) {
     // Increase the total number of strides observed.
-    total_strides++;
+    total_strides += repeat;
 
     // Check for a zero stride.
     if (new_addr == prev_addr) {
-      stride_tally[ZERO_STRIDE]++;
+      stride_tally[ZERO_STRIDE] += repeat;
       return;
     }
 
     // Tally the number of backward strides.
     if (prev_addr > new_addr)
-      backward_strides++;
+      backward_strides += repeat;
 
     // Check for a non-multiple of the word size.
     uint64_t abs_stride = uint64_t(abs(int64_t(new_addr) - int64_t(prev_addr)));
     if (abs_stride % num_bytes != 0) {
-      stride_tally[OTHER_STRIDE]++;
+      stride_tally[OTHER_STRIDE] += repeat;
       return;
     }
 
@@ -82,77 +108,202 @@ public:
       while (abs_stride >>= 1)
         log2_stride++;
       if (log2_stride <= MAX_POW2_STRIDE)
-        stride_tally[log2_stride]++;
+        stride_tally[log2_stride] += repeat;
       else
-        stride_tally[OTHER_STRIDE]++;
+        stride_tally[OTHER_STRIDE] += repeat;
       return;
     }
 
     // Categorize as "other".
-    stride_tally[OTHER_STRIDE]++;
+    stride_tally[OTHER_STRIDE] += repeat;
   }
 };
 
-// Define this file's main data structure.
-static CachedOrderedMap<uint64_t, AccessPattern*>* stride_data;  // Map from a location ID to stride information.
+// Define this file's main data structure: one table per instrumented module,
+// indexed by a call-point number the compiler pass assigned.
+typedef pair<AccessPattern**, uint64_t> StrideTable;  // {slots, number of slots}
+static vector<StrideTable>* stride_tables = nullptr;
 
 // Gain access to our binary output stream.
 extern BinaryOStream* bfbin;
 
+// Create each call point's page table once a logical page size has been
+// chosen, and replay into them the accesses that were sampled to choose it.
+static void create_page_tables (void)
+{
+  size_t logical_page_size = page_sizer->page_size();
+  const vector<PageSizeChooser::SampledAccess>& samples = page_sizer->samples();
+  for (auto sample_iter = samples.cbegin(); sample_iter != samples.cend(); sample_iter++) {
+    AccessPattern* info = (AccessPattern*)sample_iter->owner;
+    if (info->touched_data == nullptr)
+      info->touched_data = new BitPageTable(logical_page_size);
+    info->touched_data->access(sample_iter->baseaddr, sample_iter->numaddrs);
+  }
+  page_sizer->discard_samples();
+}
+
+// Stop sampling and create our page tables if we haven't already.
+static void finish_sampling (void)
+{
+  if (bf_unique_approx || !(bf_unique_bytes || bf_mem_footprint))
+    return;
+  if (page_sizer->page_size() != 0)
+    return;
+  page_sizer->choose();
+  create_page_tables();
+}
+
 // Initialize our internal data structure.
 void initialize_strides (void)
 {
-  if (stride_data == nullptr)
-    stride_data = new CachedOrderedMap<uint64_t, AccessPattern*>;
+  if (stride_tables == nullptr)
+    stride_tables = new vector<StrideTable>;
+  if (page_sizer == nullptr)
+    page_sizer = new PageSizeChooser("BF_STRIDES_PAGE_SIZE", "Strides", 1.0/8.0);
+}
+
+// Record a module's statically allocated table of call points.  This is
+// invoked from a module constructor the compiler pass generates.
+extern "C"
+void bf_register_stride_table (AccessPattern** table, uint64_t num_slots)
+{
+  stride_tables->push_back(StrideTable(table, num_slots));
 }
 
 // Track a call point's strided access pattern.
 extern "C"
-void bf_track_stride (bf_symbol_info_t* syminfo, uint64_t baseaddr,
+void bf_track_stride (AccessPattern*** table, uint64_t slot,
+                      bf_symbol_info_t* syminfo, uint64_t baseaddr,
                       uint64_t numaddrs, uint8_t load0store1, uint8_t is_const)
 {
   // Determine if we've previously seen this call point.
-  auto iter = stride_data->find(syminfo->ID);
-  if (iter == stride_data->end()) {
+  AccessPattern* info = (*table)[slot];
+  if (info == nullptr) {
     // First access from this call point: Create a new tally entry.
-    (*stride_data)[syminfo->ID] = new AccessPattern(*syminfo, baseaddr, numaddrs, bool(load0store1), bool(is_const));
+    (*table)[slot] = new AccessPattern(*syminfo, baseaddr, numaddrs, bool(load0store1), bool(is_const));
     return;
   }
 
   // We've seen this call point before.  Determine the new stride and update
   // our information accordingly.
-  AccessPattern* info = iter->second;
   info->increment_tally(baseaddr);
   info->prev_addr = baseaddr;
-  if (info->touched_data != nullptr)
-    info->touched_data->access(baseaddr, numaddrs);
+  info->touch(baseaddr, numaddrs);
+}
+
+// Track a call point's accesses across all iterations of a loop in which the
+// compiler proved that the address advances by a constant stride.  The
+// result is the same as invoking bf_track_stride() on every iteration.
+extern "C"
+void bf_track_stride_loop (AccessPattern*** table, uint64_t slot,
+                           bf_symbol_info_t* syminfo, uint64_t baseaddr,
+                           int64_t stride, uint64_t iterations,
+                           uint64_t numaddrs, uint8_t load0store1,
+                           uint8_t is_const)
+{
+  // Tally the first access normally.
+  if (iterations == 0)
+    return;
+  bf_track_stride(table, slot, syminfo, baseaddr, numaddrs, load0store1, is_const);
+  if (iterations == 1)
+    return;
+
+  // Tally all remaining strides at once.
+  AccessPattern* info = (*table)[slot];
+  uint64_t last_addr = baseaddr + uint64_t(stride)*(iterations - 1);
+  info->increment_tally(baseaddr + uint64_t(stride), iterations - 1);
+  info->prev_addr = last_addr;
+
+  // Mark as touched all of the addresses accessed after the first.  While a
+  // logical page size is still being chosen, sample every access
+  // individually.  Otherwise, mark contiguous accesses as a single range.
+  if (stride == 0)
+    return;
+  uint64_t abs_stride = uint64_t(stride < 0 ? -stride : stride);
+  if (abs_stride <= numaddrs && (info->touched_data != nullptr || info->touched_sketch != nullptr)) {
+    info->touch(min(baseaddr, last_addr), abs_stride*(iterations - 1) + numaddrs);
+    return;
+  }
+  uint64_t addr = baseaddr;
+  for (uint64_t i = 1; i < iterations; i++) {
+    addr += uint64_t(stride);
+    info->touch(addr, numaddrs);
+  }
+}
+
+// Gather the access patterns of every call point that was executed.
+static void all_access_patterns (vector<AccessPattern*>& access_pats)
+{
+  for (auto table_iter = stride_tables->begin(); table_iter != stride_tables->end(); table_iter++)
+    for (uint64_t i = 0; i < table_iter->second; i++)
+      if (table_iter->first[i] != nullptr)
+        access_pats.push_back(table_iter->first[i]);
 }
 
 // Compute the number of unique memory addresses accessed by loads/stores
 // that always reference the same word and by loads/stores that reference
-// different words on different invocations.
+// different words on different invocations.  Exact tallies are computed in
+// parallel, with each thread merging a disjoint subset of pages.
 void bf_partition_unique_addresses (uint64_t* uti, uint64_t *mti)
 {
-  BitPageTable uti_pt(logical_page_size);
-  BitPageTable mti_pt(logical_page_size);
-  for (auto iter = stride_data->begin(); iter != stride_data->end(); iter++) {
+  finish_sampling();
+  vector<BitPageTable*> uti_tables;
+  vector<BitPageTable*> mti_tables;
+  HyperLogLog uti_sketch(bf_unique_granularity);
+  HyperLogLog mti_sketch(bf_unique_granularity);
+  vector<AccessPattern*> access_pats;
+  all_access_patterns(access_pats);
+  for (auto iter = access_pats.begin(); iter != access_pats.end(); iter++) {
     // Determine if this is a uni-targeted instruction (UTI) or a
     // multi-targeted instruction (MTI).
-    AccessPattern* info = iter->second;
+    AccessPattern* info = *iter;
     uint64_t nonzero_strides = 0;
     for (size_t i = 0; i <= MAX_POW2_STRIDE; i++)
       nonzero_strides += info->stride_tally[i];
     nonzero_strides += info->stride_tally[OTHER_STRIDE];
 
-    // Merge the current pattern's page table into either the UTI or MTI page
-    // table.
-    if (nonzero_strides == 0)
-      uti_pt.merge(info->touched_data);
-    else
-      mti_pt.merge(info->touched_data);
+    // Merge the current pattern's sketch into either the UTI or MTI sketch,
+    // or add its page table to the UTI or MTI list for merging below.
+    if (bf_unique_approx) {
+      if (nonzero_strides == 0)
+        uti_sketch.merge(info->touched_sketch);
+      else
+        mti_sketch.merge(info->touched_sketch);
+    }
+    else {
+      if (nonzero_strides == 0)
+        uti_tables.push_back(info->touched_data);
+      else
+        mti_tables.push_back(info->touched_data);
+    }
+  }
+  if (bf_unique_approx) {
+    *uti = uti_sketch.tally_unique();
+    *mti = mti_sketch.tally_unique();
+    return;
+  }
+
+  // Merge each shard of pages into a UTI and an MTI page table.  Because the
+  // shards are disjoint, the total is simply the sum of the shards' tallies.
+  size_t num_threads = bf_report_threads();
+  vector<uint64_t> uti_tallies(num_threads, 0);
+  vector<uint64_t> mti_tallies(num_threads, 0);
+  bf_run_in_parallel([&](size_t shard, size_t num_shards) {
+      BitPageTable uti_pt(page_sizer->page_size());
+      BitPageTable mti_pt(page_sizer->page_size());
+      for (auto table : uti_tables)
+        uti_pt.merge(table, shard, num_shards);
+      for (auto table : mti_tables)
+        mti_pt.merge(table, shard, num_shards);
+      uti_tallies[shard] = uti_pt.tally_unique();
+      mti_tallies[shard] = mti_pt.tally_unique();
+    });
+  *uti = 0;
+  *mti = 0;
+  for (size_t t = 0; t < num_threads; t++) {
+    *uti += uti_tallies[t];
+    *mti += mti_tallies[t];
   }
-  *uti = uti_pt.tally_unique();
-  *mti = mti_pt.tally_unique();
 }
 
 // This function is used by sort() to sort stride information in decreasing
@@ -175,6 +326,7 @@ static bool compare_total_strides (const AccessPattern* one,
 // Output strides by call point.
 void bf_report_strides_by_call_point (void)
 {
+  finish_sampling();
   // Output a binary table header.
   *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Strided accesses";
   *bfbin << uint8_t(BINOUT_COL_STRING) << "Instruction"
@@ -199,8 +351,7 @@ void bf_report_strides_by_call_point (void)
 
   // Sort the stride information in decreasing order of invocation count.
   vector<AccessPattern*> access_pats;
-  for (auto iter = stride_data->begin(); iter != stride_data->end(); iter++)
-    access_pats.push_back(iter->second);
+  all_access_patterns(access_pats);
   sort(access_pats.begin(), access_pats.end(), compare_total_strides);
 
   // Output all the information we have.
@@ -229,7 +380,7 @@ void bf_report_strides_by_call_point (void)
     *bfbin << info->stride_tally[OTHER_STRIDE]
            << info->backward_strides;
     if (bf_unique_bytes || bf_mem_footprint)
-      *bfbin << info->touched_data->tally_unique();
+      *bfbin << info->tally_unique();
   }
   *bfbin << uint8_t(BINOUT_ROW_NONE);
 }
@@ -14,56 +14,61 @@ namespace bytesflops {
 
 // Keep track of the unique bytes touched by each function and by the
 // program as a whole.
-typedef CachedUnorderedMap<const char*, WordPageTable*> func_to_page_t;
 static WordPageTable* global_unique_bytes = nullptr;
-static func_to_page_t* function_unique_bytes = nullptr;
+static FunctionPageTable* function_unique_bytes = nullptr;
 
-// Define a logical page size to use throughout this file.
-static const size_t logical_page_size = 8192;
+// Choose a logical page size to use throughout this file.
+static PageSizeChooser* page_sizer = nullptr;
+
+// Create our page tables once a logical page size has been chosen, and replay
+// into them the accesses that were sampled to choose it.
+static void create_page_tables (void)
+{
+  size_t logical_page_size = page_sizer->page_size();
+  global_unique_bytes = new WordPageTable(logical_page_size);
+  function_unique_bytes = new FunctionPageTable(logical_page_size);
+  const vector<PageSizeChooser::SampledAccess>& samples = page_sizer->samples();
+  for (auto sample_iter = samples.cbegin(); sample_iter != samples.cend(); sample_iter++)
+    if (sample_iter->owner == nullptr)
+      global_unique_bytes->access(sample_iter->baseaddr, sample_iter->numaddrs);
+    else
+      function_unique_bytes->access((const char*)sample_iter->owner,
+                                    sample_iter->baseaddr, sample_iter->numaddrs);
+  page_sizer->discard_samples();
+}
+
+// Stop sampling and create our page tables if we haven't already.
+static void finish_sampling (void)
+{
+  if (global_unique_bytes != nullptr)
+    return;
+  page_sizer->choose();
+  create_page_tables();
+}
 
 // Initialize some of our variables at first use.
 void initialize_tallybytes (void)
 {
-  global_unique_bytes = new WordPageTable(logical_page_size);
-  function_unique_bytes = new func_to_page_t();
+  page_sizer = new PageSizeChooser("BF_FOOTPRINT_PAGE_SIZE", "Memory-footprint", 1.0);
+  if (page_sizer->page_size() != 0)
+    create_page_tables();
 }
 
 // Return the number of unique addresses referenced by a given function.
 uint64_t bf_tally_unique_addresses_tb (const char* funcname)
 {
-  func_to_page_t::iterator map_iter = function_unique_bytes->find(funcname);
-  if (map_iter == function_unique_bytes->end())
-    return 0;
-  else
-    return map_iter->second->tally_unique();
+  finish_sampling();
+  return function_unique_bytes->tally_unique(funcname);
 }
 
 // Return the number of unique addresses referenced by the entire program.
 uint64_t bf_tally_unique_addresses_tb (void)
 {
+  finish_sampling();
   return global_unique_bytes->tally_unique();
 }
 
-// Associate a set of memory locations with a given function.  Return the
-// page-to-bit-vector mapping for the given function.
-static WordPageTable* assoc_addresses_with_func (const char* funcname,
-                                                 uint64_t baseaddr,
-                                                 uint64_t numaddrs)
-{
-  WordPageTable* unique_bytes;
-  func_to_page_t::iterator map_iter = function_unique_bytes->find(funcname);
-  if (map_iter == function_unique_bytes->end())
-    // This is the first time we've seen this function.
-    (*function_unique_bytes)[funcname] = unique_bytes = new WordPageTable(logical_page_size);
-  else
-    // We've seen this function before.
-    unique_bytes = map_iter->second;
-  unique_bytes->access(baseaddr, numaddrs);
-  return unique_bytes;
-}
-
-// Associate a set of memory locations with a given function.  This function
-// basically wraps assoc_addresses_with_func() with a quick cache lookup.
+// Associate a set of memory locations with a given function.
 extern "C"
 void bf_assoc_addresses_with_func_tb (const char* funcname, uint64_t baseaddr, uint64_t numaddrs)
 {
@@ -77,8 +82,13 @@ void bf_assoc_addresses_with_func_tb (const char* funcname, uint64_t baseaddr, u
   else
     funcname = bf_string_to_symbol(funcname);
 
-  // Associate the range of addresses with the function's page table.
-  assoc_addresses_with_func(funcname, baseaddr, numaddrs);
+  // Associate the range of addresses with the function.
+  if (__builtin_expect(function_unique_bytes == nullptr, 0)) {
+    if (page_sizer->sample(funcname, baseaddr, numaddrs))
+      create_page_tables();
+  }
+  else
+    function_unique_bytes->access(funcname, baseaddr, numaddrs);
 }
 
 // Associate a set of memory locations with the program as a whole.
@@ -87,7 +97,12 @@ void bf_assoc_addresses_with_prog_tb (uint64_t baseaddr, uint64_t numaddrs)
 {
   if (bf_suppress_counting)
     return;
-  global_unique_bytes->access(baseaddr, numaddrs);
+  if (__builtin_expect(global_unique_bytes == nullptr, 0)) {
+    if (page_sizer->sample(nullptr, baseaddr, numaddrs))
+      create_page_tables();
+  }
+  else
+    global_unique_bytes->access(baseaddr, numaddrs);
 }
 
 // Return true if one {count, multiplier} pair has a greater
@@ -97,24 +112,37 @@ static bool greater_count_than (bf_addr_tally_t a, bf_addr_tally_t b)
   return a.first > b.first;
 }
 
-// Convert a collection of tallies to a histogram.
+// Convert a collection of tallies to a histogram.  Each thread processes a
+// contiguous range of pages into a histogram of its own, and the threads'
+// histograms are then combined.
 static void get_address_tally_hist (WordPageTable& mapping, vector<bf_addr_tally_t>& histogram, uint64_t* total)
 {
   // Process each page of counts in turn.
   typedef CachedUnorderedMap<bytecount_t, uint64_t> count_to_mult_t;
-  count_to_mult_t count2mult;               // Number of times each count was seen
-  for (auto counts_iter = mapping.begin(); counts_iter != mapping.end(); ) {
-    // Increment the iterator now so we can safely delete it at the bottom of
-    // this block.
-    WordPageTableEntry* pte = counts_iter->second;
-    counts_iter++;
-
-    // Increment the multiplier for each count.
-    const bytecount_t* byte_counter = pte->raw_counts();
-    for (size_t i = 0; i < logical_page_size; i++)
-      if (byte_counter[i] > 0)
-        count2mult[byte_counter[i]]++;
-  }
+  vector<WordPageTableEntry*> all_ptes;
+  for (auto counts_iter = mapping.begin(); counts_iter != mapping.end(); counts_iter++)
+    all_ptes.push_back(counts_iter->second);
+  size_t num_ptes = all_ptes.size();
+  vector<count_to_mult_t> thread_count2mult(bf_report_threads());
+  bf_run_in_parallel([&](size_t thread_id, size_t num_threads) {
+      count_to_mult_t& count2mult = thread_count2mult[thread_id];   // Number of times each count was seen
+      size_t first_pte = num_ptes*thread_id/num_threads;
+      size_t last_pte = num_ptes*(thread_id + 1)/num_threads;
+      for (size_t p = first_pte; p < last_pte; p++) {
+        // Increment the multiplier for each count.  Neighboring bytes tend to
+        // be accessed equally often, so process a run of equal counts at a
+        // time.
+        all_ptes[p]->visit_runs([&count2mult](bytecount_t count, size_t run_length) {
+            count2mult[count] += run_length;
+          });
+      }
+    });
+
+  // Combine the threads' histograms.
+  count_to_mult_t& count2mult = thread_count2mult[0];
+  for (size_t t = 1; t < thread_count2mult.size(); t++)
+    for (auto c2m_iter = thread_count2mult[t].begin(); c2m_iter != thread_count2mult[t].end(); c2m_iter++)
+      count2mult[c2m_iter->first] += c2m_iter->second;
 
   // Convert count2mult from a map to a vector.
   for (count_to_mult_t::iterator c2m_iter = count2mult.begin(); c2m_iter != count2mult.end(); c2m_iter++) {
@@ -132,6 +160,7 @@ static void get_address_tally_hist (WordPageTable& mapping, vector<bf_addr_tally
 // we build the latter.
 void bf_get_address_tally_hist (vector<bf_addr_tally_t>& histogram, uint64_t* total)
 {
+  finish_sampling();
   get_address_tally_hist(*global_unique_bytes, histogram, total);
 }
 
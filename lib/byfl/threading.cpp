@@ -5,6 +5,7 @@
  * By Scott Pakin <pakin@lanl.gov>
  */
 
+#include <sched.h>
 #include "byfl.h"
 
 using namespace std;
@@ -17,6 +18,76 @@ namespace bytesflops {
 void initialize_threading (void) {
 }
 
+// Return the number of threads to use for end-of-run processing.  This is
+// taken from the BF_REPORT_THREADS environment variable and defaults to the
+// number of processors in the process's affinity mask.  (Under MPI, ranks
+// sharing a node are typically bound to disjoint processors, so they don't
+// each spawn one thread per processor on the node.)
+size_t bf_report_threads (void)
+{
+  static size_t num_threads = 0;
+  if (num_threads == 0) {
+    const char* num_threads_str = getenv("BF_REPORT_THREADS");
+    if (num_threads_str != nullptr)
+      num_threads = size_t(strtoull(num_threads_str, nullptr, 10));
+    else {
+      cpu_set_t cpus;
+      if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+        num_threads = size_t(CPU_COUNT(&cpus));
+      else
+        num_threads = 1;
+    }
+    if (num_threads == 0)
+      num_threads = 1;
+  }
+  return num_threads;
+}
+
+// Define the arguments passed to each thread spawned by bf_run_in_parallel().
+struct ParallelWork {
+  const function<void(size_t, size_t)>* work;   // Function to invoke
+  size_t thread_id;                             // Index of this thread
+  size_t num_threads;                           // Total number of threads
+};
+
+// Invoke a thread's share of a parallel computation.
+static void* run_parallel_work (void* arg)
+{
+  ParallelWork* pwork = (ParallelWork*)arg;
+  (*pwork->work)(pwork->thread_id, pwork->num_threads);
+  return nullptr;
+}
+
+// Invoke work(thread_id, num_threads) on each of bf_report_threads() threads,
+// including the calling thread (thread 0), and wait for all of them to
+// finish.  Callers are responsible for combining the threads' results in a
+// deterministic order.
+void bf_run_in_parallel (const function<void(size_t, size_t)>& work)
+{
+  size_t num_threads = bf_report_threads();
+  if (num_threads == 1) {
+    work(0, 1);
+    return;
+  }
+  vector<pthread_t> threads(num_threads);
+  vector<ParallelWork> pwork(num_threads);
+  for (size_t t = 1; t < num_threads; t++) {
+    pwork[t].work = &work;
+    pwork[t].thread_id = t;
+    pwork[t].num_threads = num_threads;
+    if (pthread_create(&threads[t], nullptr, run_parallel_work, &pwork[t]) != 0) {
+      cerr << "Failed to create a thread\n";
+      bf_abend();
+    }
+  }
+  work(0, num_threads);
+  for (size_t t = 1; t < num_threads; t++)
+    if (pthread_join(threads[t], nullptr) != 0) {
+      cerr << "Failed to join a thread\n";
+      bf_abend();
+    }
+}
+
 // Take the mega-lock.
 extern "C"
 void bf_acquire_mega_lock (void)
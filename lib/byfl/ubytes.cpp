@@ -7,61 +7,149 @@
  */
 
 #include "byfl.h"
+#include <sys/mman.h>
 
 using namespace std;
 
+// With -bf-shadow-mem, the program-wide set of unique bytes is a bitmap in
+// shadow memory, which instrumented code may update inline.  The following
+// variables are shared with the instrumented code.
+extern "C" {
+  uint64_t bf_shadow_base = 0;     // Address of the shadow bitmap
+  uint64_t bf_shadow_unique = 0;   // Number of bits set in the shadow bitmap
+}
+
 namespace bytesflops {
 
 // Keep track of the unique bytes touched by each function and by the program
 // as a whole.
-typedef CachedUnorderedMap<const char*, BitPageTable*> func_to_page_t;
 static BitPageTable* global_unique_bytes = nullptr;
-static func_to_page_t* function_unique_bytes = nullptr;
+static FunctionPageTable* function_unique_bytes = nullptr;
+
+// With -bf-unique-bytes=approx, keep track of the unique bytes touched by
+// each function and by the program as a whole with HyperLogLog sketches
+// instead.
+static HyperLogLog* global_unique_sketch = nullptr;
+static CachedUnorderedMap<const char*, HyperLogLog*>* function_unique_sketches = nullptr;
+
+// Choose a logical page size to use throughout this file.
+static PageSizeChooser* page_sizer = nullptr;
+
+// Create our page tables once a logical page size has been chosen, and replay
+// into them the accesses that were sampled to choose it.
+static void create_page_tables (void)
+{
+  size_t logical_page_size = page_sizer->page_size();
+  global_unique_bytes = new BitPageTable(logical_page_size);
+  function_unique_bytes = new FunctionPageTable(logical_page_size);
+  const vector<PageSizeChooser::SampledAccess>& samples = page_sizer->samples();
+  for (auto sample_iter = samples.cbegin(); sample_iter != samples.cend(); sample_iter++)
+    if (sample_iter->owner == nullptr)
+      global_unique_bytes->access(sample_iter->baseaddr, sample_iter->numaddrs);
+    else
+      function_unique_bytes->access((const char*)sample_iter->owner,
+                                    sample_iter->baseaddr, sample_iter->numaddrs);
+  page_sizer->discard_samples();
+}
 
-// Define a logical page size to use throughout this file.
-static const size_t logical_page_size = 8192;
+// Stop sampling and create our page tables if we haven't already.
+static void finish_sampling (void)
+{
+  if (global_unique_bytes != nullptr)
+    return;
+  page_sizer->choose();
+  create_page_tables();
+}
 
 // Initialize some of our variables at first use.
 void initialize_ubytes (void)
 {
-  global_unique_bytes = new BitPageTable(logical_page_size);
-  function_unique_bytes = new func_to_page_t();
+  if (bf_unique_approx) {
+    global_unique_sketch = new HyperLogLog(bf_unique_granularity);
+    function_unique_sketches = new CachedUnorderedMap<const char*, HyperLogLog*>();
+    return;
+  }
+  page_sizer = new PageSizeChooser("BF_UNIQUE_PAGE_SIZE", "Unique-bytes", 1.0/8.0);
+  if (page_sizer->page_size() != 0)
+    create_page_tables();
+
+  // Reserve address space for the shadow bitmap.  The kernel allocates
+  // physical pages only as they're first touched.  We reserve one word
+  // beyond the end of the bitmap for the benefit of instrumented code, which
+  // may read and write two bytes at a time.
+  if (bf_unique_bytes && bf_shadow_mem && !bf_mem_footprint) {
+    void* shadow = mmap(nullptr, BF_SHADOW_BYTES + sizeof(uint64_t),
+                        PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                        -1, 0);
+    if (shadow == MAP_FAILED) {
+      cerr << "Failed to reserve " << BF_SHADOW_BYTES
+           << " bytes of address space for the -bf-shadow-mem bitmap\n";
+      bf_abend();
+    }
+    bf_shadow_base = uint64_t(shadow);
+  }
+}
+
+// Set the bits in a shadow word that are set in a mask, and return the number
+// of bits that changed from 0 to 1.
+static inline uint64_t shadow_set_bits (uint64_t* word, uint64_t mask)
+{
+  uint64_t old_word = *word;
+  uint64_t new_word = old_word | mask;
+  *word = new_word;
+  return __builtin_popcountll(old_word ^ new_word);
+}
+
+// Mark a range of addresses as touched in the shadow bitmap.  Addresses beyond
+// the bitmap's reach wrap around, just as they do in instrumented code.
+static void shadow_access (uint64_t baseaddr, uint64_t numaddrs)
+{
+  if (numaddrs == 0)
+    return;
+  const uint64_t word_mask = BF_SHADOW_BYTES/sizeof(uint64_t) - 1;
+  uint64_t* bitmap = (uint64_t*)bf_shadow_base;
+  uint64_t lastaddr = baseaddr + numaddrs - 1;
+  uint64_t first_word = baseaddr/64;
+  uint64_t last_word = lastaddr/64;
+  uint64_t first_mask = ~0ULL << (baseaddr%64);       // Bits to set in the first word
+  uint64_t last_mask = ~0ULL >> (63 - lastaddr%64);   // Bits to set in the last word
+  uint64_t new_bits;                                  // Number of bits set that were previously clear
+  if (first_word == last_word)
+    new_bits = shadow_set_bits(&bitmap[first_word & word_mask], first_mask & last_mask);
+  else {
+    new_bits = shadow_set_bits(&bitmap[first_word & word_mask], first_mask);
+    for (uint64_t w = first_word + 1; w < last_word; w++)
+      new_bits += shadow_set_bits(&bitmap[w & word_mask], ~0ULL);
+    new_bits += shadow_set_bits(&bitmap[last_word & word_mask], last_mask);
+  }
+  bf_shadow_unique += new_bits;
 }
 
 // Return the number of unique addresses referenced by a given function.
 uint64_t bf_tally_unique_addresses (const char* funcname)
 {
-  func_to_page_t::iterator map_iter = function_unique_bytes->find(funcname);
-  if (map_iter == function_unique_bytes->end())
-    return 0;
-  else
-    return map_iter->second->tally_unique();
+  if (bf_unique_approx) {
+    auto sketch_iter = function_unique_sketches->find(funcname);
+    if (sketch_iter == function_unique_sketches->end())
+      return 0;
+    return sketch_iter->second->tally_unique();
+  }
+  finish_sampling();
+  return function_unique_bytes->tally_unique(funcname);
 }
 
 // Return the number of unique addresses referenced by the entire program.
 uint64_t bf_tally_unique_addresses (void)
 {
+  if (bf_unique_approx)
+    return global_unique_sketch->tally_unique();
+  if (bf_shadow_base != 0)
+    return bf_shadow_unique;
+  finish_sampling();
   return global_unique_bytes->tally_unique();
 }
 
-// Associate a set of memory locations with a given function.  Return
-// the page-to-bit-vector mapping for the given function.
-static BitPageTable* assoc_addresses_with_func (const char* funcname,
-                                                uint64_t baseaddr,
-                                                uint64_t numaddrs)
-{
-  BitPageTable* unique_bytes;
-  func_to_page_t::iterator map_iter = function_unique_bytes->find(funcname);
-  if (map_iter == function_unique_bytes->end())
-    // This is the first time we've seen this function.
-    (*function_unique_bytes)[funcname] = unique_bytes = new BitPageTable(logical_page_size);
-  else
-    // We've seen this function before.
-    unique_bytes = map_iter->second;
-  unique_bytes->access(baseaddr, numaddrs);
-  return unique_bytes;
-}
-
 // Associate a set of memory locations with a given function.
 extern "C"
 void bf_assoc_addresses_with_func (const char* funcname, uint64_t baseaddr, uint64_t numaddrs)
@@ -76,8 +164,19 @@ void bf_assoc_addresses_with_func (const char* funcname, uint64_t baseaddr, uint
   else
     funcname = bf_string_to_symbol(funcname);
 
-  // Associate the range of addresses with the function's page table.
-  assoc_addresses_with_func(funcname, baseaddr, numaddrs);
+  // Associate the range of addresses with the function.
+  if (bf_unique_approx) {
+    HyperLogLog*& sketch = (*function_unique_sketches)[funcname];
+    if (sketch == nullptr)
+      sketch = new HyperLogLog(bf_unique_granularity);
+    sketch->access(baseaddr, numaddrs);
+  }
+  else if (__builtin_expect(function_unique_bytes == nullptr, 0)) {
+    if (page_sizer->sample(funcname, baseaddr, numaddrs))
+      create_page_tables();
+  }
+  else
+    function_unique_bytes->access(funcname, baseaddr, numaddrs);
 }
 
 // Associate a set of memory locations with the program as a whole.
@@ -86,7 +185,16 @@ void bf_assoc_addresses_with_prog (uint64_t baseaddr, uint64_t numaddrs)
 {
   if (bf_suppress_counting)
     return;
-  global_unique_bytes->access(baseaddr, numaddrs);
+  if (bf_unique_approx)
+    global_unique_sketch->access(baseaddr, numaddrs);
+  else if (bf_shadow_base != 0)
+    shadow_access(baseaddr, numaddrs);
+  else if (__builtin_expect(global_unique_bytes == nullptr, 0)) {
+    if (page_sizer->sample(nullptr, baseaddr, numaddrs))
+      create_page_tables();
+  }
+  else
+    global_unique_bytes->access(baseaddr, numaddrs);
 }
 
 } // namespace bytesflops
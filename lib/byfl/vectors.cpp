@@ -63,7 +63,9 @@ struct hashvec
 
 
 // Define a mapping from a function name to a vector operation to a tally.
-typedef CachedUnorderedMap<VectorOperation*, uint64_t, hashvec, eqvec> vector_to_tally_t;
+// The inner map is searched with a reusable VectorOperation that is modified
+// between searches, so it can't cache previously found keys.
+typedef unordered_map<VectorOperation*, uint64_t, hashvec, eqvec> vector_to_tally_t;
 typedef CachedUnorderedMap<const char*, vector_to_tally_t*> name_to_vector_t;
 
 // Keep track of the number of vector operations performed by each
@@ -71,6 +73,17 @@ typedef CachedUnorderedMap<const char*, vector_to_tally_t*> name_to_vector_t;
 static name_to_vector_t* function_vector_usage = NULL;
 static name_to_vector_t* user_defined_vector_usage = NULL;
 
+// Describe a module's vector-operation counters.
+struct VectorCounts {
+  const uint64_t* counts;         // Number of times each vector type was used
+  const bf_vector_info_t* infos;  // Static description of each vector type
+  uint64_t num_types;             // Number of entries in each of the above
+  vector<uint64_t> uncounted;     // Operations that were suppressed or already merged
+};
+
+// Keep track of every module's vector-operation counters.
+static vector<VectorCounts>* vector_counts = NULL;
+
 
 namespace bytesflops {
 
@@ -83,10 +96,11 @@ void initialize_vectors (void)
   user_defined_vector_usage = new name_to_vector_t();
 }
 
-// Associate a vector operation with a given name.
+// Associate one or more executions of a vector operation with a given name.
 static void tally_vector_operation (name_to_vector_t* vector_usage,
                                     const char *tag, uint64_t num_elements,
-                                    uint64_t element_bits, bool is_flop)
+                                    uint64_t element_bits, bool is_flop,
+                                    uint64_t tally=1)
 {
   // Find or create the associated vector-to-tally mapping.
   name_to_vector_t::iterator vectally_iter = vector_usage->find(tag);
@@ -94,7 +108,7 @@ static void tally_vector_operation (name_to_vector_t* vector_usage,
     // This is the first time we've seen this tag.  Give it a fresh
     // map and return.
     vector_to_tally_t* newvectally = new vector_to_tally_t();
-    (*newvectally)[new VectorOperation(num_elements, element_bits, is_flop)] = 1;
+    (*newvectally)[new VectorOperation(num_elements, element_bits, is_flop)] = tally;
     (*vector_usage)[tag] = newvectally;
     return;
   }
@@ -107,11 +121,11 @@ static void tally_vector_operation (name_to_vector_t* vector_usage,
   if (tally_iter == vectally->end()) {
     // This is the first time we've seen this vector type in the
     // current tag.  Create an initial tally and return.
-    (*vectally)[search_vector] = 1;
+    (*vectally)[search_vector] = tally;
     search_vector = new VectorOperation();
     return;
   }
-  tally_iter->second++;
+  tally_iter->second += tally;
 }
 
 extern "C"
@@ -138,8 +152,72 @@ void bf_tally_vector_operation (const char *funcname, uint64_t num_elements,
     tally_vector_operation(user_defined_vector_usage, partition, num_elements, element_bits, is_flop);
 }
 
+// Register a module's vector-operation counters and the static description of
+// each vector type they count.  This function is invoked from a module
+// constructor.
+extern "C"
+void bf_register_vector_counts (const uint64_t* counts, const bf_vector_info_t* infos,
+                                uint64_t num_types)
+{
+  if (vector_counts == NULL)
+    vector_counts = new vector<VectorCounts>;
+  VectorCounts module_counts;
+  module_counts.counts = counts;
+  module_counts.infos = infos;
+  module_counts.num_types = num_types;
+  module_counts.uncounted.resize(num_types, 0);
+  if (bf_suppress_counting)
+    // Counting is currently suppressed (see bf_suppress_vector_counts()).
+    for (uint64_t i = 0; i < num_types; i++)
+      module_counts.uncounted[i] -= counts[i];
+  vector_counts->push_back(module_counts);
+}
+
+// Exclude from the report all vector operations that occur while counting is
+// suppressed.  As with basic-block counters, we subtract the counters' values
+// when suppression begins and add them back when it ends.
+void bf_suppress_vector_counts (bool suppress)
+{
+  if (vector_counts == NULL)
+    return;
+  for (auto vc_iter = vector_counts->begin(); vc_iter != vector_counts->end(); vc_iter++) {
+    VectorCounts& module_counts = *vc_iter;
+    for (uint64_t i = 0; i < module_counts.num_types; i++)
+      if (suppress)
+        module_counts.uncounted[i] -= module_counts.counts[i];
+      else
+        module_counts.uncounted[i] += module_counts.counts[i];
+  }
+}
+
+// Fold into function_vector_usage all vector operations counted by
+// per-module counters since the last time this function was called.
+static void merge_vector_counts (void)
+{
+  if (vector_counts == NULL)
+    return;
+  if (bf_suppress_counting)
+    bf_suppress_vector_counts(false);
+  for (auto vc_iter = vector_counts->begin(); vc_iter != vector_counts->end(); vc_iter++) {
+    VectorCounts& module_counts = *vc_iter;
+    for (uint64_t i = 0; i < module_counts.num_types; i++) {
+      uint64_t tally = module_counts.counts[i] - module_counts.uncounted[i];
+      if (tally == 0)
+        continue;
+      module_counts.uncounted[i] += tally;
+      const bf_vector_info_t& info = module_counts.infos[i];
+      const char* funcname = bf_per_func ? bf_string_to_symbol(info.function) : "";
+      tally_vector_operation(function_vector_usage, funcname, info.num_elements,
+                             info.element_bits, info.is_flop, tally);
+    }
+  }
+  if (bf_suppress_counting)
+    bf_suppress_vector_counts(true);
+}
+
 // Acquire statistics on all vector operations encountered.
 void bf_get_vector_statistics(uint64_t* num_ops, uint64_t* total_elts, uint64_t* total_bits) {
+  merge_vector_counts();
   *num_ops = *total_elts = *total_bits = 0;
   for (name_to_vector_t::iterator vectally_iter = function_vector_usage->begin();
        vectally_iter != function_vector_usage->end();
@@ -179,6 +257,9 @@ void bf_get_vector_statistics(const char* tag, uint64_t* num_ops, uint64_t* tota
 // Output a histogram of all vector operations encountered.
 void bf_report_vector_operations (void)
 {
+  // Include the vector operations tallied by per-module counters.
+  merge_vector_counts();
+
   // Output a binary table header.
   *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Vector operations";
   *bfbin << uint8_t(BINOUT_COL_UINT64) << "Elements per vector"
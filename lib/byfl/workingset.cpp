@@ -0,0 +1,141 @@
+/*
+ * Helper library for computing bytes:flops ratios
+ * (tracking the working set over time)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include "byfl.h"
+#include <time.h>
+
+using namespace std;
+
+namespace bytesflops {
+
+// Define the page size to use throughout this file.  Unlike the other
+// analyses' page sizes, this one is not chosen by a PageSizeChooser.  The
+// "Unique pages" column deliberately counts conventional 4 KiB OS pages, so a
+// different size would change the results, not merely the memory usage.
+static const size_t logical_page_size = 4096;
+
+// When epochs are measured in time, check the clock only once every this many
+// memory operations (a power of two).
+static const uint64_t time_check_interval = 1024;
+
+// Summarize the working set of a single epoch.
+struct EpochSummary {
+  uint64_t mem_ops;      // Number of memory operations performed
+  uint64_t end_ms;       // Milliseconds from program start to the end of the epoch
+  uint64_t lines;        // Number of unique cache lines accessed
+  uint64_t pages;        // Number of unique pages accessed
+};
+
+// Keep track of the lines and pages accessed during the current epoch and of
+// the working set of every completed epoch.
+static PageTable<EpochPageTableEntry>* epoch_pages = nullptr;
+static vector<EpochSummary>* all_epochs = nullptr;
+static uint64_t current_epoch = 1;      // Current epoch number (0 tags pages never accessed)
+static uint64_t epoch_mem_ops = 0;      // Memory operations performed so far in the current epoch
+static uint64_t epoch_lines = 0;        // Unique lines accessed so far in the current epoch
+static uint64_t epoch_page_count = 0;   // Unique pages accessed so far in the current epoch
+static uint64_t epoch_start_ms = 0;     // Time at which the current epoch began
+static uint64_t program_start_ms = 0;   // Time at which the first epoch began
+static unsigned int lg_line_size;       // Log base 2 of the cache-line size
+
+extern BinaryOStream* bfbin;
+
+// Return the current time in milliseconds.
+uint64_t bf_current_ms (void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return uint64_t(now.tv_sec)*1000 + uint64_t(now.tv_nsec)/1000000;
+}
+
+// Initialize some of our variables at first use.
+void initialize_working_set (void)
+{
+  if (bf_epoch_ops == 0 && bf_epoch_ms == 0)
+    return;
+  epoch_pages = new PageTable<EpochPageTableEntry>(logical_page_size);
+  all_epochs = new vector<EpochSummary>;
+  lg_line_size = 63 - __builtin_clzll(bf_line_size);
+  if ((uint64_t(1) << lg_line_size) > logical_page_size)
+    lg_line_size = __builtin_ctzll(logical_page_size);
+  program_start_ms = epoch_start_ms = bf_current_ms();
+}
+
+// Record the current epoch's working set and begin a new epoch.
+static void end_epoch (uint64_t now_ms)
+{
+  EpochSummary summary;
+  summary.mem_ops = epoch_mem_ops;
+  summary.end_ms = now_ms - program_start_ms;
+  summary.lines = epoch_lines;
+  summary.pages = epoch_page_count;
+  all_epochs->push_back(summary);
+  current_epoch++;
+  epoch_mem_ops = 0;
+  epoch_lines = 0;
+  epoch_page_count = 0;
+  epoch_start_ms = now_ms;
+}
+
+// Add a range of addresses to the current epoch's working set.
+extern "C"
+void bf_touch_working_set (uint64_t baseaddr, uint64_t numaddrs)
+{
+  if (bf_suppress_counting)
+    return;
+  epoch_pages->access(baseaddr, numaddrs, current_epoch, lg_line_size,
+                      &epoch_page_count, &epoch_lines);
+  epoch_mem_ops++;
+
+  // End the epoch after a given number of memory operations or, failing
+  // that, a given amount of time.
+  if (bf_epoch_ops > 0) {
+    if (epoch_mem_ops >= bf_epoch_ops)
+      end_epoch(bf_current_ms());
+  }
+  else if ((epoch_mem_ops & (time_check_interval - 1)) == 0) {
+    uint64_t now_ms = bf_current_ms();
+    if (now_ms - epoch_start_ms >= bf_epoch_ms)
+      end_epoch(now_ms);
+  }
+}
+
+// Output the working set of each epoch.
+void bf_report_working_set (void)
+{
+  // Finish the final, partial epoch.
+  if (epoch_mem_ops > 0)
+    end_epoch(bf_current_ms());
+
+  // Output a binary table header.
+  uint64_t line_size = uint64_t(1) << lg_line_size;
+  *bfbin << uint8_t(BINOUT_TABLE_BASIC) << "Working set by epoch";
+  *bfbin << uint8_t(BINOUT_COL_UINT64) << "Epoch"
+         << uint8_t(BINOUT_COL_UINT64) << "Memory operations"
+         << uint8_t(BINOUT_COL_UINT64) << "Ending time (ms)"
+         << uint8_t(BINOUT_COL_UINT64) << "Unique lines"
+         << uint8_t(BINOUT_COL_UINT64) << "Unique pages"
+         << uint8_t(BINOUT_COL_UINT64) << "Line size"
+         << uint8_t(BINOUT_COL_UINT64) << "Page size"
+         << uint8_t(BINOUT_COL_NONE);
+
+  // Output one row per epoch.
+  for (size_t i = 0; i < all_epochs->size(); i++) {
+    const EpochSummary& summary = (*all_epochs)[i];
+    *bfbin << uint8_t(BINOUT_ROW_DATA)
+           << uint64_t(i + 1)
+           << summary.mem_ops
+           << summary.end_ms
+           << summary.lines
+           << summary.pages
+           << line_size
+           << uint64_t(logical_page_size);
+  }
+  *bfbin << uint8_t(BINOUT_ROW_NONE);
+}
+
+} // namespace bytesflops
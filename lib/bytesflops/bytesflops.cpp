@@ -28,15 +28,33 @@ namespace bytesflops_pass {
                  cl::desc("Additionally output the name of each function's parent"));
 
   // Define a command-line option for keeping track of unique bytes
-  cl::opt<bool>
-  TrackUniqueBytes("bf-unique-bytes", cl::init(false), cl::NotHidden,
-                   cl::desc("Tally unique bytes accessed"));
+  cl::opt<UniqueBytesType>
+  TrackUniqueBytes("bf-unique-bytes", cl::init(UB_NONE), cl::NotHidden,
+                   cl::ValueOptional,
+                   cl::desc("Tally unique bytes accessed"),
+                   cl::values(clEnumValN(UB_EXACT,  "",       "Count unique bytes exactly"),
+                              clEnumValN(UB_APPROX, "approx", "Estimate unique bytes with HyperLogLog sketches")));
+
+  // Define a command-line option for the granularity at which
+  // -bf-unique-bytes=approx counts unique addresses.
+  cl::opt<UniqueGranularityType>
+  UniqueGranularity("bf-unique-granularity", cl::init(UG_BYTE), cl::NotHidden,
+                    cl::desc("Granularity at which to estimate unique addresses"),
+                    cl::values(clEnumValN(UG_BYTE, "byte", "Count unique bytes"),
+                               clEnumValN(UG_WORD, "word", "Count unique pointer-sized words"),
+                               clEnumValN(UG_LINE, "line", "Count unique cache lines")));
 
   // Define a command-line option for keeping track of unique bytes
   cl::opt<bool>
   FindMemFootprint("bf-mem-footprint", cl::init(false), cl::NotHidden,
                    cl::desc("Tabulate the minimum amount of memory needed for various cache hit rates"));
 
+  // Define a command-line option for keeping track of unique bytes in a
+  // shadow-memory bitmap instead of a page table.
+  cl::opt<bool>
+  ShadowMemory("bf-shadow-mem", cl::init(false), cl::NotHidden,
+               cl::desc("Track unique bytes in a shadow-memory bitmap updated by inline code"));
+
   // Define a command-line option for tallying loads and stored by
   // data structure.
   cl::opt<bool>
@@ -128,6 +146,41 @@ namespace bytesflops_pass {
                cl::desc("Log base 2 of the maximum number of sets modeled at the same time."),
                cl::value_desc("bits"));
 
+  // Define a command-line option for reporting the working set in each
+  // epoch of a given number of memory operations.
+  cl::opt<unsigned long long>
+  EpochOps("bf-epoch-ops", cl::init(0), cl::NotHidden,
+           cl::desc("Report the working set of every N memory operations"),
+           cl::value_desc("N"));
+
+  // Define a command-line option for reporting the working set in each
+  // epoch of a given number of milliseconds.
+  cl::opt<unsigned long long>
+  EpochMs("bf-epoch-ms", cl::init(0), cl::NotHidden,
+          cl::desc("Report the working set of every T milliseconds"),
+          cl::value_desc("T"));
+
+  // Define a command-line option for sampling the heap footprint of each
+  // allocation site every given number of allocation events.
+  cl::opt<unsigned long long>
+  HeapEvents("bf-heap-events", cl::init(0), cl::NotHidden,
+             cl::desc("Sample the heap footprint every N allocation events"),
+             cl::value_desc("N"));
+
+  // Define a command-line option for sampling the heap footprint of each
+  // allocation site every given number of milliseconds.
+  cl::opt<unsigned long long>
+  HeapMs("bf-heap-ms", cl::init(0), cl::NotHidden,
+         cl::desc("Sample the heap footprint every T milliseconds"),
+         cl::value_desc("T"));
+
+  // Define a command-line option for distinguishing heap allocations by the
+  // context from which they were called.
+  cl::opt<unsigned long long>
+  AllocContext("bf-alloc-context", cl::init(0), cl::NotHidden,
+               cl::desc("Distinguish heap allocations by their N innermost callers"),
+               cl::value_desc("N"));
+
   static RegisterPass<BytesFlops> H("bytesflops", "Bytes:flops instrumentation");
 
   // Define a command-line option for tracking load/store strides.
@@ -135,4 +188,22 @@ namespace bytesflops_pass {
   TrackStrides("bf-strides", cl::init(false), cl::NotHidden,
                cl::desc("Track data-access strides on a per-call-point basis"));
 
+  // Define a command-line option for disabling the compile-time tallying of
+  // strides that can be determined statically.
+  cl::opt<bool>
+  DynamicStrides("bf-dynamic-strides", cl::init(false), cl::NotHidden,
+                 cl::desc("Track all strides at run time, even those that can be determined statically"));
+
+  // Define a command-line option for tallying the counters of simple loops
+  // once per loop execution instead of once per iteration.
+  cl::opt<bool>
+  HoistLoops("bf-hoist-loops", cl::init(false), cl::NotHidden,
+             cl::desc("Tally simple loops' counters once per loop execution instead of once per iteration"));
+
+  // Define a command-line option for counting control-flow edges instead of
+  // updating counters in every basic block.
+  cl::opt<bool>
+  EdgeProfile("bf-edge-profile", cl::init(false), cl::NotHidden,
+              cl::desc("Count control-flow edges and reconstruct all other counters at the end of the run"));
+
 }  // namespace bytesflops_pass
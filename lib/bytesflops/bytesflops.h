@@ -10,13 +10,23 @@
 #ifndef BYTES_FLOPS_H_
 #define BYTES_FLOPS_H_
 
+#include "llvm/ADT/MapVector.h"
 #include "llvm/ADT/StringMap.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Config/llvm-config.h"
+#if LLVM_VERSION_MAJOR >= 11
+# include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+#else
+# include "llvm/Analysis/ScalarEvolutionExpander.h"
+#endif
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/GlobalValue.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instruction.h"
@@ -35,6 +45,7 @@
 #include <vector>
 #include <memory>
 #include <set>
+#include <tuple>
 #include <iomanip>
 #include <unordered_map>
 #include <time.h>
@@ -61,12 +72,22 @@ namespace bytesflops_pass {
   extern cl::opt<bool> TrackCallStack;
 
   // Define a command-line option for keeping track of unique bytes.
-  extern cl::opt<bool> TrackUniqueBytes;
+  typedef enum {UB_NONE, UB_EXACT, UB_APPROX} UniqueBytesType;
+  extern cl::opt<UniqueBytesType> TrackUniqueBytes;
+
+  // Define a command-line option for the granularity at which
+  // -bf-unique-bytes=approx counts unique addresses.
+  typedef enum {UG_BYTE, UG_WORD, UG_LINE} UniqueGranularityType;
+  extern cl::opt<UniqueGranularityType> UniqueGranularity;
 
   // Define a command-line option for helping find a program's
   // working-set size.
   extern cl::opt<bool> FindMemFootprint;
 
+  // Define a command-line option for keeping track of unique bytes in a
+  // shadow-memory bitmap.
+  extern cl::opt<bool> ShadowMemory;
+
   // Define a command-line option for tallying loads and stored by
   // data structure.
   extern cl::opt<bool> TallyByDataStruct;
@@ -122,6 +143,32 @@ namespace bytesflops_pass {
   // Define a command-line option for tracking load/store strides.
   extern cl::opt<bool> TrackStrides;
 
+  // Define a command-line option for disabling the compile-time tallying of
+  // strides that can be determined statically.
+  extern cl::opt<bool> DynamicStrides;
+
+  // Define a command-line option for tallying the counters of simple loops
+  // once per loop execution instead of once per iteration.
+  extern cl::opt<bool> HoistLoops;
+
+  // Define a command-line option for counting control-flow edges instead of
+  // updating counters in every basic block.
+  extern cl::opt<bool> EdgeProfile;
+
+  // Define command-line options for reporting the working set in each epoch
+  // of a given number of memory operations or milliseconds.
+  extern cl::opt<unsigned long long> EpochOps;
+  extern cl::opt<unsigned long long> EpochMs;
+
+  // Define command-line options for sampling the heap footprint of each
+  // allocation site every given number of allocation events or milliseconds.
+  extern cl::opt<unsigned long long> HeapEvents;
+  extern cl::opt<unsigned long long> HeapMs;
+
+  // Define a command-line option for distinguishing heap allocations by the
+  // context from which they were called.
+  extern cl::opt<unsigned long long> AllocContext;
+
   // Destructively remove all instances of a given character from a string.
   extern void remove_all_instances(string& some_string, char some_char);
 
@@ -213,6 +260,8 @@ namespace bytesflops_pass {
     GlobalVariable* op_var;    // Global reference to bf_op_count, a 64-bit operation counter
     GlobalVariable* op_bits_var;   // Global reference to bf_op_bits_count, a 64-bit operation-bit counter
     GlobalVariable* call_inst_var;              // Global reference to bf_call_ins_count, a 64-bit call-instruction counter
+    GlobalVariable* shadow_base_var;            // Global reference to bf_shadow_base, the address of the shadow bitmap
+    GlobalVariable* shadow_unique_var;          // Global reference to bf_shadow_unique, a 64-bit unique-byte counter
     uint64_t static_loads;   // Number of static load instructions
     uint64_t static_stores;  // Number of static store instructions
     uint64_t static_flops;   // Number of static floating-point instructions
@@ -233,7 +282,13 @@ namespace bytesflops_pass {
     Function* take_mega_lock;      // Pointer to bf_acquire_mega_lock()
     Function* release_mega_lock;   // Pointer to bf_release_mega_lock()
     Function* tally_vector;        // Pointer to bf_tally_vector_operation()
+    Function* register_vector_counts;  // Pointer to bf_register_vector_counts()
+    GlobalVariable* vector_counts_var;  // Pointer to the module's per-vector-type operation counters
+    StructType* vector_info_type;       // bf_vector_info_t struct type
+    vector<Constant*> vector_infos;     // Static description of each counted vector type
+    std::map<std::tuple<std::string, uint64_t, uint64_t, bool>, uint64_t> vector_slots;  // Map from a vector type to its counter slot
     Function* access_data_struct;  // Pointer to bf_access_data_struct()
+    Function* access_data_struct_locality;  // Pointer to bf_access_data_struct_locality()
     Function* assoc_addrs_with_sstruct;     // Pointer to bf_assoc_addresses_with_sstruct()
     Function* assoc_addrs_with_dstruct;     // Pointer to bf_assoc_addresses_with_dstruct
     Function* assoc_addrs_with_dstruct_pm;  // Pointer to bf_assoc_addresses_with_dstruct_pm
@@ -242,8 +297,16 @@ namespace bytesflops_pass {
     Function* reuse_dist_prog;   // Pointer to bf_reuse_dist_addrs_prog()
     Function* memset_intrinsic;  // Pointer to LLVM's memset() intrinsic
     Function* access_cache;      // Pointer to bf_touch_cache()
-    Function* tally_bb_exec;     // Pointer to bf_tally_bb_execution()
+    Function* register_bb_counts;  // Pointer to bf_register_bb_counts()
+    GlobalVariable* bb_counts_var;  // Pointer to the module's per-basic-block execution counters
+    StructType* bb_info_type;       // bf_bb_info_t struct type
+    vector<Constant*> bb_infos;     // Static information about each counted basic block
     Function* track_stride;      // Pointer to bf_track_stride()
+    Function* track_stride_loop;  // Pointer to bf_track_stride_loop()
+    Function* register_stride_table;  // Pointer to bf_register_stride_table()
+    GlobalVariable* stride_table_var;  // Module-level table of per-call-point stride information
+    uint64_t num_stride_slots;   // Number of call points assigned a slot in stride_table_var
+    Function* touch_working_set;  // Pointer to bf_touch_working_set()
     StringMap<Constant*> func_name_to_arg;   // Map from a function name to an IR function argument
     set<string>* instrument_only;   // Set of functions to instrument; NULL=all
     set<string>* dont_instrument;   // Set of functions not to instrument; NULL=none
@@ -295,6 +358,13 @@ namespace bytesflops_pass {
                                    Constant* global_var,
                                    Value* increment);
 
+    // Insert before a given instruction some code to mark a range of at
+    // most eight bytes as touched in the shadow-memory bitmap.
+    void insert_shadow_update(Module* module,
+                              BasicBlock::iterator& insert_before,
+                              Value* mem_addr,
+                              uint64_t byte_count);
+
     // Insert after a given instruction some code to increment an
     // element of a global array.
     void increment_global_array(BasicBlock::iterator& insert_before,
@@ -496,6 +566,105 @@ namespace bytesflops_pass {
     // Track all global variable declarations.
     void track_global_variables(Module* module);
 
+    // Register the module's stride table with the run-time library.
+    void create_stride_table_ctor(Module* module);
+
+    // Describe a load or store whose address advances by a constant stride
+    // on every iteration of a loop that executes a computable number of
+    // times.  Such strides are tallied once per loop execution instead of on
+    // every access.
+    typedef struct {
+      Value* first_addr;     // Address accessed on the first iteration
+      Value* trip_count;     // Number of iterations of the loop
+      int64_t stride;        // Bytes between consecutive addresses
+      BasicBlock* exit_bb;   // Loop's unique exit block
+    } static_stride_t;
+    MapVector<Instruction*, static_stride_t> static_strides;
+
+    // Find all loads and stores in a function whose strides can be
+    // determined statically.
+    void find_static_strides(Function& function);
+
+    // Tally statically determined strides upon exiting their loops.
+    void insert_static_stride_calls(Module* module);
+
+    // Describe a constant increment of a global counter that is deferred
+    // instead of being emitted where it occurs.  A counter is identified by
+    // its variable, its number of dimensions (0 for a scalar), and its
+    // (constant) indices.
+    typedef std::tuple<Constant*, int, uint64_t, uint64_t, uint64_t, uint64_t> counter_key_t;
+    typedef struct {
+      uint64_t per_trip;     // Amount to add per loop iteration
+      uint64_t once;         // Amount to add once per loop execution
+    } static_tally_t;
+    typedef MapVector<counter_key_t, static_tally_t,
+                      std::map<counter_key_t, unsigned> > static_tallies_t;
+    static_tallies_t* deferred_tallies;   // Where to defer constant increments (nullptr=don't)
+    static_tallies_t bb_tallies;          // Constant increments performed by the current basic block
+
+    // Describe an innermost, single-block loop that executes a computable
+    // number of times.  Such a loop's counters are tallied once per loop
+    // execution instead of on every iteration.
+    typedef struct {
+      Value* trip_count;         // Number of iterations of the loop
+      BasicBlock* exit_bb;       // Loop's unique exit block
+      static_tallies_t tallies;  // Constant increments performed by the loop
+      bool direct_increments;    // true=some increments could not be deferred
+      int must_clear;            // Counters the exit block must clear
+    } hoisted_loop_t;
+    MapVector<BasicBlock*, hoisted_loop_t> hoisted_loops;
+    hoisted_loop_t* current_hoist;   // Loop currently being instrumented, if hoisted
+
+    // Find all loops in a function whose counter increments can be hoisted
+    // to the loop exit.
+    void find_hoistable_loops(Function& function);
+
+    // Defer an increment of a global counter if both the increment and the
+    // counter's indices are constant.  Return true if the increment was
+    // deferred and false if code must be emitted for it.
+    bool defer_increment(Constant* global_var, int num_dims, Value** indices,
+                         Value* increment);
+
+    // Insert code to perform a set of deferred increments, each scaled by a
+    // given trip count (nullptr=execute once).
+    void insert_deferred_increments(static_tallies_t& tallies, Value* trip_count,
+                                    BasicBlock::iterator& insert_before);
+
+    // Support -bf-edge-profile, which counts the executions of a minimal set
+    // of control-flow edges and reconstructs all constant counter increments
+    // from those at the end of the run.  A "profile point" is a basic block
+    // or a conditional-branch edge whose execution count can be expressed in
+    // terms of the edge counters.
+    GlobalVariable* edge_counts_var;     // Pointer to the module's edge counters
+    Function* register_edge_profile;     // bf_register_edge_profile()
+    StructType* edge_term_type;          // bf_edge_term_t
+    StructType* edge_tally_type;         // bf_edge_tally_t
+    uint64_t num_edge_counters;          // Number of edge counters in the module
+    uint64_t num_profile_points;         // Number of profile points in the module
+    vector<Constant*> edge_terms;        // Profile-point executions in terms of edge counters
+    vector<Constant*> edge_tallies;      // Constant increments performed by each profile point
+    DenseMap<BasicBlock*, uint64_t> profiled_blocks;  // Profile point of each of the current function's blocks
+    DenseMap<BasicBlock*, std::pair<uint64_t, uint64_t> > profiled_branches;  // Profile points of each conditional branch's not-taken and taken edges
+
+    // Place edge counters in a function and express the execution count of
+    // each of its profile points in terms of those.  Return false, leaving
+    // the function unmodified, if the function can't be edge-profiled.
+    bool place_edge_counters(Function& function);
+
+    // Record that a profile point increments a counter by a given amount.
+    void record_edge_tally(uint64_t point, const counter_key_t& key, uint64_t amount);
+
+    // Register the module's edge profile with the run-time library.
+    void create_edge_profile_ctor(Module* module);
+
+    // Register the module's basic-block execution counters with the run-time
+    // library.
+    void create_bb_counts_ctor(Module* module);
+
+    // Register the module's vector-operation counters with the run-time
+    // library.
+    void create_vector_counts_ctor(Module* module);
+
     // Read the metadata associated with a value and generate code to construct
     // a bf_symbol_info_t representing where the value came from.
     AllocaInst* find_value_provenance(Module& module, Value* value,
@@ -508,6 +677,10 @@ namespace bytesflops_pass {
                                       Instruction* insert_before,
                                       AllocaInst* syminfo_struct = nullptr);
 
+    // Do the same, but return a pointer to a constant bf_symbol_info_t
+    // instead of generating code to construct one.
+    Constant* find_value_provenance(Module& module, InternalSymbolInfo& syminfo);
+
     // Do the same, but take a BasicBlock iterator instead of a Value.
     AllocaInst* find_value_provenance(Module& module,
                                       BasicBlock::iterator& inst_iter,
@@ -529,6 +702,9 @@ namespace bytesflops_pass {
 
     FunctionKeyGen::KeyID record_func(const std::string & fname);
 
+    // Request the analyses we use to find statically determined strides.
+    virtual void getAnalysisUsage(AnalysisUsage& usage) const;
+
     // Initialize the BytesFlops pass.
     virtual bool doInitialization(Module& module);
 
@@ -0,0 +1,335 @@
+/*
+ * Instrument code to keep track of run-time behavior:
+ * edge profiling (counting a minimal set of control-flow edges)
+ *
+ * By Scott Pakin <pakin@lanl.gov>
+ */
+
+#include "bytesflops.h"
+
+namespace bytesflops_pass {
+
+  // Describe a control-flow edge.  Node numbers are basic-block numbers
+  // except for a single virtual exit node, which follows all basic blocks.
+  // Each basic block that leaves the function has an edge to the exit node,
+  // and the exit node has a virtual edge to the entry block.
+  struct ProfileEdge {
+    unsigned int src;        // Source node
+    unsigned int dst;        // Destination node
+    uint64_t weight;         // Estimated relative execution frequency
+    bool is_real;            // true=transfers control out of a basic block
+    bool must_derive;        // true=can't be instrumented so must be in the spanning tree
+    bool in_tree;            // true=derived from other edges; false=counted
+    uint64_t counter;        // Edge-counter number (if not in the tree)
+    map<uint64_t, int64_t> terms;  // Execution count in terms of edge counters
+  };
+
+  // Return the representative of a node's set in a union-find structure.
+  static unsigned int find_set(vector<unsigned int>& parent, unsigned int node) {
+    while (parent[node] != node) {
+      parent[node] = parent[parent[node]];
+      node = parent[node];
+    }
+    return node;
+  }
+
+  // Return true if a basic block contains a call that may never return,
+  // leaving the block without taking any of its outgoing edges.
+  static bool may_not_complete(BasicBlock* bb) {
+    for (auto inst_iter = bb->begin(); inst_iter != bb->end(); inst_iter++)
+      if ((isa<CallInst>(*inst_iter) || isa<InvokeInst>(*inst_iter))
+          && !isa<IntrinsicInst>(*inst_iter))
+        return true;
+    return false;
+  }
+
+  // Place edge counters on the complement of a maximum spanning tree of the
+  // function's control-flow graph (Knuth; Ball and Larus).  The count of every
+  // edge in the tree is a linear combination of the counts of the edges not
+  // in the tree, so only the latter need to be counted at run time.
+  bool BytesFlops::place_edge_counters(Function& function) {
+    LoopInfo& loop_info = getAnalysis<LoopInfoWrapperPass>(function).getLoopInfo();
+    LLVMContext& ctx = function.getContext();
+    IntegerType* i64type = Type::getInt64Ty(ctx);
+
+    // Number each basic block.
+    vector<BasicBlock*> blocks;
+    DenseMap<BasicBlock*, unsigned int> block_num;
+    for (auto bb_iter = function.begin(); bb_iter != function.end(); bb_iter++) {
+      block_num[&*bb_iter] = blocks.size();
+      blocks.push_back(&*bb_iter);
+    }
+    unsigned int exit_node = blocks.size();
+
+    // Construct a list of edges.  Edges with a higher weight are more likely
+    // to be placed in the spanning tree and therefore not counted.
+    vector<ProfileEdge> edges;
+    ProfileEdge virtual_edge;
+    virtual_edge.src = exit_node;
+    virtual_edge.dst = 0;
+    virtual_edge.weight = ~uint64_t(0);
+    virtual_edge.is_real = false;
+    virtual_edge.must_derive = false;
+    edges.push_back(virtual_edge);
+    for (unsigned int b = 0; b < blocks.size(); b++) {
+      BasicBlock* bb = blocks[b];
+      Instruction* terminator = bb->getTerminator();
+      unsigned int src_depth = loop_info.getLoopDepth(bb);
+
+      // Add an edge to each unique successor or, if there are none, to the
+      // exit node.
+      vector<BasicBlock*> successors;
+      for (unsigned int s = 0; s < terminator->getNumSuccessors(); s++) {
+        BasicBlock* succ = terminator->getSuccessor(s);
+        if (find(successors.begin(), successors.end(), succ) == successors.end())
+          successors.push_back(succ);
+      }
+      if (successors.empty())
+        successors.push_back(nullptr);
+      for (auto succ_iter = successors.begin(); succ_iter != successors.end(); succ_iter++) {
+        BasicBlock* succ = *succ_iter;
+        ProfileEdge edge;
+        edge.src = b;
+        edge.dst = succ == nullptr ? exit_node : block_num[succ];
+        unsigned int depth = succ == nullptr ? 0 : min(src_depth, loop_info.getLoopDepth(succ));
+        edge.weight = uint64_t(1) << (4*min(depth, 15U));
+        edge.is_real = true;
+        edge.must_derive =
+          successors.size() > 1
+          && (succ->getUniquePredecessor() != bb
+              || succ->getFirstInsertionPt() == succ->end())
+          && !(isa<BranchInst>(terminator) && cast<BranchInst>(terminator)->isConditional());
+        edges.push_back(edge);
+      }
+
+      // Add a fake edge to the exit node from each basic block that may not
+      // complete.  The fake edge accounts for the difference between the
+      // block's incoming and outgoing flow.
+      if (may_not_complete(bb)) {
+        ProfileEdge edge;
+        edge.src = b;
+        edge.dst = exit_node;
+        edge.weight = 0;
+        edge.is_real = false;
+        edge.must_derive = true;
+        edges.push_back(edge);
+      }
+    }
+
+    // Construct a maximum spanning tree using Kruskal's algorithm, first
+    // adding all edges that must be derived.  Give up if those form a cycle.
+    vector<size_t> order(edges.size());
+    for (size_t e = 0; e < edges.size(); e++)
+      order[e] = e;
+    stable_sort(order.begin(), order.end(),
+                [&edges](size_t a, size_t b) {
+                  if (edges[a].must_derive != edges[b].must_derive)
+                    return edges[a].must_derive;
+                  return edges[a].weight > edges[b].weight;
+                });
+    vector<unsigned int> parent(exit_node + 1);
+    for (unsigned int n = 0; n <= exit_node; n++)
+      parent[n] = n;
+    uint64_t first_counter = num_edge_counters;
+    uint64_t next_counter = first_counter;
+    for (auto order_iter = order.begin(); order_iter != order.end(); order_iter++) {
+      ProfileEdge& edge = edges[*order_iter];
+      unsigned int src_set = find_set(parent, edge.src);
+      unsigned int dst_set = find_set(parent, edge.dst);
+      edge.in_tree = src_set != dst_set;
+      if (edge.in_tree)
+        parent[src_set] = dst_set;
+      else if (edge.must_derive)
+        return false;
+      else {
+        edge.counter = next_counter++;
+        edge.terms[edge.counter] = 1;
+      }
+    }
+
+    // Root each tree of the spanning forest, recording each node's parent
+    // edge and depth.
+    vector<vector<size_t> > tree_adj(exit_node + 1);
+    for (size_t e = 0; e < edges.size(); e++)
+      if (edges[e].in_tree) {
+        tree_adj[edges[e].src].push_back(e);
+        tree_adj[edges[e].dst].push_back(e);
+      }
+    const size_t no_edge = ~size_t(0);
+    vector<size_t> up_edge(exit_node + 1, no_edge);
+    vector<unsigned int> up_node(exit_node + 1);
+    vector<int> depth(exit_node + 1, -1);
+    for (unsigned int root = 0; root <= exit_node; root++) {
+      if (depth[root] != -1)
+        continue;
+      depth[root] = 0;
+      up_node[root] = root;
+      vector<unsigned int> pending(1, root);
+      while (!pending.empty()) {
+        unsigned int node = pending.back();
+        pending.pop_back();
+        for (auto adj_iter = tree_adj[node].begin(); adj_iter != tree_adj[node].end(); adj_iter++) {
+          const ProfileEdge& edge = edges[*adj_iter];
+          unsigned int other = edge.src == node ? edge.dst : edge.src;
+          if (depth[other] != -1)
+            continue;
+          depth[other] = depth[node] + 1;
+          up_edge[other] = *adj_iter;
+          up_node[other] = node;
+          pending.push_back(other);
+        }
+      }
+    }
+
+    // Each counted edge u->v closes a cycle with the tree path from v back
+    // to u.  Flow around that cycle adds the edge's count to each tree edge
+    // traversed forward and subtracts it from each tree edge traversed
+    // backward.
+    for (size_t c = 0; c < edges.size(); c++) {
+      if (edges[c].in_tree)
+        continue;
+      uint64_t counter = edges[c].counter;
+      unsigned int from = edges[c].dst;   // Walks from v up to the common ancestor
+      unsigned int to = edges[c].src;     // Walks from u up to the common ancestor
+      while (from != to) {
+        if (depth[from] >= depth[to]) {
+          ProfileEdge& edge = edges[up_edge[from]];
+          edge.terms[counter] += edge.src == from ? 1 : -1;
+          from = up_node[from];
+        }
+        else {
+          ProfileEdge& edge = edges[up_edge[to]];
+          edge.terms[counter] += edge.dst == to ? 1 : -1;
+          to = up_node[to];
+        }
+      }
+    }
+
+    // Express each basic block's execution count as the sum of its real
+    // outgoing edges' counts and each conditional branch's not-taken and
+    // taken counts as its edges' counts.
+    map<unsigned int, map<uint64_t, int64_t> > block_terms;
+    map<pair<unsigned int, unsigned int>, const ProfileEdge*> real_edges;
+    for (auto edge_iter = edges.begin(); edge_iter != edges.end(); edge_iter++) {
+      if (!edge_iter->is_real)
+        continue;
+      map<uint64_t, int64_t>& terms = block_terms[edge_iter->src];
+      for (auto term_iter = edge_iter->terms.begin(); term_iter != edge_iter->terms.end(); term_iter++)
+        terms[term_iter->first] += term_iter->second;
+      real_edges[make_pair(edge_iter->src, edge_iter->dst)] = &*edge_iter;
+    }
+    vector<pair<uint64_t, const map<uint64_t, int64_t>*> > point_terms;
+    for (unsigned int b = 0; b < blocks.size(); b++) {
+      BasicBlock* bb = blocks[b];
+      profiled_blocks[bb] = num_profile_points;
+      point_terms.push_back(make_pair(num_profile_points++, &block_terms[b]));
+      BranchInst* br_inst = dyn_cast<BranchInst>(bb->getTerminator());
+      if (br_inst == nullptr || !br_inst->isConditional()
+          || br_inst->getSuccessor(0) == br_inst->getSuccessor(1))
+        continue;
+      const ProfileEdge* nt_edge = real_edges[make_pair(b, block_num[br_inst->getSuccessor(0)])];
+      const ProfileEdge* t_edge = real_edges[make_pair(b, block_num[br_inst->getSuccessor(1)])];
+      profiled_branches[bb] = make_pair(num_profile_points, num_profile_points + 1);
+      point_terms.push_back(make_pair(num_profile_points++, &nt_edge->terms));
+      point_terms.push_back(make_pair(num_profile_points++, &t_edge->terms));
+    }
+    for (auto pt_iter = point_terms.begin(); pt_iter != point_terms.end(); pt_iter++) {
+      const map<uint64_t, int64_t>& terms = *pt_iter->second;
+      for (auto term_iter = terms.begin(); term_iter != terms.end(); term_iter++) {
+        if (term_iter->second == 0)
+          continue;
+        vector<Constant*> fields;
+        fields.push_back(ConstantInt::get(i64type, pt_iter->first));
+        fields.push_back(ConstantInt::get(i64type, term_iter->first));
+        fields.push_back(ConstantInt::get(i64type, uint64_t(term_iter->second)));
+        edge_terms.push_back(ConstantStruct::get(edge_term_type, fields));
+      }
+    }
+
+    // Count each edge not in the tree, preferably at the end of its source
+    // block or the beginning of its destination block.  If neither is
+    // possible, the source block must end in a conditional branch, and we
+    // count the edge by the branch condition.
+    for (auto edge_iter = edges.begin(); edge_iter != edges.end(); edge_iter++) {
+      if (edge_iter->in_tree)
+        continue;
+      ConstantInt* counter = ConstantInt::get(i64type, edge_iter->counter);
+      if (!edge_iter->is_real) {
+        // Virtual edge -- count function entries.
+        BasicBlock::iterator insert_before = blocks[0]->getFirstInsertionPt();
+        increment_global_array(insert_before, edge_counts_var, counter, one);
+        continue;
+      }
+      BasicBlock* src_bb = blocks[edge_iter->src];
+      BasicBlock* dst_bb = edge_iter->dst == exit_node ? nullptr : blocks[edge_iter->dst];
+      Instruction* terminator = src_bb->getTerminator();
+      if (dst_bb == nullptr || src_bb->getUniqueSuccessor() == dst_bb) {
+        BasicBlock::iterator insert_before = terminator->getIterator();
+        increment_global_array(insert_before, edge_counts_var, counter, one);
+      }
+      else if (dst_bb->getUniquePredecessor() == src_bb
+               && dst_bb->getFirstInsertionPt() != dst_bb->end()) {
+        BasicBlock::iterator insert_before = dst_bb->getFirstInsertionPt();
+        increment_global_array(insert_before, edge_counts_var, counter, one);
+      }
+      else {
+        BranchInst* br_inst = cast<BranchInst>(terminator);
+        Value* taken = br_inst->getCondition();
+        if (br_inst->getSuccessor(0) != dst_bb) {
+          BinaryOperator* not_taken = BinaryOperator::CreateNot(taken, "bf_not_taken", terminator);
+          mark_as_byfl(not_taken);
+          taken = not_taken;
+        }
+        ZExtInst* increment = new ZExtInst(taken, i64type, "bf_taken", terminator);
+        mark_as_byfl(increment);
+        BasicBlock::iterator insert_before = terminator->getIterator();
+        increment_global_array(insert_before, edge_counts_var, counter, increment);
+      }
+    }
+    num_edge_counters = next_counter;
+    return true;
+  }
+
+  // Record that a profile point increments a counter by a given amount.
+  void BytesFlops::record_edge_tally(uint64_t point, const counter_key_t& key,
+                                     uint64_t amount) {
+    // Determine the address of the counter or of the pointer to the counter
+    // array.
+    Constant* counter = std::get<0>(key);
+    uint64_t index = 0;
+    uint64_t indirect = 0;
+    LLVMContext& ctx = counter->getContext();
+    IntegerType* i64type = Type::getInt64Ty(ctx);
+    switch (std::get<1>(key)) {
+      case 0:
+        break;
+
+      case 1:
+        index = std::get<2>(key);
+        indirect = 1;
+        break;
+
+      default:
+        {
+          vector<Constant*> gep_indices;
+          gep_indices.push_back(ConstantInt::get(i64type, 0));
+          gep_indices.push_back(ConstantInt::get(i64type, std::get<2>(key)));
+          gep_indices.push_back(ConstantInt::get(i64type, std::get<3>(key)));
+          gep_indices.push_back(ConstantInt::get(i64type, std::get<4>(key)));
+          gep_indices.push_back(ConstantInt::get(i64type, std::get<5>(key)));
+          counter = ConstantExpr::getGetElementPtr(nullptr, counter, gep_indices);
+        }
+        break;
+    }
+
+    // Add a row to the tally table.
+    vector<Constant*> fields;
+    fields.push_back(ConstantExpr::getBitCast(counter, Type::getInt8PtrTy(ctx)));
+    fields.push_back(ConstantInt::get(i64type, point));
+    fields.push_back(ConstantInt::get(i64type, index));
+    fields.push_back(ConstantInt::get(i64type, amount));
+    fields.push_back(ConstantInt::get(i64type, indirect));
+    edge_tallies.push_back(ConstantStruct::get(edge_tally_type, fields));
+  }
+
+} // namespace bytesflops_pass
@@ -137,6 +137,10 @@ void BytesFlops::increment_global_variable(BasicBlock::iterator& insert_before,
                                            Constant* global_var,
                                            Value* increment)
 {
+  // Defer constant increments if we're asked to.
+  if (defer_increment(global_var, 0, nullptr, increment))
+    return;
+
   // %0 = load i64* @<global_var>, align 8
   LoadInst* load_var = new LoadInst(global_var, "gvar", false, &*insert_before);
   mark_as_byfl(load_var);
@@ -151,6 +155,181 @@ void BytesFlops::increment_global_variable(BasicBlock::iterator& insert_before,
   mark_as_byfl(new StoreInst(inc_var, global_var, false, &*insert_before));
 }
 
+// Defer an increment of a global counter if we're deferring increments and
+// both the increment and the counter's indices are constant.  Return true if
+// the increment was deferred.
+bool BytesFlops::defer_increment(Constant* global_var, int num_dims,
+                                 Value** indices, Value* increment)
+{
+  if (deferred_tallies == nullptr)
+    return false;
+  uint64_t idx_vals[4] = {0, 0, 0, 0};
+  ConstantInt* inc_val = dyn_cast<ConstantInt>(increment);
+  for (int i = 0; i < num_dims; i++) {
+    ConstantInt* idx_val = dyn_cast<ConstantInt>(indices[i]);
+    if (idx_val == nullptr)
+      inc_val = nullptr;
+    else
+      idx_vals[i] = idx_val->getZExtValue();
+  }
+  if (inc_val == nullptr) {
+    if (current_hoist != nullptr)
+      current_hoist->direct_increments = true;
+    return false;
+  }
+  counter_key_t key(global_var, num_dims,
+                    idx_vals[0], idx_vals[1], idx_vals[2], idx_vals[3]);
+  (*deferred_tallies)[key].per_trip += inc_val->getZExtValue();
+  return true;
+}
+
+// Insert before a given instruction some code to increment each counter in a
+// set of deferred increments by its per-iteration amount times a trip count
+// plus its one-time amount.  A null trip count represents a single execution.
+void BytesFlops::insert_deferred_increments(static_tallies_t& tallies,
+                                            Value* trip_count,
+                                            BasicBlock::iterator& insert_before)
+{
+  LLVMContext& ctx = insert_before->getContext();
+  for (auto tally_iter = tallies.begin(); tally_iter != tallies.end(); tally_iter++) {
+    // Compute the total increment: <trip_count>*<per_trip> + <once>.
+    const counter_key_t& key = tally_iter->first;
+    const static_tally_t& tally = tally_iter->second;
+    Value* increment;
+    if (trip_count == nullptr) {
+      if (tally.per_trip + tally.once == 0)
+        continue;
+      increment = ConstantInt::get(ctx, APInt(64, tally.per_trip + tally.once));
+    }
+    else if (tally.per_trip != 0) {
+      BinaryOperator* product =
+        BinaryOperator::Create(Instruction::Mul, trip_count,
+                               ConstantInt::get(ctx, APInt(64, tally.per_trip)),
+                               "trips_inc", &*insert_before);
+      mark_as_byfl(product);
+      increment = product;
+      if (tally.once != 0) {
+        BinaryOperator* sum =
+          BinaryOperator::Create(Instruction::Add, product,
+                                 ConstantInt::get(ctx, APInt(64, tally.once)),
+                                 "loop_inc", &*insert_before);
+        mark_as_byfl(sum);
+        increment = sum;
+      }
+    }
+    else if (tally.once != 0)
+      increment = ConstantInt::get(ctx, APInt(64, tally.once));
+    else
+      continue;
+
+    // Increment the counter.
+    Constant* global_var = std::get<0>(key);
+    uint64_t idx_vals[4] = {std::get<2>(key), std::get<3>(key),
+                            std::get<4>(key), std::get<5>(key)};
+    Value* indices[4];
+    for (int i = 0; i < 4; i++)
+      indices[i] = ConstantInt::get(ctx, APInt(64, idx_vals[i]));
+    switch (std::get<1>(key)) {
+      case 0:
+        increment_global_variable(insert_before, global_var, increment);
+        break;
+
+      case 1:
+        increment_global_array(insert_before, global_var, indices[0], increment);
+        break;
+
+      default:
+        increment_global_4D_array(insert_before, cast<GlobalVariable>(global_var),
+                                  indices[0], indices[1], indices[2], indices[3],
+                                  increment);
+        break;
+    }
+  }
+}
+
+// Insert before a given instruction some code to mark a range of at most
+// eight bytes as touched in the shadow-memory bitmap and to tally the number of
+// bits that were previously clear.  This is an inline equivalent of
+// bf_assoc_addresses_with_prog() for when -bf-shadow-mem is specified.
+void BytesFlops::insert_shadow_update(Module* module,
+                                      BasicBlock::iterator& insert_before,
+                                      Value* mem_addr,
+                                      uint64_t byte_count)
+{
+  LLVMContext& globctx = module->getContext();
+  IntegerType* i16type = Type::getInt16Ty(globctx);
+  IntegerType* i64type = Type::getInt64Ty(globctx);
+  Instruction* insert_point = &*insert_before;
+
+  // %1 = lshr i64 %mem_addr, 3
+  // %2 = and i64 %1, <BF_SHADOW_BYTES-1>
+  BinaryOperator* shadow_idx =
+    BinaryOperator::Create(Instruction::LShr, mem_addr,
+                           ConstantInt::get(i64type, 3),
+                           "shadow_idx", insert_point);
+  mark_as_byfl(shadow_idx);
+  BinaryOperator* shadow_ofs =
+    BinaryOperator::Create(Instruction::And, shadow_idx,
+                           ConstantInt::get(i64type, BF_SHADOW_BYTES - 1),
+                           "shadow_ofs", insert_point);
+  mark_as_byfl(shadow_ofs);
+
+  // %3 = load i64* @bf_shadow_base, align 8
+  // %4 = add i64 %3, %2
+  // %5 = inttoptr i64 %4 to i16*
+  LoadInst* shadow_base = new LoadInst(shadow_base_var, "shadow_base", false, 8, insert_point);
+  mark_as_byfl(shadow_base);
+  BinaryOperator* shadow_addr =
+    BinaryOperator::Create(Instruction::Add, shadow_base, shadow_ofs,
+                           "shadow_addr", insert_point);
+  mark_as_byfl(shadow_addr);
+  IntToPtrInst* shadow_ptr =
+    new IntToPtrInst(shadow_addr, PointerType::get(i16type, 0), "shadow_ptr", insert_point);
+  mark_as_byfl(shadow_ptr);
+
+  // %6 = trunc i64 %mem_addr to i16
+  // %7 = and i16 %6, 7
+  // %8 = shl i16 <2^byte_count-1>, %7
+  TruncInst* addr16 = new TruncInst(mem_addr, i16type, "addr16", insert_point);
+  mark_as_byfl(addr16);
+  BinaryOperator* bit_ofs =
+    BinaryOperator::Create(Instruction::And, addr16,
+                           ConstantInt::get(i16type, 7),
+                           "bit_ofs", insert_point);
+  mark_as_byfl(bit_ofs);
+  BinaryOperator* mask =
+    BinaryOperator::Create(Instruction::Shl,
+                           ConstantInt::get(i16type, (1U<<byte_count) - 1),
+                           bit_ofs, "mask", insert_point);
+  mark_as_byfl(mask);
+
+  // %9 = load i16* %5, align 1
+  // %10 = or i16 %9, %8
+  // store i16 %10, i16* %5, align 1
+  LoadInst* old_bits = new LoadInst(shadow_ptr, "old_bits", false, 1, insert_point);
+  mark_as_byfl(old_bits);
+  BinaryOperator* new_bits =
+    BinaryOperator::Create(Instruction::Or, old_bits, mask, "new_bits", insert_point);
+  mark_as_byfl(new_bits);
+  mark_as_byfl(new StoreInst(new_bits, shadow_ptr, false, 1, insert_point));
+
+  // %11 = xor i16 %10, %9
+  // %12 = call i16 @llvm.ctpop.i16(i16 %11)
+  // %13 = zext i16 %12 to i64
+  BinaryOperator* changed_bits =
+    BinaryOperator::Create(Instruction::Xor, new_bits, old_bits,
+                           "changed_bits", insert_point);
+  mark_as_byfl(changed_bits);
+  Function* ctpop = Intrinsic::getDeclaration(module, Intrinsic::ctpop, i16type);
+  CallInst* num_changed = CallInst::Create(ctpop, changed_bits, "num_changed", insert_point);
+  mark_as_byfl(num_changed);
+  ZExtInst* num_changed64 = new ZExtInst(num_changed, i64type, "num_changed64", insert_point);
+  mark_as_byfl(num_changed64);
+
+  // Add the number of newly set bits to bf_shadow_unique.
+  increment_global_variable(insert_before, shadow_unique_var, num_changed64);
+}
+
 // Insert before a given instruction some code to increment an element of a
 // global array (really, a pointer to a vector).
 void BytesFlops::increment_global_array(BasicBlock::iterator& insert_before,
@@ -158,6 +337,10 @@ void BytesFlops::increment_global_array(BasicBlock::iterator& insert_before,
                                         Value* idx,
                                         Value* increment)
 {
+  // Defer constant increments if we're asked to.
+  if (defer_increment(global_var, 1, &idx, increment))
+    return;
+
   // %1 = load i64** @<global_var>, align 8
   LoadInst* load_array = new LoadInst(global_var, "garray", false, 8, &*insert_before);
   mark_as_byfl(load_array);
@@ -190,6 +373,11 @@ void BytesFlops::increment_global_4D_array(BasicBlock::iterator& insert_before,
                                            Value* idx4,
                                            Value* increment)
 {
+  // Defer constant increments if we're asked to.
+  Value* indices[4] = {idx1, idx2, idx3, idx4};
+  if (defer_increment(array4d_var, 4, indices, increment))
+    return;
+
   // %1 = getelementptr inbounds [<D1> x [<D1> x [<D3> x [<D4> x i64]]]]* @<global_var>, i64 0, i64 <idx1>, i64 <idx2>, i64 <idx3>, i64 <idx4>
   std::vector<Value*> gep_indices;
   gep_indices.push_back(zero);
@@ -613,6 +801,34 @@ void BytesFlops::insert_end_bb_code (Module* module, KeyType_t funcKey,
           // Conditional branch -- dynamically choose to increment
           // either "not taken" or "taken".
           static_cond_brs++;
+          if (current_hoist != nullptr) {
+            // Hoisted loop -- the branch back to the top of the loop is
+            // taken on every iteration but the last, and the other branch
+            // is taken exactly once.
+            bool nt_repeats = br_inst->getSuccessor(0) == br_inst->getParent();
+            counter_key_t repeat_key(terminator_var, 1,
+                                     nt_repeats ? BF_END_BB_COND_NT : BF_END_BB_COND_T,
+                                     0, 0, 0);
+            counter_key_t exit_key(terminator_var, 1,
+                                   nt_repeats ? BF_END_BB_COND_T : BF_END_BB_COND_NT,
+                                   0, 0, 0);
+            (*deferred_tallies)[repeat_key].per_trip++;
+            (*deferred_tallies)[repeat_key].once--;
+            (*deferred_tallies)[exit_key].once++;
+            break;
+          }
+          auto profiled = profiled_branches.find(br_inst->getParent());
+          if (profiled != profiled_branches.end()) {
+            // Edge-profiled branch -- tally each direction by the number
+            // of times its edge was taken.
+            record_edge_tally(profiled->second.first,
+                              counter_key_t(terminator_var, 1, BF_END_BB_COND_NT, 0, 0, 0),
+                              1);
+            record_edge_tally(profiled->second.second,
+                              counter_key_t(terminator_var, 1, BF_END_BB_COND_T, 0, 0, 0),
+                              1);
+            break;
+          }
           SelectInst* array_offset =
             SelectInst::Create(br_inst->getCondition(),
                                ConstantInt::get(globctx, APInt(64, BF_END_BB_COND_NT)),
@@ -640,27 +856,58 @@ void BytesFlops::insert_end_bb_code (Module* module, KeyType_t funcKey,
                          ConstantInt::get(globctx, APInt(64, BF_END_BB_ANY)),
                          one);
 
-  // If we're instrumenting every basic block, insert calls to
-  // bf_tally_bb_execution(), bf_accumulate_bb_tallies(), and
-  // bf_report_bb_tallies().
+  // Perform all of the basic block's constant counter increments at once,
+  // one addition per counter.  (A hoisted loop's increments are instead
+  // performed at the loop exit, and an edge-profiled block's increments are
+  // instead reconstructed at the end of the run.)
+  if (deferred_tallies == &bb_tallies) {
+    deferred_tallies = nullptr;
+    auto profiled = profiled_blocks.find(insert_before->getParent());
+    if (profiled == profiled_blocks.end())
+      insert_deferred_increments(bb_tallies, nullptr, insert_before);
+    else {
+      // Vector-operation counters must exclude operations performed while
+      // counting is suppressed, so they can't wait until the end of the run.
+      static_tallies_t direct_tallies;
+      for (auto tally_iter = bb_tallies.begin(); tally_iter != bb_tallies.end(); tally_iter++) {
+        if (std::get<0>(tally_iter->first) == vector_counts_var) {
+          direct_tallies.insert(*tally_iter);
+          continue;
+        }
+        uint64_t amount = tally_iter->second.per_trip + tally_iter->second.once;
+        if (amount != 0)
+          record_edge_tally(profiled->second, tally_iter->first, amount);
+      }
+      insert_deferred_increments(direct_tallies, nullptr, insert_before);
+    }
+  }
+
+  // If we're instrumenting every basic block, increment the basic block's
+  // slot in the module's execution-counter array and insert calls to
+  // bf_accumulate_bb_tallies() and bf_report_bb_tallies().  The basic
+  // block's location and size are recorded statically, alongside its slot
+  // number, for the run-time library to read at the end of the run.
   if (InstrumentEveryBB) {
-    static MersenneTwister bb_rng(module->getModuleIdentifier());
-    vector<Value*> arg_list;
-    uint64_t randnum = uint64_t(bb_rng.next());
-    func_syminfo =
-      find_value_provenance(*module, &inst, inst_to_string(&inst), insert_before, func_syminfo);
-    arg_list.push_back(func_syminfo);
-    arg_list.push_back(ConstantInt::get(globctx, APInt(64, randnum)));
-    arg_list.push_back(ConstantInt::get(globctx, APInt(64, num_insts)));
-    callinst_create(tally_bb_exec, arg_list, &*insert_before);
+    InternalSymbolInfo syminfo(&inst, inst_to_string(&inst));
+    Constant* bb_syminfo = find_value_provenance(*module, syminfo);
+    vector<Constant*> info_fields;
+    info_fields.push_back(bb_syminfo);
+    info_fields.push_back(ConstantInt::get(globctx, APInt(64, num_insts)));
+    ConstantInt* bb_slot = ConstantInt::get(globctx, APInt(64, bb_infos.size()));
+    bb_infos.push_back(ConstantStruct::get(bb_info_type, info_fields));
+    increment_global_array(insert_before, bb_counts_var, bb_slot, one);
     callinst_create(accum_bb_tallies, &*insert_before);
-    arg_list.resize(1);    // Retain only the bf_symbol_info_t* argument.
+    vector<Value*> arg_list;
+    arg_list.push_back(bb_syminfo);
     callinst_create(report_bb_tallies, arg_list, &*insert_before);
   }
 
   // If we're instrumenting by function, insert a call to
   // bf_assoc_counters_with_func() at the end of the basic block.
-  if (TallyByFunction) {
+  // There's no need to do so at the end of each iteration of a hoisted loop
+  // if all of its counter increments were deferred to the loop exit.
+  bool flush_counters = current_hoist == nullptr || current_hoist->direct_increments;
+  if (TallyByFunction && flush_counters) {
     vector<Value*> arg_list;
     ConstantInt * key = ConstantInt::get(IntegerType::get(globctx, 8*sizeof(FunctionKeyGen::KeyID)),
                                          funcKey);
@@ -669,7 +916,7 @@ void BytesFlops::insert_end_bb_code (Module* module, KeyType_t funcKey,
   }
 
   // Reset all of our counter variables.
-  if (InstrumentEveryBB || TallyByFunction) {
+  if ((InstrumentEveryBB || TallyByFunction) && flush_counters) {
     if (must_clear & CLEAR_LOADS) {
       mark_as_byfl(new StoreInst(zero, load_var, false, &*insert_before));
       mark_as_byfl(new StoreInst(zero, load_inst_var, false, &*insert_before));
@@ -1000,6 +1247,40 @@ AllocaInst* BytesFlops::find_value_provenance(Module& module,
   return syminfo_struct;
 }
 
+// Return a constant pointer to a private, constant copy of a string.
+static Constant* private_string_constant(Module& module, const string& value,
+                                         const char* name)
+{
+  LLVMContext& globctx = module.getContext();
+  Constant* contents = ConstantDataArray::getString(globctx, value, true);
+  GlobalVariable* string_var =
+    new GlobalVariable(module, contents->getType(), true,
+                       GlobalValue::PrivateLinkage, contents, name);
+  string_var->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+  return ConstantExpr::getBitCast(string_var, Type::getInt8PtrTy(globctx));
+}
+
+// Return a pointer to a constant bf_symbol_info_t that represents a given
+// InternalSymbolInfo.
+Constant* BytesFlops::find_value_provenance(Module& module,
+                                            InternalSymbolInfo& syminfo)
+{
+  LLVMContext& globctx = module.getContext();
+  vector<Constant*> fields;
+  fields.push_back(ConstantInt::get(globctx, APInt(64, syminfo.ID)));
+  fields.push_back(private_string_constant(module, syminfo.origin, "bf_syminfo.origin.data"));
+  fields.push_back(private_string_constant(module, syminfo.symbol, "bf_syminfo.symbol.data"));
+  fields.push_back(private_string_constant(module, syminfo.function, "bf_syminfo.function.data"));
+  fields.push_back(private_string_constant(module, syminfo.file, "bf_syminfo.file.data"));
+  fields.push_back(ConstantInt::get(globctx, APInt(32, syminfo.line)));
+  GlobalVariable* syminfo_var =
+    new GlobalVariable(module, syminfo_type, true, GlobalValue::InternalLinkage,
+                       ConstantStruct::get(syminfo_type, fields),
+                       "bf_syminfo");
+  syminfo_var->setAlignment(8);
+  return syminfo_var;
+}
+
 
 // Read the metadata associated with a value and generate code to construct a
 // bf_symbol_info_t representing where the value came from.
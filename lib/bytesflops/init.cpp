@@ -161,6 +161,230 @@ namespace bytesflops_pass {
     }
   }
 
+  /*
+   * Define a constructor called bf_stride_table_ctor() with the following
+   * form, passing the run-time library the module's table of stride-tracking
+   * slots, one per call point the pass numbered:
+   *
+   * __attribute__((constructor))
+   * static void bf_stride_table_ctor (void)
+   * {
+   *   bf_initialize_if_necessary();
+   *   bf_register_stride_table(bf_stride_slots, <number of call points>);
+   * }
+   */
+  void BytesFlops::create_stride_table_ctor (Module* module) {
+    // Declare the bf_stride_table_ctor() function.
+    const char* funcname = "bf_stride_table_ctor";
+    Function* func = module->getFunction(funcname);
+    if (func != nullptr)
+      return;
+    func = declare_thunk(module, funcname);
+    func->setLinkage(GlobalValue::InternalLinkage);
+
+    // Prepend bf_stride_table_ctor() to the list of constructors.
+    prepend_to_ctor_list(module, func);
+
+    // Statically allocate the slots themselves, and point bf_stride_table to
+    // them so strides can be tracked even before the constructor runs.
+    LLVMContext& globctx = module->getContext();
+    PointerType* ptr_to_char = Type::getInt8PtrTy(globctx);
+    ArrayType* slots_type = ArrayType::get(ptr_to_char, num_stride_slots);
+    GlobalVariable* slots_var =
+      new GlobalVariable(*module, slots_type, false, GlobalValue::InternalLinkage,
+                         ConstantAggregateZero::get(slots_type),
+                         "bf_stride_slots");
+    slots_var->setAlignment(8);
+    vector<Constant*> first_elt;
+    first_elt.push_back(ConstantInt::get(globctx, APInt(64, 0)));
+    first_elt.push_back(ConstantInt::get(globctx, APInt(64, 0)));
+    Constant* slots_ptr = ConstantExpr::getGetElementPtr(slots_type, slots_var, first_elt);
+    stride_table_var->setInitializer(slots_ptr);
+    stride_table_var->setConstant(true);
+
+    // Add a single basic block to bf_stride_table_ctor() that calls
+    // bf_initialize_if_necessary() followed by bf_register_stride_table().
+    BasicBlock* bblock = BasicBlock::Create(globctx, "entry", func);
+    ReturnInst* ret_inst = ReturnInst::Create(globctx, bblock);
+    callinst_create(init_if_necessary, ret_inst);
+    vector<Value*> arg_list;
+    arg_list.push_back(slots_ptr);
+    arg_list.push_back(ConstantInt::get(globctx, APInt(64, num_stride_slots)));
+    callinst_create(register_stride_table, arg_list, ret_inst);
+  }
+
+  /*
+   * Define a constructor called bf_edge_profile_ctor() with the following
+   * form, passing the run-time library the module's edge-profile tables:
+   *
+   * __attribute__((constructor))
+   * static void bf_edge_profile_ctor (void)
+   * {
+   *   bf_initialize_if_necessary();
+   *   bf_register_edge_profile(bf_edge_count_array, <number of edge counters>,
+   *                            <number of profile points>,
+   *                            bf_edge_terms, <number of terms>,
+   *                            bf_edge_tallies, <number of tallies>);
+   * }
+   */
+  void BytesFlops::create_edge_profile_ctor (Module* module) {
+    // Statically allocate the edge counters, and point bf_edge_counts to them
+    // so edges can be counted even before the constructor runs.
+    LLVMContext& globctx = module->getContext();
+    PointerType* ptr_to_char = Type::getInt8PtrTy(globctx);
+    ArrayType* counts_type = ArrayType::get(Type::getInt64Ty(globctx), num_edge_counters);
+    GlobalVariable* counts_var =
+      new GlobalVariable(*module, counts_type, false, GlobalValue::InternalLinkage,
+                         ConstantAggregateZero::get(counts_type),
+                         "bf_edge_count_array");
+    counts_var->setAlignment(8);
+    vector<Constant*> first_elt;
+    first_elt.push_back(ConstantInt::get(globctx, APInt(64, 0)));
+    first_elt.push_back(ConstantInt::get(globctx, APInt(64, 0)));
+    Constant* counts_ptr = ConstantExpr::getGetElementPtr(counts_type, counts_var, first_elt);
+    edge_counts_var->setInitializer(counts_ptr);
+    edge_counts_var->setConstant(true);
+
+    // Define the tables that map edge counts to counter increments.
+    ArrayType* terms_type = ArrayType::get(edge_term_type, edge_terms.size());
+    GlobalVariable* terms_var =
+      new GlobalVariable(*module, terms_type, true, GlobalValue::InternalLinkage,
+                         ConstantArray::get(terms_type, edge_terms),
+                         "bf_edge_terms");
+    ArrayType* tallies_type = ArrayType::get(edge_tally_type, edge_tallies.size());
+    GlobalVariable* tallies_var =
+      new GlobalVariable(*module, tallies_type, true, GlobalValue::InternalLinkage,
+                         ConstantArray::get(tallies_type, edge_tallies),
+                         "bf_edge_tallies");
+
+    // Declare the bf_edge_profile_ctor() function.
+    Function* func = declare_thunk(module, "bf_edge_profile_ctor");
+    func->setLinkage(GlobalValue::InternalLinkage);
+    prepend_to_ctor_list(module, func);
+
+    // Add a single basic block to bf_edge_profile_ctor() that calls
+    // bf_initialize_if_necessary() followed by bf_register_edge_profile().
+    BasicBlock* bblock = BasicBlock::Create(globctx, "entry", func);
+    ReturnInst* ret_inst = ReturnInst::Create(globctx, bblock);
+    callinst_create(init_if_necessary, ret_inst);
+    vector<Value*> arg_list;
+    arg_list.push_back(counts_ptr);
+    arg_list.push_back(ConstantInt::get(globctx, APInt(64, num_edge_counters)));
+    arg_list.push_back(ConstantInt::get(globctx, APInt(64, num_profile_points)));
+    arg_list.push_back(ConstantExpr::getBitCast(terms_var, ptr_to_char));
+    arg_list.push_back(ConstantInt::get(globctx, APInt(64, edge_terms.size())));
+    arg_list.push_back(ConstantExpr::getBitCast(tallies_var, ptr_to_char));
+    arg_list.push_back(ConstantInt::get(globctx, APInt(64, edge_tallies.size())));
+    callinst_create(register_edge_profile, arg_list, ret_inst);
+  }
+
+  /*
+   * Define a constructor called bf_bb_counts_ctor() with the following form,
+   * passing the run-time library the module's basic-block execution counters
+   * and static information about each basic block they count:
+   *
+   * __attribute__((constructor))
+   * static void bf_bb_counts_ctor (void)
+   * {
+   *   bf_initialize_if_necessary();
+   *   bf_register_bb_counts(bf_bb_count_array, bf_bb_info, <number of basic blocks>);
+   * }
+   */
+  void BytesFlops::create_bb_counts_ctor (Module* module) {
+    // Statically allocate the counters themselves, and point bf_bb_counts to
+    // them so basic blocks can be counted even before the constructor runs.
+    LLVMContext& globctx = module->getContext();
+    ArrayType* counts_type = ArrayType::get(Type::getInt64Ty(globctx), bb_infos.size());
+    GlobalVariable* counts_var =
+      new GlobalVariable(*module, counts_type, false, GlobalValue::InternalLinkage,
+                         ConstantAggregateZero::get(counts_type),
+                         "bf_bb_count_array");
+    counts_var->setAlignment(8);
+    vector<Constant*> first_elt;
+    first_elt.push_back(ConstantInt::get(globctx, APInt(64, 0)));
+    first_elt.push_back(ConstantInt::get(globctx, APInt(64, 0)));
+    Constant* counts_ptr = ConstantExpr::getGetElementPtr(counts_type, counts_var, first_elt);
+    bb_counts_var->setInitializer(counts_ptr);
+    bb_counts_var->setConstant(true);
+
+    // Define the table of static basic-block information.
+    ArrayType* info_type = ArrayType::get(bb_info_type, bb_infos.size());
+    GlobalVariable* info_var =
+      new GlobalVariable(*module, info_type, true, GlobalValue::InternalLinkage,
+                         ConstantArray::get(info_type, bb_infos),
+                         "bf_bb_info");
+
+    // Declare the bf_bb_counts_ctor() function.
+    Function* func = declare_thunk(module, "bf_bb_counts_ctor");
+    func->setLinkage(GlobalValue::InternalLinkage);
+    prepend_to_ctor_list(module, func);
+
+    // Add a single basic block to bf_bb_counts_ctor() that calls
+    // bf_initialize_if_necessary() followed by bf_register_bb_counts().
+    BasicBlock* bblock = BasicBlock::Create(globctx, "entry", func);
+    ReturnInst* ret_inst = ReturnInst::Create(globctx, bblock);
+    callinst_create(init_if_necessary, ret_inst);
+    vector<Value*> arg_list;
+    arg_list.push_back(counts_ptr);
+    arg_list.push_back(ConstantExpr::getBitCast(info_var, Type::getInt8PtrTy(globctx)));
+    arg_list.push_back(ConstantInt::get(globctx, APInt(64, bb_infos.size())));
+    callinst_create(register_bb_counts, arg_list, ret_inst);
+  }
+
+  /*
+   * Define a constructor called bf_vector_counts_ctor() with the following
+   * form, passing the run-time library the module's vector-operation counters
+   * and a static description of each vector type they count:
+   *
+   * __attribute__((constructor))
+   * static void bf_vector_counts_ctor (void)
+   * {
+   *   bf_initialize_if_necessary();
+   *   bf_register_vector_counts(bf_vector_count_array, bf_vector_info, <number of vector types>);
+   * }
+   */
+  void BytesFlops::create_vector_counts_ctor (Module* module) {
+    // Statically allocate the counters themselves, and point bf_vector_counts
+    // to them so vector operations can be counted even before the constructor
+    // runs.
+    LLVMContext& globctx = module->getContext();
+    ArrayType* counts_type = ArrayType::get(Type::getInt64Ty(globctx), vector_infos.size());
+    GlobalVariable* counts_var =
+      new GlobalVariable(*module, counts_type, false, GlobalValue::InternalLinkage,
+                         ConstantAggregateZero::get(counts_type),
+                         "bf_vector_count_array");
+    counts_var->setAlignment(8);
+    vector<Constant*> first_elt;
+    first_elt.push_back(ConstantInt::get(globctx, APInt(64, 0)));
+    first_elt.push_back(ConstantInt::get(globctx, APInt(64, 0)));
+    Constant* counts_ptr = ConstantExpr::getGetElementPtr(counts_type, counts_var, first_elt);
+    vector_counts_var->setInitializer(counts_ptr);
+    vector_counts_var->setConstant(true);
+
+    // Define the table of static vector-type information.
+    ArrayType* info_type = ArrayType::get(vector_info_type, vector_infos.size());
+    GlobalVariable* info_var =
+      new GlobalVariable(*module, info_type, true, GlobalValue::InternalLinkage,
+                         ConstantArray::get(info_type, vector_infos),
+                         "bf_vector_info");
+
+    // Declare the bf_vector_counts_ctor() function.
+    Function* func = declare_thunk(module, "bf_vector_counts_ctor");
+    func->setLinkage(GlobalValue::InternalLinkage);
+    prepend_to_ctor_list(module, func);
+
+    // Add a single basic block to bf_vector_counts_ctor() that calls
+    // bf_initialize_if_necessary() followed by bf_register_vector_counts().
+    BasicBlock* bblock = BasicBlock::Create(globctx, "entry", func);
+    ReturnInst* ret_inst = ReturnInst::Create(globctx, bblock);
+    callinst_create(init_if_necessary, ret_inst);
+    vector<Value*> arg_list;
+    arg_list.push_back(counts_ptr);
+    arg_list.push_back(ConstantExpr::getBitCast(info_var, Type::getInt8PtrTy(globctx)));
+    arg_list.push_back(ConstantInt::get(globctx, APInt(64, vector_infos.size())));
+    callinst_create(register_vector_counts, arg_list, ret_inst);
+  }
+
   // Initialize the BytesFlops pass.
   bool BytesFlops::doInitialization(Module& module) {
     // Inject external declarations to various variables defined in byfl.c.
@@ -182,6 +406,10 @@ namespace bytesflops_pass {
     op_var          = declare_global_var(module, i64type, "bf_op_count");
     op_bits_var     = declare_global_var(module, i64type, "bf_op_bits_count");
     call_inst_var   = declare_global_var(module, i64type, "bf_call_ins_count");
+    if (ShadowMemory) {
+      shadow_base_var   = declare_global_var(module, i64type, "bf_shadow_base");
+      shadow_unique_var = declare_global_var(module, i64type, "bf_shadow_unique");
+    }
 
     // bf_inst_deps_histo is a bit tricky because it's a 3D array.
     ArrayType* i64array1Dtype = ArrayType::get(i64type, 2);
@@ -255,6 +483,27 @@ namespace bytesflops_pass {
     // Assign a value to bf_unique_bytes.
     create_global_constant(module, "bf_unique_bytes", bool(TrackUniqueBytes) || bool(FindMemFootprint));
 
+    // Assign a value to bf_shadow_mem.
+    create_global_constant(module, "bf_shadow_mem", bool(ShadowMemory));
+
+    // Assign a value to bf_unique_approx.
+    if (TrackUniqueBytes == UB_APPROX && FindMemFootprint)
+      report_fatal_error("-bf-unique-bytes=approx is not allowed in conjunction with -bf-mem-footprint");
+    if (TrackUniqueBytes == UB_APPROX && ShadowMemory)
+      report_fatal_error("-bf-unique-bytes=approx is not allowed in conjunction with -bf-shadow-mem");
+    create_global_constant(module, "bf_unique_approx", TrackUniqueBytes == UB_APPROX);
+
+    // Assign a value to bf_unique_granularity.
+    uint64_t granularity = 1;
+    if (UniqueGranularity == UG_WORD)
+      granularity = module.getDataLayout().getPointerSize();
+    else if (UniqueGranularity == UG_LINE) {
+      if ((CacheLineBytes & (CacheLineBytes - 1)) != 0)
+        report_fatal_error("-bf-unique-granularity=line requires -bf-line-size to be a power of two");
+      granularity = uint64_t(CacheLineBytes);
+    }
+    create_global_constant(module, "bf_unique_granularity", granularity);
+
     // Assign a value to bf_vectors.
     create_global_constant(module, "bf_vectors", bool(TallyVectors));
 
@@ -264,6 +513,9 @@ namespace bytesflops_pass {
     // Assign a value to bf_strides.
     create_global_constant(module, "bf_strides", bool(TrackStrides));
 
+    // Assign a value to bf_thread_safe.
+    create_global_constant(module, "bf_thread_safe", bool(ThreadSafety));
+
     // Assign a value to bf_max_reuse_dist.
     create_global_constant(module, "bf_max_reuse_distance", uint64_t(MaxReuseDist));
 
@@ -273,6 +525,30 @@ namespace bytesflops_pass {
     // Assign a value to bf_line_size.
     create_global_constant(module, "bf_line_size", uint64_t(CacheLineBytes));
 
+    // Assign values to bf_epoch_ops and bf_epoch_ms.
+    if (EpochOps > 0 && EpochMs > 0)
+      report_fatal_error("-bf-epoch-ops and -bf-epoch-ms are mutually exclusive");
+    create_global_constant(module, "bf_epoch_ops", uint64_t(EpochOps));
+    create_global_constant(module, "bf_epoch_ms", uint64_t(EpochMs));
+
+    // Assign values to bf_heap_events and bf_heap_ms.
+    if (HeapEvents > 0 && HeapMs > 0)
+      report_fatal_error("-bf-heap-events and -bf-heap-ms are mutually exclusive");
+    if ((HeapEvents > 0 || HeapMs > 0) && !TallyByDataStruct)
+      report_fatal_error("-bf-heap-events and -bf-heap-ms are allowed only in conjunction with -bf-data-structs");
+    create_global_constant(module, "bf_heap_events", uint64_t(HeapEvents));
+    create_global_constant(module, "bf_heap_ms", uint64_t(HeapMs));
+
+    // Assign a value to bf_alloc_context.
+    if (AllocContext > 0 && !TallyByDataStruct)
+      report_fatal_error("-bf-alloc-context is allowed only in conjunction with -bf-data-structs");
+    create_global_constant(module, "bf_alloc_context", uint64_t(AllocContext));
+
+    // Ensure that edge profiling is used only when all counters are tallied
+    // by the program as a whole.
+    if (EdgeProfile && (TallyByFunction || InstrumentEveryBB || ThreadSafety))
+      report_fatal_error("-bf-edge-profile is not allowed in conjunction with -bf-by-func, -bf-every-bb, or -bf-thread-safe");
+
     // Assign a value to bf_max_sets.
     create_global_constant(module, "bf_max_set_bits", uint64_t(CacheMaxSetBits));
 
@@ -311,7 +587,7 @@ namespace bytesflops_pass {
 
     // Inject external declarations for bf_accumulate_bb_tallies(),
     // bf_reset_bb_tallies(), bf_report_bb_tallies(), and
-    // bf_tally_bb_execution().
+    // bf_register_bb_counts().
     if (InstrumentEveryBB) {
       // Declare the zero-argument functions first.
       accum_bb_tallies = declare_thunk(&module, "bf_accumulate_bb_tallies");
@@ -325,15 +601,34 @@ namespace bytesflops_pass {
       report_bb_tallies =
         declare_extern_c(void_func_result, "bf_report_bb_tallies", &module);
 
-      // Declare bf_tally_bb_execution().
+      // Define a pointer to the module's basic-block execution counters.
+      // The counters themselves are allocated once we know how many basic
+      // blocks the module contains.
+      bb_counts_var =
+        new GlobalVariable(module, i64ptrtype, false,
+                           GlobalValue::InternalLinkage,
+                           ConstantPointerNull::get(i64ptrtype),
+                           "bf_bb_counts");
+      bb_infos.clear();
+
+      // Declare the bf_bb_info_t type.
+      bb_info_type = module.getTypeByName("struct.bf_bb_info_t");
+      if (bb_info_type == nullptr) {
+        vector<Type*> fields;
+        fields.push_back(ptr_to_syminfo_arg);
+        fields.push_back(uint64_arg);
+        bb_info_type = StructType::create(globctx, fields, "struct.bf_bb_info_t");
+      }
+
+      // Declare bf_register_bb_counts().
       func_args.clear();
-      func_args.push_back(ptr_to_syminfo_arg);
-      func_args.push_back(uint64_arg);
+      func_args.push_back(i64ptrtype);
+      func_args.push_back(ptr_to_char_arg);
       func_args.push_back(uint64_arg);
       void_func_result =
         FunctionType::get(Type::getVoidTy(globctx), func_args, false);
-      tally_bb_exec =
-        declare_extern_c(void_func_result, "bf_tally_bb_execution", &module);
+      register_bb_counts =
+        declare_extern_c(void_func_result, "bf_register_bb_counts", &module);
     }
 
     // Inject an external declarations for bf_increment_func_tally().
@@ -384,6 +679,7 @@ namespace bytesflops_pass {
 
     // Declare bf_tally_vector_operation() only if we were asked
     // to track vector operations.
+    vector_counts_var = nullptr;
     if (TallyVectors) {
       vector<Type*> all_function_args;
       all_function_args.push_back(ptr_to_char_arg);
@@ -396,6 +692,45 @@ namespace bytesflops_pass {
         declare_extern_c(void_func_result,
                          "bf_tally_vector_operation",
                          &module);
+
+      // Vector operations are normally tallied in a module-level counter
+      // array, one slot per distinct function and vector type.  Call-stack
+      // names and user-defined partitions are known only at run time,
+      // however, so in those cases we call bf_tally_vector_operation()
+      // instead.
+      if (!TrackCallStack && !InstrumentEveryBB) {
+        // Define a pointer to the module's vector-operation counters.  The
+        // counters themselves are allocated once we know how many distinct
+        // vector types the module uses.
+        vector_counts_var =
+          new GlobalVariable(module, i64ptrtype, false,
+                             GlobalValue::InternalLinkage,
+                             ConstantPointerNull::get(i64ptrtype),
+                             "bf_vector_counts");
+        vector_infos.clear();
+        vector_slots.clear();
+
+        // Declare the bf_vector_info_t type.
+        vector_info_type = module.getTypeByName("struct.bf_vector_info_t");
+        if (vector_info_type == nullptr) {
+          vector<Type*> fields;
+          fields.push_back(ptr_to_char_arg);
+          fields.push_back(uint64_arg);
+          fields.push_back(uint64_arg);
+          fields.push_back(uint8_arg);
+          vector_info_type = StructType::create(globctx, fields, "struct.bf_vector_info_t");
+        }
+
+        // Declare bf_register_vector_counts().
+        vector<Type*> func_args;
+        func_args.push_back(i64ptrtype);
+        func_args.push_back(ptr_to_char_arg);
+        func_args.push_back(uint64_arg);
+        void_func_result =
+          FunctionType::get(Type::getVoidTy(globctx), func_args, false);
+        register_vector_counts =
+          declare_extern_c(void_func_result, "bf_register_vector_counts", &module);
+      }
     }
 
     // Inject external declarations for bf_assoc_addresses_with_prog()
@@ -533,7 +868,29 @@ namespace bytesflops_pass {
     if (TrackStrides) {
       vector<Type*> all_function_args;
       FunctionType* void_func_result;
+
+      // Define a pointer to a table with one slot per call point.  The
+      // table itself is allocated statically at finalization time, once the
+      // number of call points is known, and bf_track_stride() indexes it
+      // directly.
+      PointerType* ptr_to_ptr_to_char = PointerType::get(ptr_to_char_arg, 0);
+      stride_table_var =
+        new GlobalVariable(module, ptr_to_ptr_to_char, false,
+                           GlobalValue::InternalLinkage,
+                           ConstantPointerNull::get(ptr_to_ptr_to_char),
+                           "bf_stride_table");
+      num_stride_slots = 0;
+      all_function_args.push_back(ptr_to_ptr_to_char);
+      all_function_args.push_back(uint64_arg);
+      void_func_result =
+        FunctionType::get(Type::getVoidTy(globctx), all_function_args, false);
+      register_stride_table =
+        declare_extern_c(void_func_result, "bf_register_stride_table", &module);
+
+      // Declare bf_track_stride() itself.
       all_function_args.clear();
+      all_function_args.push_back(stride_table_var->getType());
+      all_function_args.push_back(uint64_arg);
       all_function_args.push_back(ptr_to_syminfo_arg);
       all_function_args.push_back(uint64_arg);
       all_function_args.push_back(uint64_arg);
@@ -542,6 +899,85 @@ namespace bytesflops_pass {
       void_func_result =
         FunctionType::get(Type::getVoidTy(globctx), all_function_args, false);
       track_stride = declare_extern_c(void_func_result, "bf_track_stride", &module);
+
+      // Declare bf_track_stride_loop(), which tallies all of a loop's
+      // statically determined strides for a single call point at once.
+      all_function_args.clear();
+      all_function_args.push_back(stride_table_var->getType());
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(ptr_to_syminfo_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint8_arg);
+      all_function_args.push_back(uint8_arg);
+      void_func_result =
+        FunctionType::get(Type::getVoidTy(globctx), all_function_args, false);
+      track_stride_loop = declare_extern_c(void_func_result, "bf_track_stride_loop", &module);
+    }
+
+    // Declare bf_register_edge_profile() only if we were asked to count
+    // control-flow edges.
+    if (EdgeProfile) {
+      // Define a pointer to the module's edge counters.  The counters
+      // themselves are allocated once we know how many edges the module
+      // counts.
+      edge_counts_var =
+        new GlobalVariable(module, i64ptrtype, false,
+                           GlobalValue::InternalLinkage,
+                           ConstantPointerNull::get(i64ptrtype),
+                           "bf_edge_counts");
+      num_edge_counters = 0;
+      num_profile_points = 0;
+      edge_terms.clear();
+      edge_tallies.clear();
+
+      // Declare the bf_edge_term_t and bf_edge_tally_t types.
+      edge_term_type = module.getTypeByName("struct.bf_edge_term_t");
+      if (edge_term_type == nullptr) {
+        vector<Type*> fields;
+        fields.push_back(uint64_arg);
+        fields.push_back(uint64_arg);
+        fields.push_back(uint64_arg);
+        edge_term_type = StructType::create(globctx, fields, "struct.bf_edge_term_t");
+      }
+      edge_tally_type = module.getTypeByName("struct.bf_edge_tally_t");
+      if (edge_tally_type == nullptr) {
+        vector<Type*> fields;
+        fields.push_back(ptr_to_char_arg);
+        fields.push_back(uint64_arg);
+        fields.push_back(uint64_arg);
+        fields.push_back(uint64_arg);
+        fields.push_back(uint64_arg);
+        edge_tally_type = StructType::create(globctx, fields, "struct.bf_edge_tally_t");
+      }
+
+      // Declare bf_register_edge_profile() itself.
+      vector<Type*> all_function_args;
+      all_function_args.push_back(i64ptrtype);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(ptr_to_char_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(ptr_to_char_arg);
+      all_function_args.push_back(uint64_arg);
+      FunctionType* void_func_result =
+        FunctionType::get(Type::getVoidTy(globctx), all_function_args, false);
+      register_edge_profile =
+        declare_extern_c(void_func_result, "bf_register_edge_profile", &module);
+    }
+
+    // Declare bf_touch_working_set() only if we were asked to track the
+    // working set over time.
+    if (EpochOps > 0 || EpochMs > 0) {
+      vector<Type*> all_function_args;
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint64_arg);
+      FunctionType* void_func_result =
+        FunctionType::get(Type::getVoidTy(globctx), all_function_args, false);
+      touch_working_set =
+        declare_extern_c(void_func_result, "bf_touch_working_set", &module);
     }
 
     // Inject an external declaration for llvm.memset.p0i8.i64().
@@ -579,6 +1015,24 @@ namespace bytesflops_pass {
                          &module);
     }
 
+    // Inject an external declaration for bf_access_data_struct_locality() if
+    // we need to attribute cache-model or reuse-distance results to data
+    // structures.
+    if (TallyByDataStruct && (CacheModel || rd_bits > 0)) {
+      vector<Type*> all_function_args;
+      all_function_args.push_back(ptr_to_syminfo_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint64_arg);
+      all_function_args.push_back(uint8_arg);
+      all_function_args.push_back(uint8_arg);
+      FunctionType* void_func_result =
+        FunctionType::get(Type::getVoidTy(globctx), all_function_args, false);
+      access_data_struct_locality =
+        declare_extern_c(void_func_result,
+                         "bf_access_data_struct_locality",
+                         &module);
+    }
+
     // Inject external declarations for bf_acquire_mega_lock() and
     // bf_release_mega_lock().
     if (ThreadSafety) {
@@ -603,6 +1057,22 @@ namespace bytesflops_pass {
 
   char BytesFlops::ID = 0;
 
+  // Request only the analyses needed by the options we were given: loop
+  // information for static strides, hoisted loops, and edge profiling, plus
+  // scalar evolution for the first two and dominators for the first.  These
+  // conditions must match those in runOnFunction().
+  void BytesFlops::getAnalysisUsage(AnalysisUsage& usage) const {
+    bool static_strides = TrackStrides && !DynamicStrides && !ThreadSafety;
+    bool hoist_loops = HoistLoops && !EdgeProfile && !InstrumentEveryBB && !ThreadSafety;
+    if (static_strides)
+      usage.addRequired<DominatorTreeWrapperPass>();
+    if (static_strides || hoist_loops || EdgeProfile)
+      usage.addRequired<LoopInfoWrapperPass>();
+    if (static_strides || hoist_loops)
+      usage.addRequired<ScalarEvolutionWrapperPass>();
+    usage.setPreservesCFG();
+  }
+
   // Insert code for incrementing our byte, flop, etc. counters.
   bool BytesFlops::runOnFunction(Function& function) {
     // Do nothing if we're supposed to ignore this function.
@@ -622,7 +1092,10 @@ namespace bytesflops_pass {
       // to instrument bf_categorize_counters() using
       // bf_categorize_counters().
       return false;
-    if (function_name == "bf_func_key_map_ctor" || function_name == "bf_track_global_vars_ctor")
+    if (function_name == "bf_func_key_map_ctor" || function_name == "bf_track_global_vars_ctor"
+        || function_name == "bf_stride_table_ctor" || function_name == "bf_edge_profile_ctor"
+        || function_name == "bf_bb_counts_ctor"
+        || function_name == "bf_vector_counts_ctor")
       // Ignore other Byfl-defined functions, too.
       return false;
     if (function_name == "_Znwm" || function_name == "_ZdlPv" || function_name == "_ZdaPv")
@@ -645,9 +1118,37 @@ namespace bytesflops_pass {
     // string.
     map_instructions_to_strings(function);
 
-    // Instrument "interesting" instructions in every basic block.
+    // Find strides that can be tallied once per loop instead of on every
+    // access.  This must be done before the function is modified.
     Module* module = function.getParent();
+    static_strides.clear();
+    if (TrackStrides && !DynamicStrides && !ThreadSafety)
+      find_static_strides(function);
+
+    // Find loops whose counters can be tallied once per loop execution
+    // instead of on every iteration.
+    hoisted_loops.clear();
+    current_hoist = nullptr;
+    deferred_tallies = nullptr;
+    if (HoistLoops && !EdgeProfile && !InstrumentEveryBB && !ThreadSafety)
+      find_hoistable_loops(function);
+
+    // Count control-flow edges instead of updating counters in every basic
+    // block if we were asked to and the function's control flow allows it.
+    profiled_blocks.clear();
+    profiled_branches.clear();
+    if (EdgeProfile)
+      place_edge_counters(function);
+
+    // Instrument "interesting" instructions in every basic block.
     instrument_entire_function(module, function, function_name);
+    if (!static_strides.empty())
+      insert_static_stride_calls(module);
+    for (auto hl_iter = hoisted_loops.begin(); hl_iter != hoisted_loops.end(); hl_iter++) {
+      hoisted_loop_t& info = hl_iter->second;
+      BasicBlock::iterator insert_before = info.exit_bb->getFirstInsertionPt();
+      insert_deferred_increments(info.tallies, info.trip_count, insert_before);
+    }
 
     // Return, indicating that we modified this function.
     return true;
@@ -188,7 +188,8 @@ namespace bytesflops_pass {
     CastInst* mem_addr = nullptr;
     Value* mem_ptr = nullptr;
     if (TrackUniqueBytes || FindMemFootprint || rd_bits > 0 ||
-        TallyByDataStruct || TrackStrides || CacheModel) {
+        TallyByDataStruct || TrackStrides || CacheModel ||
+        EpochOps > 0 || EpochMs > 0) {
       mem_ptr =
         opcode == Instruction::Load
         ? cast<LoadInst>(inst).getPointerOperand()
@@ -211,25 +212,55 @@ namespace bytesflops_pass {
         callinst_create(assoc_addrs_with_func, arg_list, &*insert_before);
       }
 
-      // Unconditionally insert a call to bf_assoc_addresses_with_prog().
+      // Unconditionally insert a call to bf_assoc_addresses_with_prog().  As
+      // an optimization, with -bf-shadow-mem, update the shadow bitmap inline
+      // instead.  The inline code assumes a little-endian target and no
+      // concurrent updates.
+      if (ShadowMemory && !FindMemFootprint && !ThreadSafety
+          && byte_count <= 8 && target_data.isLittleEndian())
+        insert_shadow_update(module, insert_before, mem_addr, byte_count);
+      else {
+        vector<Value*> arg_list;
+        arg_list.push_back(mem_addr);
+        arg_list.push_back(num_bytes);
+        callinst_create(assoc_addrs_with_prog, arg_list, &*insert_before);
+      }
+    }
+
+    // Determine if the cache model and the reuse-distance tracker should see
+    // this access via bf_access_data_struct_locality(), which attributes
+    // their results to the data structure being accessed, instead of via
+    // their usual calls at the end of the basic block.
+    bool track_reuse =
+      (opcode == Instruction::Load && (rd_bits&(1<<RD_LOADS)) != 0)
+      || (opcode == Instruction::Store && (rd_bits&(1<<RD_STORES)) != 0);
+    uint8_t locality = 0;
+    if (TallyByDataStruct) {
+      if (CacheModel)
+        locality |= BF_LOCALITY_CACHE;
+      if (track_reuse)
+        locality |= BF_LOCALITY_REUSE;
+    }
+
+    // If requested by the user, insert a call to bf_touch_cache().
+    if (CacheModel && (locality&BF_LOCALITY_CACHE) == 0) {
       vector<Value*> arg_list;
       arg_list.push_back(mem_addr);
       arg_list.push_back(num_bytes);
-      callinst_create(assoc_addrs_with_prog, arg_list, &*insert_before);
+      callinst_create(access_cache, arg_list, &*insert_before);
     }
 
-    // If requested by the user, insert a call to bf_touch_cache().
-    if (CacheModel) {
+    // If requested by the user, insert a call to bf_touch_working_set().
+    if (EpochOps > 0 || EpochMs > 0) {
       vector<Value*> arg_list;
       arg_list.push_back(mem_addr);
       arg_list.push_back(num_bytes);
-      callinst_create(access_cache, arg_list, &*insert_before);
+      callinst_create(touch_working_set, arg_list, &*insert_before);
     }
 
     // If requested by the user, also insert a call to
     // bf_reuse_dist_addrs_prog().
-    if ((opcode == Instruction::Load && (rd_bits&(1<<RD_LOADS)) != 0)
-        || (opcode == Instruction::Store && (rd_bits&(1<<RD_STORES)) != 0)) {
+    if (track_reuse && (locality&BF_LOCALITY_REUSE) == 0) {
       vector<Value*> arg_list;
       arg_list.push_back(mem_addr);
       arg_list.push_back(num_bytes);
@@ -237,12 +268,16 @@ namespace bytesflops_pass {
     }
 
     // If requested by the user, also insert a call to bf_track_stride().
-    if (TrackStrides) {
+    // Strides that were determined statically are instead tallied when the
+    // loop exits.
+    if (TrackStrides && static_strides.find(&inst) == static_strides.end()) {
       vector<Value*> arg_list;
       func_syminfo =
         find_value_provenance(*module, &inst, inst_to_string(&inst), insert_before, func_syminfo);
       uint8_t load0store1 = opcode == Instruction::Load ? 0 : 1;
       uint8_t is_const = all_constant_refs(&inst);
+      arg_list.push_back(stride_table_var);
+      arg_list.push_back(ConstantInt::get(bbctx, APInt(64, num_stride_slots++)));
       arg_list.push_back(func_syminfo);
       arg_list.push_back(mem_addr);
       arg_list.push_back(num_bytes);
@@ -251,17 +286,14 @@ namespace bytesflops_pass {
       callinst_create(track_stride, arg_list, &*insert_before);
     }
 
-    // If requested by the user, insert a call to bf_access_data_struct().
+    // If requested by the user, insert a call to bf_access_data_struct() or
+    // bf_access_data_struct_locality().
     if (TallyByDataStruct) {
       // We can't delay instrumentation to the end of the basic block.  We have
       // to do it now in case the data are about to be deallocated.
       BasicBlock::iterator insert_post_ls = iter;
       insert_post_ls++;
 
-      // Acquire the mega-lock before inserting any instrumentation code.
-      if (ThreadSafety)
-        callinst_create(take_mega_lock, &*insert_post_ls);
-
       // Instrument the load or store.
       uint8_t load0store1 = opcode == Instruction::Load ? 0 : 1;
       vector<Value*> arg_list;
@@ -274,11 +306,12 @@ namespace bytesflops_pass {
       arg_list.push_back(imm_mem_addr);
       arg_list.push_back(num_bytes);
       arg_list.push_back(ConstantInt::get(bbctx, APInt(8, load0store1)));
-      callinst_create(access_data_struct, arg_list, &*insert_post_ls);
-
-      // Release the mega-lock.
-      if (ThreadSafety)
-        callinst_create(release_mega_lock, &*insert_post_ls);
+      if (locality == 0)
+        callinst_create(access_data_struct, arg_list, &*insert_post_ls);
+      else {
+        arg_list.push_back(ConstantInt::get(bbctx, APInt(8, locality)));
+        callinst_create(access_data_struct_locality, arg_list, &*insert_post_ls);
+      }
 
       // Advance the iterator to the last piece of code we inserted.  The
       // invoking loop will then advance it again.
@@ -339,10 +372,6 @@ namespace bytesflops_pass {
           BasicBlock::iterator insert_post_mem = iter;
           insert_post_mem++;
 
-          // Acquire the mega-lock before inserting any instrumentation code.
-          if (ThreadSafety)
-            callinst_create(take_mega_lock, &*insert_post_mem);
-
           // A memory set is treated as a store.
           vector<Value*> arg_list;
           CastInst* mem_addr =
@@ -358,10 +387,6 @@ namespace bytesflops_pass {
           arg_list.push_back(ConstantInt::get(globctx, APInt(8, 1)));
           callinst_create(access_data_struct, arg_list, &*insert_post_mem);
 
-          // Release the mega-lock.
-          if (ThreadSafety)
-            callinst_create(release_mega_lock, &*insert_post_mem);
-
           // Advance the iterator to the last piece of code we inserted.  The
           // invoking loop will then advance it again.
           iter = insert_post_mem;
@@ -381,10 +406,6 @@ namespace bytesflops_pass {
           BasicBlock::iterator insert_post_mem = iter;
           insert_post_mem++;
 
-          // Acquire the mega-lock before inserting any instrumentation code.
-          if (ThreadSafety)
-            callinst_create(take_mega_lock, &*insert_post_mem);
-
           // A memory transfer is treated as a load...
           vector<Value*> arg_list;
           CastInst* mem_addr =
@@ -413,10 +434,6 @@ namespace bytesflops_pass {
           arg_list.push_back(ConstantInt::get(globctx, APInt(8, 1)));
           callinst_create(access_data_struct, arg_list, &*insert_post_mem);
 
-          // Release the mega-lock.
-          if (ThreadSafety)
-            callinst_create(release_mega_lock, &*insert_post_mem);
-
           // Advance the iterator to the last piece of code we inserted.  The
           // invoking loop will then advance it again.
           iter = insert_post_mem;
@@ -452,10 +469,6 @@ namespace bytesflops_pass {
       BasicBlock::iterator insert_post_call = iter;
       insert_post_call++;
 
-      // Acquire the mega-lock before inserting any instrumentation code.
-      if (ThreadSafety)
-        callinst_create(take_mega_lock, &*insert_post_call);
-
       // Determine the number of bytes we allocated.
       unsigned int num_args = call_inst->getNumArgOperands();
       Value* byte_count = nullptr;       // Number of bytes allocated
@@ -525,10 +538,6 @@ namespace bytesflops_pass {
         callinst_create(disassoc_addrs_with_dstruct, arg_list, &*insert_post_call);
       }
 
-      // Release the mega-lock.
-      if (ThreadSafety)
-        callinst_create(release_mega_lock, &*insert_post_call);
-
       // Advance the iterator to the last piece of code we inserted.  The
       // invoking loop will then advance it again.
       iter = insert_post_call;
@@ -614,10 +623,6 @@ namespace bytesflops_pass {
         BasicBlock::iterator insert_post_alloca = iter;
         insert_post_alloca++;
 
-        // Acquire the mega-lock before inserting any instrumentation code.
-        if (ThreadSafety)
-          callinst_create(take_mega_lock, &*insert_post_alloca);
-
         // Determine the number of bytes allocated.
         Type* alloc_type = ainst.getAllocatedType();
         const DataLayout& target_data = module->getDataLayout();
@@ -646,10 +651,6 @@ namespace bytesflops_pass {
         arg_list.push_back(bytes_alloced);
         callinst_create(assoc_addrs_with_dstruct_stack, arg_list, &*insert_post_alloca);
 
-        // Release the mega-lock.
-        if (ThreadSafety)
-          callinst_create(release_mega_lock, &*insert_post_alloca);
-
         // Advance the iterator to the last piece of code we inserted.  The
         // invoking loop will then advance it again.
         iter = insert_post_alloca;
@@ -780,19 +781,264 @@ namespace bytesflops_pass {
           // Ignore mixed scalar/vector operations.
           break;
 
-        // Tally this vector operation.
-        vector<Value*> arg_list;
+        // Characterize this vector operation.
         uint64_t elt_count = vt->getNumElements();
-        uint64_t total_bits = instType->getPrimitiveSizeInBits();
-        arg_list.push_back(map_func_name_to_arg(module, function_name));
-        arg_list.push_back(get_vector_length(bbctx, vt, one));
-        arg_list.push_back(ConstantInt::get(bbctx, APInt(64, total_bits/elt_count)));
-        arg_list.push_back(ConstantInt::get(bbctx, APInt(8, 1)));
-        callinst_create(tally_vector, arg_list, &*insert_before);
+        uint64_t elt_bits = instType->getPrimitiveSizeInBits()/elt_count;
+        if (vector_counts_var == nullptr) {
+          // The function name or partition is known only at run time.
+          // Tally this vector operation dynamically.
+          vector<Value*> arg_list;
+          arg_list.push_back(map_func_name_to_arg(module, function_name));
+          arg_list.push_back(get_vector_length(bbctx, vt, one));
+          arg_list.push_back(ConstantInt::get(bbctx, APInt(64, elt_bits)));
+          arg_list.push_back(ConstantInt::get(bbctx, APInt(8, tally_fp)));
+          callinst_create(tally_vector, arg_list, &*insert_before);
+          break;
+        }
+
+        // Find or assign the counter slot for this function and vector type,
+        // and increment it.
+        string slot_func = TallyByFunction ? function_name.str() : string("");
+        auto slot_key = std::make_tuple(slot_func, elt_count, elt_bits, tally_fp);
+        auto slot_iter = vector_slots.find(slot_key);
+        uint64_t slot;
+        if (slot_iter == vector_slots.end()) {
+          slot = vector_infos.size();
+          vector_slots[slot_key] = slot;
+          vector<Constant*> info_fields;
+          info_fields.push_back(map_func_name_to_arg(module, slot_func));
+          info_fields.push_back(ConstantInt::get(bbctx, APInt(64, elt_count)));
+          info_fields.push_back(ConstantInt::get(bbctx, APInt(64, elt_bits)));
+          info_fields.push_back(ConstantInt::get(bbctx, APInt(8, tally_fp)));
+          vector_infos.push_back(ConstantStruct::get(vector_info_type, info_fields));
+        }
+        else
+          slot = slot_iter->second;
+        increment_global_array(insert_before, vector_counts_var,
+                               ConstantInt::get(bbctx, APInt(64, slot)), one);
       }
       while (0);
   }
 
+  // Return true if a loop contains no calls, which may reenter the function or
+  // never return, and no blocks that leave the function directly.
+  static bool loop_is_call_free(Loop* loop) {
+    for (auto bb_iter = loop->block_begin(); bb_iter != loop->block_end(); bb_iter++) {
+      BasicBlock* bb = *bb_iter;
+      if (bb->getTerminator()->getNumSuccessors() == 0)
+        return false;
+      for (auto inst_iter = bb->begin(); inst_iter != bb->end(); inst_iter++)
+        if ((isa<CallInst>(*inst_iter) || isa<InvokeInst>(*inst_iter))
+            && !isa<IntrinsicInst>(*inst_iter))
+          return false;
+    }
+    return true;
+  }
+
+  // Find all loads and stores in a function whose strides can be determined
+  // statically.  These are accesses that execute exactly once per iteration of
+  // a call-free loop with a single exit and a computable trip count and whose
+  // address either is loop-invariant or advances by a constant stride.
+  void BytesFlops::find_static_strides(Function& function) {
+    DominatorTree& dom_tree =
+      getAnalysis<DominatorTreeWrapperPass>(function).getDomTree();
+    LoopInfo& loop_info = getAnalysis<LoopInfoWrapperPass>(function).getLoopInfo();
+    ScalarEvolution& scev = getAnalysis<ScalarEvolutionWrapperPass>(function).getSE();
+    const DataLayout& target_data = function.getParent()->getDataLayout();
+    IntegerType* i64type = Type::getInt64Ty(function.getContext());
+    SCEVExpander expander(scev, target_data, "bf_stride");
+
+    // Remember the function's original instructions so we can later mark as
+    // Byfl-inserted everything the SCEV expander adds.
+    set<Instruction*> orig_insts;
+    for (auto inst_iter = inst_begin(function); inst_iter != inst_end(function); inst_iter++)
+      orig_insts.insert(&*inst_iter);
+
+    // Gather all loops, including nested loops.
+    vector<Loop*> all_loops(loop_info.begin(), loop_info.end());
+    for (size_t i = 0; i < all_loops.size(); i++) {
+      Loop* loop = all_loops[i];
+      all_loops.insert(all_loops.end(), loop->begin(), loop->end());
+    }
+
+    // Consider each loop in turn.
+    for (auto loop_iter = all_loops.begin(); loop_iter != all_loops.end(); loop_iter++) {
+      // Ensure the loop has a preheader in which to compute its trip count
+      // and a single exit, taken from the latch, in which to tally strides.
+      Loop* loop = *loop_iter;
+      BasicBlock* preheader = loop->getLoopPreheader();
+      BasicBlock* latch = loop->getLoopLatch();
+      BasicBlock* exit_bb = loop->getExitBlock();
+      if (preheader == nullptr || latch == nullptr || exit_bb == nullptr
+          || loop->getExitingBlock() != latch
+          || exit_bb->getSinglePredecessor() != latch)
+        continue;
+
+      // Reject loops that contain calls or that leave the function directly.
+      if (!loop_is_call_free(loop))
+        continue;
+
+      // Ensure the trip count can be computed before the loop is entered.
+      const SCEV* taken_count = scev.getBackedgeTakenCount(loop);
+      if (isa<SCEVCouldNotCompute>(taken_count) || !isSafeToExpand(taken_count, scev))
+        continue;
+      Instruction* insert_before = preheader->getTerminator();
+      Value* trip_count = nullptr;
+
+      // Consider every load and store that executes exactly once per
+      // iteration, that is, that lies in the loop proper (not a subloop) in a
+      // block that dominates the latch.
+      for (auto bb_iter = loop->block_begin(); bb_iter != loop->block_end(); bb_iter++) {
+        BasicBlock* bb = *bb_iter;
+        if (loop_info.getLoopFor(bb) != loop || !dom_tree.dominates(bb, latch))
+          continue;
+        for (auto inst_iter = bb->begin(); inst_iter != bb->end(); inst_iter++) {
+          Instruction& inst = *inst_iter;
+          Value* mem_ptr;
+          if (isa<LoadInst>(inst))
+            mem_ptr = cast<LoadInst>(inst).getPointerOperand();
+          else if (isa<StoreInst>(inst))
+            mem_ptr = cast<StoreInst>(inst).getPointerOperand();
+          else
+            continue;
+
+          // Determine the address of the first access and the stride between
+          // accesses.
+          const SCEV* addr = scev.getSCEV(mem_ptr);
+          const SCEV* first_addr;
+          int64_t stride;
+          if (scev.isLoopInvariant(addr, loop)) {
+            first_addr = addr;
+            stride = 0;
+          }
+          else {
+            const SCEVAddRecExpr* rec = dyn_cast<SCEVAddRecExpr>(addr);
+            if (rec == nullptr || rec->getLoop() != loop || !rec->isAffine())
+              continue;
+            const SCEVConstant* step = dyn_cast<SCEVConstant>(rec->getStepRecurrence(scev));
+            if (step == nullptr)
+              continue;
+            first_addr = rec->getStart();
+            stride = step->getAPInt().getSExtValue();
+          }
+          if (!isSafeToExpand(first_addr, scev))
+            continue;
+
+          // Compute the first address and the trip count in the preheader.
+          if (trip_count == nullptr) {
+            const SCEV* num_trips =
+              scev.getAddExpr(scev.getTruncateOrZeroExtend(taken_count, i64type),
+                              scev.getConstant(i64type, 1));
+            trip_count = expander.expandCodeFor(num_trips, i64type, insert_before);
+          }
+          Value* first_ptr =
+            expander.expandCodeFor(first_addr, first_addr->getType(), insert_before);
+          static_stride_t info;
+          info.first_addr = new PtrToIntInst(first_ptr, i64type, "", insert_before);
+          info.trip_count = trip_count;
+          info.stride = stride;
+          info.exit_bb = exit_bb;
+          static_strides[&inst] = info;
+        }
+      }
+    }
+
+    // Prevent the code we just added from being instrumented.
+    for (auto inst_iter = inst_begin(function); inst_iter != inst_end(function); inst_iter++)
+      if (orig_insts.find(&*inst_iter) == orig_insts.end())
+        mark_as_byfl(&*inst_iter);
+  }
+
+  // Tally statically determined strides upon exiting their loops by inserting
+  // one call to bf_track_stride_loop() per load or store.
+  void BytesFlops::insert_static_stride_calls(Module* module) {
+    const DataLayout& target_data = module->getDataLayout();
+    for (auto ss_iter = static_strides.begin(); ss_iter != static_strides.end(); ss_iter++) {
+      Instruction* inst = ss_iter->first;
+      const static_stride_t& info = ss_iter->second;
+      LLVMContext& ctx = inst->getContext();
+      unsigned int opcode = inst->getOpcode();
+      Value* mem_value = opcode == Instruction::Load ? inst : cast<StoreInst>(inst)->getValueOperand();
+      uint64_t byte_count = target_data.getTypeStoreSize(mem_value->getType());
+      BasicBlock::iterator insert_before = info.exit_bb->getFirstInsertionPt();
+      func_syminfo =
+        find_value_provenance(*module, inst, inst_to_string(inst), insert_before, func_syminfo);
+      uint8_t load0store1 = opcode == Instruction::Load ? 0 : 1;
+      uint8_t is_const = all_constant_refs(inst);
+      vector<Value*> arg_list;
+      arg_list.push_back(stride_table_var);
+      arg_list.push_back(ConstantInt::get(ctx, APInt(64, num_stride_slots++)));
+      arg_list.push_back(func_syminfo);
+      arg_list.push_back(info.first_addr);
+      arg_list.push_back(ConstantInt::get(ctx, APInt(64, uint64_t(info.stride))));
+      arg_list.push_back(info.trip_count);
+      arg_list.push_back(ConstantInt::get(ctx, APInt(64, byte_count)));
+      arg_list.push_back(ConstantInt::get(ctx, APInt(8, load0store1)));
+      arg_list.push_back(ConstantInt::get(ctx, APInt(8, is_const)));
+      callinst_create(track_stride_loop, arg_list, &*insert_before);
+    }
+  }
+
+  // Find all loops in a function whose counter increments can be hoisted to
+  // the loop exit.  These are innermost, call-free loops consisting of a
+  // single basic block that exits to a block of its own and that execute a
+  // number of times that can be computed before the loop is entered.
+  void BytesFlops::find_hoistable_loops(Function& function) {
+    LoopInfo& loop_info = getAnalysis<LoopInfoWrapperPass>(function).getLoopInfo();
+    ScalarEvolution& scev = getAnalysis<ScalarEvolutionWrapperPass>(function).getSE();
+    const DataLayout& target_data = function.getParent()->getDataLayout();
+    IntegerType* i64type = Type::getInt64Ty(function.getContext());
+    SCEVExpander expander(scev, target_data, "bf_hoist");
+
+    // Remember the function's original instructions so we can later mark as
+    // Byfl-inserted everything the SCEV expander adds.
+    set<Instruction*> orig_insts;
+    for (auto inst_iter = inst_begin(function); inst_iter != inst_end(function); inst_iter++)
+      orig_insts.insert(&*inst_iter);
+
+    // Gather all loops, including nested loops.
+    vector<Loop*> all_loops(loop_info.begin(), loop_info.end());
+    for (size_t i = 0; i < all_loops.size(); i++) {
+      Loop* loop = all_loops[i];
+      all_loops.insert(all_loops.end(), loop->begin(), loop->end());
+    }
+
+    // Consider each single-block loop in turn.
+    for (auto loop_iter = all_loops.begin(); loop_iter != all_loops.end(); loop_iter++) {
+      Loop* loop = *loop_iter;
+      if (!loop->getSubLoops().empty() || loop->getNumBlocks() != 1)
+        continue;
+      BasicBlock* bb = loop->getHeader();
+      BasicBlock* preheader = loop->getLoopPreheader();
+      BasicBlock* exit_bb = loop->getExitBlock();
+      BranchInst* br_inst = dyn_cast<BranchInst>(bb->getTerminator());
+      if (preheader == nullptr || exit_bb == nullptr
+          || exit_bb->getSinglePredecessor() != bb
+          || br_inst == nullptr || !br_inst->isConditional()
+          || !loop_is_call_free(loop))
+        continue;
+
+      // Compute the trip count in the preheader.
+      const SCEV* taken_count = scev.getBackedgeTakenCount(loop);
+      if (isa<SCEVCouldNotCompute>(taken_count) || !isSafeToExpand(taken_count, scev))
+        continue;
+      const SCEV* num_trips =
+        scev.getAddExpr(scev.getTruncateOrZeroExtend(taken_count, i64type),
+                        scev.getConstant(i64type, 1));
+      hoisted_loop_t& info = hoisted_loops[bb];
+      info.trip_count =
+        expander.expandCodeFor(num_trips, i64type, preheader->getTerminator());
+      info.exit_bb = exit_bb;
+      info.direct_increments = false;
+      info.must_clear = 0;
+    }
+
+    // Prevent the code we just added from being instrumented.
+    for (auto inst_iter = inst_begin(function); inst_iter != inst_end(function); inst_iter++)
+      if (orig_insts.find(&*inst_iter) == orig_insts.end())
+        mark_as_byfl(&*inst_iter);
+  }
+
   // Do most of the instrumentation work: Walk each instruction in
   // each basic block and add instrumentation code around loads,
   // stores, flops, etc.
@@ -842,12 +1088,24 @@ namespace bytesflops_pass {
       }
     }
 
+    // Order the basic blocks so that each hoisted loop is instrumented
+    // before its exit block, which must clear the counters the loop
+    // increments.
+    vector<BasicBlock*> bb_order;
+    set<BasicBlock*> bb_ordered;
+    for (auto func_iter = function.begin(); func_iter != function.end(); func_iter++) {
+      BasicBlock* bb = &*func_iter;
+      for (auto hl_iter = hoisted_loops.begin(); hl_iter != hoisted_loops.end(); hl_iter++)
+        if (hl_iter->second.exit_bb == bb && bb_ordered.insert(hl_iter->first).second)
+          bb_order.push_back(hl_iter->first);
+      if (bb_ordered.insert(bb).second)
+        bb_order.push_back(bb);
+    }
+
     // Iterate over each basic block in turn.
-    for (Function::iterator func_iter = function.begin();
-         func_iter != function.end();
-         func_iter++) {
+    for (auto bb_iter = bb_order.begin(); bb_iter != bb_order.end(); bb_iter++) {
       // Perform per-basic-block variable initialization.
-      BasicBlock& bb = *func_iter;
+      BasicBlock& bb = **bb_iter;
       if (bb.getName() == "bf_entry")
         continue;  // Don't instrument the basic block we just added.
       LLVMContext& bbctx = bb.getContext();
@@ -856,6 +1114,18 @@ namespace bytesflops_pass {
       int must_clear = 0;   // Keep track of which counters we need to clear.
       uint64_t num_insts = bb.size();
 
+      // Defer the basic block's constant counter increments to the end of
+      // the block or, if the block is a hoisted loop, to the loop exit.  If
+      // the block is a hoisted loop's exit, clear the counters to which the
+      // loop's increments are applied.
+      auto hoist_iter = hoisted_loops.find(&bb);
+      current_hoist = hoist_iter == hoisted_loops.end() ? nullptr : &hoist_iter->second;
+      bb_tallies.clear();
+      deferred_tallies = current_hoist == nullptr ? &bb_tallies : &current_hoist->tallies;
+      for (auto hl_iter = hoisted_loops.begin(); hl_iter != hoisted_loops.end(); hl_iter++)
+        if (hl_iter->second.exit_bb == &bb)
+          must_clear |= hl_iter->second.must_clear;
+
       // Insert an "unreachable" instruction as a sentinel before the real
       // terminator instruction.  New code is inserted before the real
       // terminator, and instrumentation stops at the sentinel.
@@ -945,7 +1215,11 @@ namespace bytesflops_pass {
 
       // Add one last bit of code then release the mega-lock and elide
       // the sentinel terminator.
+      if (current_hoist != nullptr)
+        current_hoist->must_clear = must_clear;
       insert_end_bb_code(module, keyval, num_insts, must_clear, terminator_inst);
+      current_hoist = nullptr;
+      deferred_tallies = nullptr;
       if (ThreadSafety)
         callinst_create(release_mega_lock, &*terminator_inst);
       unreachable->eraseFromParent();
@@ -1073,6 +1347,24 @@ namespace bytesflops_pass {
                                          /*Name=*/       "bf_fnames");
       mark_as_used(module, gvar_fnames);
 
+      // Register the module's stride table with the run-time library.
+      if (TrackStrides)
+        create_stride_table_ctor(&module);
+
+      // Register the module's edge profile with the run-time library.
+      if (EdgeProfile && num_profile_points > 0)
+        create_edge_profile_ctor(&module);
+
+      // Register the module's basic-block execution counters with the
+      // run-time library.
+      if (InstrumentEveryBB && !bb_infos.empty())
+        create_bb_counts_ctor(&module);
+
+      // Register the module's vector-operation counters with the run-time
+      // library.
+      if (vector_counts_var != nullptr && !vector_infos.empty())
+        create_vector_counts_ctor(&module);
+
       // Now insert callto create the function map into the module constructor.
       create_func_map_ctor(module, (uint32_t)func_key_map.size(),
                            array_key_pointer, array_fnames_pointer);
@@ -30,14 +30,14 @@ set -x
   "$bf_clang" -bf-plugin="$top_builddir/lib/bytesflops/.libs/bytesflops.so" \
 	      -bf-verbose -O2 -g -o simple-clang-many-opts "$srcdir/simple.c" \
 	      -L"$top_builddir/lib/byfl/.libs" \
-	      -bf-unique-bytes -bf-by-func -bf-call-stack -bf-vectors -bf-every-bb -bf-reuse-dist -bf-mem-footprint -bf-types -bf-inst-mix -bf-data-structs -bf-inst-deps -bf-strides -bf-disable=byfl
+	      -bf-unique-bytes -bf-by-func -bf-call-stack -bf-vectors -bf-every-bb -bf-reuse-dist -bf-mem-footprint -bf-shadow-mem -bf-types -bf-inst-mix -bf-data-structs -bf-heap-events=1 -bf-alloc-context=4 -bf-inst-deps -bf-strides -bf-epoch-ops=1000 -bf-disable=byfl
 
 # Test 3: Can the Byfl wrapper script compile, instrument, and link a program?
 "$PERL" -I"$top_srcdir/tools/wrappers" \
   "$bf_clang" -bf-plugin="$top_builddir/lib/bytesflops/.libs/bytesflops.so" \
               -bf-verbose -O2 -g -o simple-clang-many-opts "$srcdir/simple.c" \
               -L"$top_builddir/lib/byfl/.libs" \
-              -bf-unique-bytes -bf-by-func -bf-call-stack -bf-vectors -bf-every-bb -bf-reuse-dist -bf-mem-footprint -bf-types -bf-inst-mix -bf-data-structs -bf-inst-deps -bf-strides
+              -bf-unique-bytes -bf-by-func -bf-call-stack -bf-vectors -bf-every-bb -bf-reuse-dist -bf-mem-footprint -bf-shadow-mem -bf-types -bf-inst-mix -bf-data-structs -bf-heap-events=1 -bf-alloc-context=4 -bf-inst-deps -bf-strides -bf-epoch-ops=1000
 
 # Test 4: Does the Byfl-instrumented program run without error?
 env LD_LIBRARY_PATH="$top_builddir/lib/byfl/.libs:$LD_LIBRARY_PATH" \
@@ -49,3 +49,34 @@ int_ops=`"$top_builddir/tools/postproc/bfbin2csv" --include=Program --flat-outpu
 if [ ! -z "$int_ops" ] && [ "$int_ops" -lt 100000 ] ; then
     exit 1
 fi
+
+# Test 6: Can the Byfl wrapper script compile, instrument, and link a program
+# that allocates heap memory using the options that are mutually exclusive
+# with some of the above?
+"$PERL" -I"$top_srcdir/tools/wrappers" \
+  "$bf_clang" -bf-plugin="$top_builddir/lib/bytesflops/.libs/bytesflops.so" \
+              -bf-verbose -O2 -g -o simple-clang-many-opts-alt "$srcdir/simple-heap.c" \
+              -L"$top_builddir/lib/byfl/.libs" \
+              -bf-unique-bytes=approx -bf-strides -bf-data-structs -bf-heap-ms=1 -bf-alloc-context=4 -bf-epoch-ms=1
+
+# Test 7: Does the alternate Byfl-instrumented program run without error?
+env LD_LIBRARY_PATH="$top_builddir/lib/byfl/.libs:$LD_LIBRARY_PATH" \
+  ./simple-clang-many-opts-alt
+
+# Test 8: Can the Byfl wrapper script compile, instrument, and link a program
+# that tracks unique bytes in shadow memory?  (Without -bf-mem-footprint, the
+# shadow bitmap is updated inline.)
+"$PERL" -I"$top_srcdir/tools/wrappers" \
+  "$bf_clang" -bf-plugin="$top_builddir/lib/bytesflops/.libs/bytesflops.so" \
+              -bf-verbose -O2 -g -o simple-clang-many-opts-shadow "$srcdir/simple-heap.c" \
+              -L"$top_builddir/lib/byfl/.libs" \
+              -bf-unique-bytes -bf-shadow-mem -bf-by-func -bf-types -bf-inst-mix
+
+# Test 9: Does the shadow-memory Byfl-instrumented program run without error,
+# and does it observe at least one unique address?
+env LD_LIBRARY_PATH="$top_builddir/lib/byfl/.libs:$LD_LIBRARY_PATH" \
+  ./simple-clang-many-opts-shadow
+unique_addrs=`"$top_builddir/tools/postproc/bfbin2csv" --include=Program --flat-output simple-clang-many-opts-shadow.byfl | "$AWK" -F, '$3 ~ /Unique addresses/ {print $4}'`
+if [ -z "$unique_addrs" ] || [ "$unique_addrs" -eq 0 ] ; then
+    exit 1
+fi
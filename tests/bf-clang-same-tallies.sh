@@ -0,0 +1,68 @@
+#! /bin/sh
+
+###########################################
+# Ensure that options that merely change  #
+# how Byfl counts don't change the counts #
+###########################################
+
+# Define some helper variables.  The ":-" ones will normally be
+# provided by the Makefile.
+AWK=${AWK:-awk}
+PERL=${PERL:-perl}
+srcdir=${srcdir:-../../tests}
+top_srcdir=${top_srcdir:-../..}
+top_builddir=${top_builddir:-..}
+bf_clang="$top_builddir/tools/wrappers/bf-clang"
+bfbin2csv="$top_builddir/tools/postproc/bfbin2csv"
+
+# Log everything we do.  Fail on the first error.
+set -e
+set -x
+
+# Compile simple.c with a set of Byfl options (argument 1) and again with an
+# additional option (argument 2), run both programs, and ensure that they
+# report identical contents for each of the named tables (remaining
+# arguments).
+compare_tallies () {
+  base_opts="$1"
+  extra_opt="$2"
+  shift 2
+
+  # Can the Byfl wrapper script compile, instrument, and link the program
+  # both with and without the additional option?
+  "$PERL" -I"$top_srcdir/tools/wrappers" \
+    "$bf_clang" -bf-plugin="$top_builddir/lib/bytesflops/.libs/bytesflops.so" \
+                -bf-verbose -O2 -g -o simple-clang-same-tallies-a "$srcdir/simple.c" \
+                -L"$top_builddir/lib/byfl/.libs" \
+                $base_opts
+  "$PERL" -I"$top_srcdir/tools/wrappers" \
+    "$bf_clang" -bf-plugin="$top_builddir/lib/bytesflops/.libs/bytesflops.so" \
+                -bf-verbose -O2 -g -o simple-clang-same-tallies-b "$srcdir/simple.c" \
+                -L"$top_builddir/lib/byfl/.libs" \
+                $base_opts $extra_opt
+
+  # Do both Byfl-instrumented programs run without error?
+  env LD_LIBRARY_PATH="$top_builddir/lib/byfl/.libs:$LD_LIBRARY_PATH" \
+    ./simple-clang-same-tallies-a
+  env LD_LIBRARY_PATH="$top_builddir/lib/byfl/.libs:$LD_LIBRARY_PATH" \
+    ./simple-clang-same-tallies-b
+
+  # Do both programs report the same tallies?
+  for table in "$@" ; do
+    "$bfbin2csv" --include="$table" --flat-output simple-clang-same-tallies-a.byfl > simple-clang-same-tallies-a.csv
+    "$bfbin2csv" --include="$table" --flat-output simple-clang-same-tallies-b.byfl > simple-clang-same-tallies-b.csv
+    cmp simple-clang-same-tallies-a.csv simple-clang-same-tallies-b.csv
+  done
+}
+
+# Test 1: Does hoisting loop counters to the loop exit preserve the
+# program-wide and per-function totals?
+compare_tallies "-bf-by-func" "-bf-hoist-loops" Program Functions
+
+# Test 2: Does counting control-flow edges instead of basic blocks preserve
+# the program-wide totals and instruction mix?
+compare_tallies "-bf-inst-mix" "-bf-edge-profile" Program "Instruction mix"
+
+# Test 3: Does tallying statically determined strides once per loop execution
+# produce the same strides as tracking every access at run time?
+compare_tallies "-bf-strides" "-bf-dynamic-strides" "Strided accesses"
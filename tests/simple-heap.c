@@ -0,0 +1,36 @@
+/***********************************
+ * Do some simple, pointless work  *
+ * on the heap                     *
+ * By Scott Pakin <pakin@lanl.gov> *
+ ***********************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Allocate memory through a wrapper so allocation contexts matter. */
+static double *my_alloc (size_t n)
+{
+  return (double *) malloc(n*sizeof(double));
+}
+
+int main (int argc, char *argv[])
+{
+  int iters = argc > 1 ? atoi(argv[1]) : 1000;
+  double *a = my_alloc(16);
+  double sum = 0.0;
+  int i, j;
+
+  for (i = 0; i < iters; i++) {
+    double *b = my_alloc(i%64 + 1);
+    for (j = 0; j <= i%64; j++)
+      b[j] = a[j%16] + i;
+    a = (double *) realloc(a, (i%32 + 16)*sizeof(double));
+    for (j = 0; j < 16; j++)
+      a[j] += b[j%(i%64 + 1)];
+    sum += a[i%16];
+    free(b);
+  }
+  printf("Sum is %g\n", sum);
+  free(a);
+  return 0;
+}